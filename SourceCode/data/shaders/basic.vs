@@ -1,3 +1,8 @@
+#ifdef USE_LAYERED_CUBEMAP
+	#extension GL_ARB_shader_viewport_layer_array : enable
+	#extension GL_AMD_vertex_shader_layer : enable
+#endif
+
 attribute vec3 a_vertex;
 attribute vec3 a_normal;
 attribute vec2 a_uv;
@@ -5,9 +10,35 @@ attribute vec4 a_color;
 
 uniform vec3 u_camera_pos;
 
-uniform mat4 u_model;
+#ifdef USE_MULTIDRAW
+	//per draw data of the DrawBatch, indexed with the draw id
+	struct sDrawData {
+		mat4 model;
+		vec4 params; //x: material index, yzw: material params
+		vec4 probes; //xy: reflection probes of the batch, zw: weights
+	};
+	layout(std430, binding = 0) buffer DrawData {
+		sDrawData u_draws[];
+	};
+	in int a_draw_id;
+	varying vec4 v_draw_probes;
+#else
+	uniform mat4 u_model;
+#endif
 uniform mat4 u_viewprojection;
 
+#ifdef USE_LAYERED_CUBEMAP
+	//the faces of a reflection probe in one draw, an instance per face
+	uniform mat4 u_face_viewprojection[6];
+#endif
+
+#ifdef USE_MATERIAL_ATLAS
+	#ifndef USE_MULTIDRAW
+		uniform vec4 u_draw_params; //the same params when drawn alone
+	#endif
+	varying vec4 v_draw_params; //layer of the atlas and factors
+#endif
+
 //this will store the color for the pixel shader
 varying vec3 v_position;
 varying vec3 v_world_position;
@@ -17,12 +48,18 @@ varying vec4 v_color;
 
 void main()
 {	
+#ifdef USE_MULTIDRAW
+	mat4 model = u_draws[a_draw_id].model;
+#else
+	mat4 model = u_model;
+#endif
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (model * vec4( a_normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
 	v_position = a_vertex;
-	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
+	v_world_position = (model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
 	v_color = a_color;
@@ -30,6 +67,23 @@ void main()
 	//store the texture coordinates
 	v_uv = a_uv;
 
+#ifdef USE_MULTIDRAW
+	v_draw_probes = u_draws[a_draw_id].probes;
+#endif
+
+#ifdef USE_MATERIAL_ATLAS
+#ifdef USE_MULTIDRAW
+	v_draw_params = u_draws[a_draw_id].params;
+#else
+	v_draw_params = u_draw_params;
+#endif
+#endif
+
 	//calcule the position of the vertex using the matrices
+#ifdef USE_LAYERED_CUBEMAP
+	gl_Layer = gl_InstanceID;
+	gl_Position = u_face_viewprojection[gl_InstanceID] * vec4( v_world_position, 1.0 );
+#else
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
+#endif
 }
\ No newline at end of file
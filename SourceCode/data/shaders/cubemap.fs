@@ -37,13 +37,12 @@ void main()
 
 	vec4 color = u_color * textureCube( u_texture, E );
 
-	color = pow(color, vec4(1.0/2.2));
-
 	// uncharted 
 	color.rgb = toneMapUncharted(color.rgb);
 
 	// simple
 	//color /= (color + vec4(1.0));
 
+	//the sRGB framebuffer encodes it
 	gl_FragColor = color;
 }
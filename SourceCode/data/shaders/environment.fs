@@ -0,0 +1,18 @@
+#if __VERSION__ >= 130
+	#define textureCubeLod textureLod
+#else
+	#extension GL_ARB_shader_texture_lod : enable
+#endif
+
+varying vec3 v_world_position;
+
+uniform samplerCube u_texture;
+uniform vec3 u_camera_position;
+
+// the radiance of the environment in the direction, read like the materials do (no flip nor tone map)
+// it is the background of the reflection probes, so they only change what the nodes around cover
+void main()
+{
+	vec3 E = normalize(v_world_position - u_camera_position);
+	gl_FragColor = vec4(textureCubeLod(u_texture, E, 0.0).rgb, 1.0);
+}
@@ -0,0 +1,71 @@
+#if __VERSION__ >= 130
+	#define textureCubeLod textureLod
+#else
+	#extension GL_ARB_shader_texture_lod : enable
+#endif
+
+#define PI 3.14159265359
+#define NUM_SAMPLES 64
+
+varying vec3 v_world_position;
+
+uniform samplerCube u_texture; // the capture of the probe, with box filtered mips
+uniform vec3 u_camera_position;
+uniform float u_roughness;
+uniform float u_size; // of the faces of the capture
+
+// the bits of i mirrored around the point, without integer operations
+float radicalInverse(float i)
+{
+	float result = 0.0;
+	float f = 0.5;
+	for (int b = 0; b < 16; ++b)
+	{
+		result += mod(i, 2.0) * f;
+		i = floor(i * 0.5);
+		f *= 0.5;
+	}
+	return result;
+}
+
+// the GGX lobe of the roughness around the direction (view = normal) like the environment baker does for the HDRE levels,
+// every sample reads the mip of the capture that covers the solid angle it represents, so a few of them dont show noise
+void main()
+{
+	vec3 N = normalize(v_world_position - u_camera_position);
+	if (u_roughness == 0.0)
+	{
+		gl_FragColor = vec4(textureCubeLod(u_texture, N, 0.0).rgb, 1.0);
+		return;
+	}
+
+	vec3 up = abs(N.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+	vec3 T = normalize(cross(up, N));
+	vec3 B = cross(N, T);
+	float a = u_roughness * u_roughness;
+	float a2 = a * a;
+	float texel_solid_angle = 4.0 * PI / (6.0 * u_size * u_size);
+
+	vec3 sum = vec3(0.0);
+	float total = 0.0;
+	for (int i = 0; i < NUM_SAMPLES; ++i)
+	{
+		float xi1 = float(i) / float(NUM_SAMPLES);
+		float xi2 = radicalInverse(float(i));
+		float cos_theta = sqrt((1.0 - xi2) / (1.0 + (a2 - 1.0) * xi2));
+		float sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+		float phi = 2.0 * PI * xi1;
+		vec3 H = T * (sin_theta * cos(phi)) + B * (sin_theta * sin(phi)) + N * cos_theta;
+		vec3 L = 2.0 * cos_theta * H - N;
+		float NdotL = 2.0 * cos_theta * cos_theta - 1.0;
+		if (NdotL <= 0.0)
+			continue;
+
+		float d = a2 / (PI * pow((a2 - 1.0) * cos_theta * cos_theta + 1.0, 2.0));
+		float sample_solid_angle = 1.0 / (float(NUM_SAMPLES) * d * 0.25); // pdf = D * NdotH / (4 * VdotH) with N = V
+		float lod = max(0.0, 0.5 * log2(sample_solid_angle / texel_solid_angle) + 1.0);
+		sum += textureCubeLod(u_texture, L, lod).rgb * NdotL;
+		total += NdotL;
+	}
+	gl_FragColor = vec4(sum / max(total, 0.0001), 1.0);
+}
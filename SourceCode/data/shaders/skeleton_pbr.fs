@@ -1,4 +1,18 @@
 
+#if __VERSION__ >= 130
+	#define textureCubeLod textureLod
+#else
+	#extension GL_ARB_shader_texture_lod : enable
+#endif
+
+#ifdef USE_MATERIAL_ATLAS
+	#if __VERSION__ >= 130
+		#define texture2DArray texture
+	#else
+		#extension GL_EXT_texture_array : enable
+	#endif
+#endif
+
 // declare here your constants
 #define PI				3.14159265359
 #define RECIPROCAL_PI	0.3183098861837697 // 1 / PI
@@ -11,17 +25,29 @@ varying vec2 v_uv;
 uniform vec3 u_camera_position;
 uniform vec4 u_color;
 
-// Levels of HDRE
-uniform samplerCube u_texture;
-uniform samplerCube u_texture_prem_0;
-uniform samplerCube u_texture_prem_1;
-uniform samplerCube u_texture_prem_2;
-uniform samplerCube u_texture_prem_3;
-uniform samplerCube u_texture_prem_4;
+// Levels of HDRE (as mips)
+uniform samplerCube u_env;
+uniform float u_env_max_lod;
+
+// reflection probes around the pixel, blended over the environment (their weights are 0 without them)
+#ifdef USE_MULTIDRAW
+	// the ones of the batch, every draw has the indices of its two and their weights
+	uniform samplerCube u_probes[4];
+	uniform vec4 u_probes_max_lods;
+	varying vec4 v_draw_probes;
+#else
+	uniform samplerCube u_probe_0;
+	uniform samplerCube u_probe_1;
+	uniform vec2 u_probe_weights;
+	uniform vec2 u_probe_max_lods;
+#endif
 
 // BRDF LUT
 uniform sampler2D u_brdf_lut;
 
+// SH9 of the environment already convolved with the lambertian lobe
+uniform vec3 u_sh_diffuse[9];
+
 //variables use boolean
 uniform bool u_use_punctual_light;
 uniform bool u_use_ibl;
@@ -48,6 +74,7 @@ uniform sampler2D u_metal_map;
 
 // Normal Map
 uniform sampler2D u_normal_map;
+uniform bool u_normal_map_xy; //compressed with two channels, z is rebuilt
 
 // Opacity Map
 uniform sampler2D u_opacity_map;
@@ -62,6 +89,23 @@ uniform sampler2D u_occlusion_map;
 
 // Heigh
 uniform sampler2D u_heigh_map;
+uniform sampler2D u_cone_map; //depth and square root of the relaxed cone ratio
+uniform float u_relief_depth; //in texture coordinates
+
+#ifdef USE_PACKED_MAPS
+// Packed maps (one fetch for several single channel maps)
+uniform sampler2D u_orm_map; //occlusion, roughness, metalness
+uniform sampler2D u_ohe_map; //opacity, heigh, emission
+#endif
+
+#ifdef USE_MATERIAL_ATLAS
+// Maps of all the materials of the atlas, one layer each (packed layout)
+uniform sampler2DArray u_albedo_atlas;
+uniform sampler2DArray u_normal_atlas;
+uniform sampler2DArray u_orm_atlas;
+uniform sampler2DArray u_ohe_atlas;
+varying vec4 v_draw_params; //y: layer, z: roughness, w: metallic factor
+#endif
 
 // Lights
 uniform vec3 u_lights_position_1;
@@ -81,25 +125,47 @@ struct Material
 } thisMaterial;
 
 // don't touch this
-// getReflectionColor:	Get pixel from HDRE (passed in separated textures)
+// getReflectionColor:	Get pixel from HDRE (the levels are the mips of the cubemap)
 //						using a 3D direction and a defined roughness
 vec3 getReflectionColor(vec3 r, float roughness)
 {
-	float lod = roughness * 5.0;
-
-	vec4 color;
-
-	if(lod < 1.0) color = mix( textureCube(u_texture, r), textureCube(u_texture_prem_0, r), lod );
-	else if(lod < 2.0) color = mix( textureCube(u_texture_prem_0, r), textureCube(u_texture_prem_1, r), lod - 1.0 );
-	else if(lod < 3.0) color = mix( textureCube(u_texture_prem_1, r), textureCube(u_texture_prem_2, r), lod - 2.0 );
-	else if(lod < 4.0) color = mix( textureCube(u_texture_prem_2, r), textureCube(u_texture_prem_3, r), lod - 3.0 );
-	else if(lod < 5.0) color = mix( textureCube(u_texture_prem_3, r), textureCube(u_texture_prem_4, r), lod - 4.0 );
-	else color = textureCube(u_texture_prem_4, r);
+	return textureCubeLod(u_env, r, roughness * u_env_max_lod).rgb;
+}
 
-	color = pow(color, vec4(1.0/2.2));
+// the local reflections of the probes, the environment gets the weight they leave
+#ifdef USE_MULTIDRAW
+// constant indices, the draws of a batch use different probes
+vec3 getProbeColor(float index, vec3 r, float roughness)
+{
+	if (index < 0.5)
+		return textureCubeLod(u_probes[0], r, roughness * u_probes_max_lods.x).rgb;
+	if (index < 1.5)
+		return textureCubeLod(u_probes[1], r, roughness * u_probes_max_lods.y).rgb;
+	if (index < 2.5)
+		return textureCubeLod(u_probes[2], r, roughness * u_probes_max_lods.z).rgb;
+	return textureCubeLod(u_probes[3], r, roughness * u_probes_max_lods.w).rgb;
+}
 
-	return color.rgb;
+vec3 addProbes(vec3 env_color, vec3 r, float roughness)
+{
+	vec3 color = env_color * (1.0 - v_draw_probes.z - v_draw_probes.w);
+	if (v_draw_probes.z > 0.0)
+		color += getProbeColor(v_draw_probes.x, r, roughness) * v_draw_probes.z;
+	if (v_draw_probes.w > 0.0)
+		color += getProbeColor(v_draw_probes.y, r, roughness) * v_draw_probes.w;
+	return color;
+}
+#else
+vec3 addProbes(vec3 env_color, vec3 r, float roughness)
+{
+	vec3 color = env_color * (1.0 - u_probe_weights.x - u_probe_weights.y);
+	if (u_probe_weights.x > 0.0)
+		color += textureCubeLod(u_probe_0, r, roughness * u_probe_max_lods.x).rgb * u_probe_weights.x;
+	if (u_probe_weights.y > 0.0)
+		color += textureCubeLod(u_probe_1, r, roughness * u_probe_max_lods.y).rgb * u_probe_weights.y;
+	return color;
 }
+#endif
 
 // don't touch these neither
 // perturbNormal:	Modify material normal using normal texture
@@ -121,6 +187,8 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv){
 vec3 perturbNormal( vec3 N, vec3 V, vec2 texcoord, vec3 normal_pixel ){
 
 	normal_pixel = normal_pixel * 255./127. - 128./127.;
+	if (u_normal_map_xy)
+		normal_pixel.z = sqrt(max(0.0, 1.0 - dot(normal_pixel.xy, normal_pixel.xy)));
 	mat3 TBN = cotangent_frame(N, V, texcoord);
 	return normalize(TBN * normal_pixel);
 }
@@ -131,20 +199,20 @@ vec3 computePunctualLight(vec3 N, vec3 V, vec3 L, vec3 H){
 	// (punctual diffuse component)
 	vec3 f_lambert = thisMaterial.f_diffuse / PI;	//diffuse
 	
-	vec3 F = thisMaterial.f_specular + (1 - thisMaterial.f_specular)*pow(1-dot(L,N),5);
+	vec3 F = thisMaterial.f_specular + (1.0 - thisMaterial.f_specular)*pow(1.0-dot(L,N),5.0);
 	
 	// distribution function
-	float alpha = pow(thisMaterial.roughness,2);
-	float D = pow(alpha,2) / (PI * pow((pow(dot(N,H),2) * (pow(alpha,2) - 1) + 1),2));
+	float alpha = pow(thisMaterial.roughness,2.0);
+	float D = pow(alpha,2.0) / (PI * pow((pow(dot(N,H),2.0) * (pow(alpha,2.0) - 1.0) + 1.0),2.0));
 	
 	// geometry distribution function	
-	float k = pow(thisMaterial.roughness + 1, 2) / 8;
-	float G_1_v = dot(N,V) / (dot(N,V) * (1 - k) + k) ;
-	float G_1_l = dot(N,L) / (dot(N,L) * (1 - k) + k) ;
+	float k = pow(thisMaterial.roughness + 1.0, 2.0) / 8.0;
+	float G_1_v = dot(N,V) / (dot(N,V) * (1.0 - k) + k) ;
+	float G_1_l = dot(N,L) / (dot(N,L) * (1.0 - k) + k) ;
 	float G = G_1_l * G_1_v;
 	
 	//BRDF facet (punctual specular component)
-	vec3 f_pfacet = (F * G * D) / (4 * dot(N,L) * dot(N,V));
+	vec3 f_pfacet = (F * G * D) / (4.0 * dot(N,L) * dot(N,V));
 	
 	//Punctual light BRDF
 	vec3 f_pl = f_lambert + f_pfacet;
@@ -152,32 +220,121 @@ vec3 computePunctualLight(vec3 N, vec3 V, vec3 L, vec3 H){
 	return f_pl * clamp(dot(L,N),0.000001,0.999999);
 }
 
+// getSHDiffuse:	Diffuse light of the environment for a normal (irradiance / PI), no texture fetches
+vec3 getSHDiffuse(vec3 n)
+{
+	return u_sh_diffuse[0] * 0.282095
+		+ (u_sh_diffuse[1] * n.y + u_sh_diffuse[2] * n.z + u_sh_diffuse[3] * n.x) * 0.488603
+		+ (u_sh_diffuse[4] * (n.x * n.y) + u_sh_diffuse[5] * (n.y * n.z) + u_sh_diffuse[7] * (n.x * n.z)) * 1.092548
+		+ u_sh_diffuse[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+		+ u_sh_diffuse[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
+
 vec3 computeIBL(vec3 N, vec3 V, vec3 L){
 	
-	//store albedo information
-	vec2 xy =  vec2(thisMaterial.roughness,clamp(dot(N,L),0.01,0.99));
+	//split sum LUT: s is the roughness and t the NdotV
+	vec2 xy =  vec2(thisMaterial.roughness,clamp(dot(N,V),0.01,0.99));
 	vec4 LUT_value = texture2D(u_brdf_lut,xy);
 	
-	//IBL specular component
+	//scale and bias of F0
 	float A = LUT_value.x;
-	
-	//IBL diffuse component
 	float B = LUT_value.y;
 	
 	//IBL BRDF 
 	vec3 f_ibl = (thisMaterial.f_specular * A + B);
 	
-	vec3 prem_color = thisMaterial.occlusion * getReflectionColor((reflect(V,N)),thisMaterial.roughness);
+	vec3 R = reflect(V,N);
+	vec3 prem_color = thisMaterial.occlusion * addProbes(getReflectionColor(R,thisMaterial.roughness), R, thisMaterial.roughness);
+
+	//IBL diffuse (lambert) from the SH
+	vec3 diffuse_color = thisMaterial.occlusion * thisMaterial.f_diffuse * max(getSHDiffuse(N), vec3(0.0));
 
-	return f_ibl * prem_color;
+	return f_ibl * prem_color + diffuse_color;
 }
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
-{ 
-    float height =  texture2D(u_heigh_map, texCoords).r;    
-    vec2 p = viewDir.xy / viewDir.z * (height * 1);
-    return texCoords - p;    
-} 
+// map fetches, from the layer of the atlas or the textures of the material
+vec4 getAlbedo(vec2 uv)
+{
+#ifdef USE_MATERIAL_ATLAS
+	return texture2DArray(u_albedo_atlas, vec3(uv, v_draw_params.y));
+#else
+	return texture2D(u_albedo_map, uv);
+#endif
+}
+
+vec3 getNormalPixel(vec2 uv)
+{
+#ifdef USE_MATERIAL_ATLAS
+	return texture2DArray(u_normal_atlas, vec3(uv, v_draw_params.y)).rgb;
+#else
+	return texture2D(u_normal_map, uv).rgb;
+#endif
+}
+
+#ifdef USE_PACKED_MAPS
+vec3 getORM(vec2 uv)
+{
+#ifdef USE_MATERIAL_ATLAS
+	return texture2DArray(u_orm_atlas, vec3(uv, v_draw_params.y)).rgb;
+#else
+	return texture2D(u_orm_map, uv).rgb;
+#endif
+}
+
+vec3 getOHE(vec2 uv)
+{
+#ifdef USE_MATERIAL_ATLAS
+	return texture2DArray(u_ohe_atlas, vec3(uv, v_draw_params.y)).rgb;
+#else
+	return texture2D(u_ohe_map, uv).rgb;
+#endif
+}
+#endif
+
+float getHeight(vec2 uv)
+{
+#ifdef USE_PACKED_MAPS
+	return getOHE(uv).g;
+#else
+	return texture2D(u_heigh_map, uv).r;
+#endif
+}
+
+#define CONE_STEPS 12
+#define BINARY_STEPS 6
+
+//relaxed cone stepping (Policarpo and Oliveira): the cones take the view ray over the empty space and it stops inside the relief
+//before crossing it twice, so a binary search between the top and that point finds the first hit
+vec2 reliefMapping(vec2 uv, vec3 N, vec3 V)
+{
+	//view ray in texture space, z goes from the top of the relief (0) to its bottom (1)
+	mat3 TBN = cotangent_frame(N, v_world_position, uv);
+	vec3 ray = vec3(-dot(V, normalize(TBN[0])), -dot(V, normalize(TBN[1])), max(dot(V, N), 0.05));
+	vec3 dir = vec3(ray.xy * (u_relief_depth / ray.z), 1.0);
+	float dist = length(dir.xy);
+
+	vec3 p = vec3(uv, 0.0);
+	for (int i = 0; i < CONE_STEPS; ++i)
+	{
+		vec2 cone = texture2D(u_cone_map, p.xy).rg;
+		float ratio = cone.g * cone.g;
+		float height = clamp(cone.r - p.z, 0.0, 1.0);
+		p += dir * (ratio * height / max(dist + ratio, 0.0001));
+	}
+
+	//the heigh map has more detail than the cones
+	dir *= p.z * 0.5;
+	p = vec3(uv, 0.0) + dir;
+	for (int i = 0; i < BINARY_STEPS; ++i)
+	{
+		dir *= 0.5;
+		if (p.z < 1.0 - getHeight(p.xy))
+			p += dir;
+		else
+			p -= dir;
+	}
+	return p.xy;
+}
 
 void setMaterialProperties(vec2 uv){
 	
@@ -187,36 +344,60 @@ void setMaterialProperties(vec2 uv){
 	thisMaterial.metalness = 0.1;
 	thisMaterial.occlusion = 0.1;
 	thisMaterial.emission = 0.1;
+
+#ifdef USE_PACKED_MAPS
+	vec3 orm = getORM(uv);
+	vec3 ohe = getOHE(uv);
+	float rough_value = orm.g;
+	float metal_value = orm.b;
+	float opacity_value = ohe.r;
+	float occlusion_value = orm.r;
+	float emission_value = ohe.b;
+#else
+	float rough_value = u_use_rough_map ? texture2D(u_roughness_map, uv).x : 0.0;
+	float metal_value = u_use_metal_map ? texture2D(u_metal_map, uv).b : 0.0;
+	float opacity_value = u_use_opacity_map ? texture2D(u_opacity_map, uv).x : 0.0;
+	float occlusion_value = u_use_occlusion_map ? texture2D(u_occlusion_map, uv).x : 0.0;
+	float emission_value = u_use_emission_map ? texture2D(u_emission_map, uv).x : 0.0;
+#endif
+	
+#ifdef USE_MATERIAL_ATLAS
+	float roughness_factor = v_draw_params.z;
+	float metallic_factor = v_draw_params.w;
+#else
+	float roughness_factor = u_roughness;
+	float metallic_factor = u_metallic_fact;
+#endif
 	
 	// Roughness
-	if (u_use_rough_map)	thisMaterial.roughness = texture2D(u_roughness_map, uv).x;
-	else	thisMaterial.roughness = u_roughness;
+	if (u_use_rough_map)	thisMaterial.roughness = rough_value;
+	else	thisMaterial.roughness = roughness_factor;
 	
 	// Metalness
-	if (u_use_metal_map)	thisMaterial.metalness = texture2D(u_metal_map, uv ).b;
-	else	thisMaterial.metalness = u_metallic_fact;
+	if (u_use_metal_map)	thisMaterial.metalness = metal_value;
+	else	thisMaterial.metalness = metallic_factor;
 	
 	// Albedo
-	if (u_use_albedo)	thisMaterial.color = texture2D(u_albedo_map, uv);
+	if (u_use_albedo)	thisMaterial.color = getAlbedo(uv);
 	else	thisMaterial.color = u_color;
 	
 	// Opacity
-	if (u_use_opacity_map)	thisMaterial.color.a = texture2D(u_opacity_map, uv).x;
+	if (u_use_opacity_map)	thisMaterial.color.a = opacity_value;
 	
 	// Occlusion
-	if (u_use_occlusion_map)	thisMaterial.occlusion = texture2D(u_occlusion_map, uv).x;
+	if (u_use_occlusion_map)	thisMaterial.occlusion = occlusion_value;
 	else	thisMaterial.occlusion = u_occlusion_factor;
 	
 	// Emission
-	if (u_use_emission_map)	thisMaterial.emission = texture2D(u_emission_map, uv).x;
+	if (u_use_emission_map)	thisMaterial.emission = emission_value;
 	else	thisMaterial.emission = u_emission_fact;
 	
 	// personalized way to apply emission (probably not the correct one, but it does something similar)
 	thisMaterial.occlusion = thisMaterial.occlusion + thisMaterial.emission;
 	
 	//Diffuse and specular components of the material
-	thisMaterial.f_diffuse = mix(vec3(0), thisMaterial.color, 1 - thisMaterial.metalness).rgb;
-	thisMaterial.f_specular = mix(vec3(0.04), thisMaterial.color, thisMaterial.metalness).rgb;
+	thisMaterial.f_diffuse = mix(vec3(0.0), thisMaterial.color.rgb, 1.0 - thisMaterial.metalness);
+	thisMaterial.f_specular = mix(vec3(0.04), thisMaterial.color.rgb, thisMaterial.metalness);
 }
 
 void main()
@@ -232,25 +413,19 @@ void main()
 	vec3 L = normalize(light_pos - world_position);
 	vec3 H = normalize(V + L);
 	
-	vec2 uv = v_uv * 3;
+	vec2 uv = v_uv * 3.0;
 	
-	//1st try of height map
-	//vec2 uv = ParallaxMapping(v_uv,V) * 3;
+	//relief mapping, the maps are read where the view ray hits the heigh map
+	if (u_use_heigh_map)
+		uv = reliefMapping(uv, N, V);
 
 	//use maps to define material properties and the f's.
 	setMaterialProperties(uv);
-	
-	//2nd try of height map (we try to move the world position towards the normal direction)
-	if (u_use_heigh_map){
-		float step = texture2D(u_heigh_map, uv).r;
-		vec3 step3 = normalize(v_normal) * step;
-		world_position = v_world_position + step3;
-	}
 
 	//normal map
 	if (u_use_normal_map){
-		vec3 normal_pixel = texture2D(u_normal_map, uv).rgb;
-		N = perturbNormal(normalize(v_normal),V,uv,normal_pixel);
+		vec3 normal_pixel = getNormalPixel(uv);
+		N = perturbNormal(normalize(v_normal),V,v_uv * 3.0,normal_pixel);
 	}
 	
 	
@@ -271,8 +446,7 @@ void main()
 	// simple tone-mapping
 	//thisMaterial.color.rgb /= (thisMaterial.color.rgb + vec3(1.0));
 	
-	// gamma correct 
-	//color.rgb = pow(color.rgb, vec3(1.0/2.2));
+	// gamma correct: done by the sRGB framebuffer when writing
 
 	// Final color
 	gl_FragColor = thisMaterial.color;
@@ -6,6 +6,7 @@
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "debugdraw.h"
 
 Skeleton::Skeleton()
 {
@@ -93,8 +94,6 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 
 void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, bool render_points)
 {
-	Mesh m;
-
 	for (int i = 1; i < num_bones; ++i)
 	{
 		Bone& bone = bones[i];
@@ -102,26 +101,16 @@ void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4 color, boo
 		Vector3 v2;
 		Matrix44 parent_global_matrix = global_bone_matrices[ bone.parent ];
 		Matrix44 global_matrix = global_bone_matrices[i];
-		v1 = global_matrix * v1;
-		v2 = parent_global_matrix * v2;
-		m.vertices.push_back(v1);
-		m.vertices.push_back(v2);
-	}
-
-	Shader* shader = Shader::getDefaultShader("flat");
-	shader->enable();
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-	shader->setUniform("u_model", model);
-	shader->setUniform("u_color", color);
-	m.render(GL_LINES);
-	if (render_points)
-	{
-		shader->setUniform("u_color", color * 2);
-		glPointSize(10);
-		m.render(GL_POINTS);
-		glPointSize(1);
+		v1 = model * (global_matrix * v1);
+		v2 = model * (parent_global_matrix * v2);
+		DebugDraw::addLine(v1, v2, color);
+		if (render_points)
+		{
+			//around 10 pixels, like the old glPointSize
+			DebugDraw::addPoint(v1, camera->eye.distance(v1) * 0.02f, color * 2);
+			DebugDraw::addPoint(v2, camera->eye.distance(v2) * 0.02f, color * 2);
+		}
 	}
-	shader->disable();
 }
 
 void Skeleton::applyTransformToBones(const char* root, Matrix44 transform)
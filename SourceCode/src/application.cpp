@@ -7,7 +7,15 @@
 #include "shader.h"
 #include "input.h"
 #include "animation.h"
-#include "extra/hdre.h"
+#include "environment.h"
+#include "drawbatch.h"
+#include "streambuffer.h"
+#include "debugdraw.h"
+#include "textureuploader.h"
+#include "texturestreamer.h"
+#include "materialatlas.h"
+#include "reflectionprobe.h"
+#include "conemap.h"
 #include "includes.h"
 
 #include <cmath>
@@ -24,6 +32,10 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	must_exit = false;
 	render_debug = true;
 	render_wireframe = false;
+	use_multidraw = true;
+	draw_batch = new DrawBatch();
+	use_material_atlas = false;
+	material_atlas = NULL;
 
 	fps = 0;
 	frame = 0;
@@ -34,6 +46,18 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	// OpenGL flags
 	glEnable( GL_CULL_FACE ); //render both sides of every triangle
 	glEnable( GL_DEPTH_TEST ); //check the occlusions using the Z buffer
+	if (getGLVersion() >= 32)
+		glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS ); //filter across the faces, the rough mips of the environment show the seams otherwise
+
+	//the lighting is computed in linear space, the backbuffer encodes it to sRGB
+	GLint encoding = GL_LINEAR;
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+	srgb_fbo = NULL;
+	if (encoding != GL_SRGB)
+	{
+		std::cout << "[WARN] the backbuffer is not sRGB, the frame is encoded by an extra pass" << std::endl;
+		srgb_fbo = new FBO();
+	}
 
 	// Create camera
 	camera = new Camera();
@@ -59,46 +83,61 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	node->mesh = Mesh::Get("data/meshes/sphere.obj.mbin");
 	node->model.setScale(2, 2, 2);
 
-	HDRE* hdre = new HDRE("data/environments/environment.hdre");
-	//Texture* cubemapTex = new Texture();
-	//cubemapTex->createCubemap(hdre->width, hdre->height, (uint8**)hdre->getFaces(0));
+	//the first one loaded becomes the current, shared by all the PBR materials
+	Environment::Get("data/environments/environment.hdre");
 
 	// Create node material
-	PBRMaterial * material = new PBRMaterial(hdre);
+	PBRMaterial * material = new PBRMaterial();
 	node->material = material;
-	material->environment = hdre;
 	// Manipulate material
 	material->color = vec4(1.0, 1.0, 1.0, 1.0);
 	
 	material->use_properties[PUNCTUAL_LIGHT] = true;
 	material->use_properties[IBL] = true;
-
-	material->brdfLUT = Texture::Get("data/brdfLUT.png");
 	//material->texture = cubemapTex;
-	
-	material->albedo_map = Texture::Get("data/maps/albedo_map.png");
+
+	//only the small mips at first, the finer ones come when the sphere is seen big enough (block compressed)
+	TextureStreamer* streamer = TextureStreamer::getDefault();
+	material->albedo_map = streamer->load("data/maps/albedo_map.png", true, TEXTURE_COLOR);
 	material->use_properties[ALBEDO_MAP] = true;
 
-	material->normal_map = Texture::Get("data/maps/normal_map.png");
+	material->normal_map = streamer->load("data/maps/normal_map.png", true, TEXTURE_NORMAL);
 	material->use_properties[NORMAL_MAP] = true;
 
-	material->rough_map = Texture::Get("data/maps/roughness_map.png");
-	material->use_properties[ROUGH_MAP] = true;
+	//the single channel maps are packed in two textures (the metalness is in the blue of its map)
+	sTextureChannel orm[] = { { "data/maps/occlusion_map.png", 0 }, { "data/maps/roughness_map.png", 0 }, { "data/maps/metal_map.png", 2 } };
+	sTextureChannel ohe[] = { { "data/maps/opacity_map.png", 0 }, { "data/maps/heigh_map.png", 0 }, { "data/maps/emission_map.png", 0 } };
+	Texture* orm_map = Texture::GetPacked(std::vector<sTextureChannel>(orm, orm + 3));
+	Texture* ohe_map = Texture::GetPacked(std::vector<sTextureChannel>(ohe, ohe + 3));
+	if (orm_map && ohe_map)
+	{
+		material->setPackedMaps(orm_map, ohe_map);
 
-	material->metal_map = Texture::Get("data/maps/metal_map.png");
+		//layer 0 of the atlas, more materials with maps of the same size would share its arrays
+		if (use_material_atlas)
+		{
+			material_atlas = new MaterialAtlas((unsigned int)orm_map->width);
+			material->setAtlas(material_atlas);
+		}
+	}
+	else
+	{
+		material->rough_map = Texture::Get("data/maps/roughness_map.png", true, true, TEXTURE_MASK);
+		material->metal_map = Texture::Get("data/maps/metal_map.png", true, true, TEXTURE_MASK);
+		material->opacity_map = Texture::Get("data/maps/opacity_map.png", true, true, TEXTURE_MASK);
+		material->occlusion_map = Texture::Get("data/maps/occlusion_map.png", true, true, TEXTURE_MASK);
+		material->emission_map = Texture::Get("data/maps/emission_map.png", true, true, TEXTURE_MASK);
+		material->heigh_map = Texture::Get("data/maps/heigh_map.png", true, true, TEXTURE_MASK);
+	}
+	material->use_properties[ROUGH_MAP] = true;
 	material->use_properties[METAL_MAP] = true;
-
-	material->opacity_map = Texture::Get("data/maps/opacity_map.png");
 	material->use_properties[OPACITY_MAP] = true;
-
-	material->occlusion_map = Texture::Get("data/maps/occlusion_map.png");
 	material->use_properties[OCCLUSION_MAP] = true;
-
-	material->emission_map = Texture::Get("data/maps/emission_map.png");
 	material->use_properties[EMISSION_MAP] = true;
+	material->use_properties[HEIGH_MAP] = true;
 
-	material->heigh_map = Texture::Get("data/maps/heigh_map.png");
-	material->use_properties[HEIGH_MAP] = false;	//not working very well
+	//relief mapping of the heigh map, with the packed maps too
+	material->cone_map = createConeMap("data/maps/heigh_map.png");
 
 	//hide the cursor
 	SDL_ShowCursor(!mouse_locked); //hide or show the mouse
@@ -107,6 +146,19 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 //what to do when the image has to be draw
 void Application::render(void)
 {
+	//wait until the GPU is done with the dynamic data of some frames ago
+	StreamBuffer::getDefault()->beginFrame();
+
+	//some more data of the textures being loaded
+	TextureUploader::getDefault()->update();
+
+	//the probes whose turn it is, with the budget of the frame
+	ReflectionProbe::update(root);
+
+	//without an sRGB backbuffer the frame goes to a texture that does the same
+	if (srgb_fbo)
+		bindSRGBTarget();
+
 	//set the clear color (the background color)
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 
@@ -116,21 +168,69 @@ void Application::render(void)
 	//set the camera as default
 	camera->enable();
 
+	//mips needed by what is visible, the streamer uploads or drops them
+	for (int i = 0; i < root.size(); i++)
+		if (root[i]->material && root[i]->mesh)
+			root[i]->material->requestTextures(root[i]->mesh, root[i]->model, camera);
+	TextureStreamer::getDefault()->update();
+	if (material_atlas)
+		material_atlas->update();
+
 	//set flags
 	glDisable(GL_BLEND);
 	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
 
-	for (int i = 0; i < root.size(); i++) {
-		root[i]->render(camera);
+	//the materials with linear colors enable the sRGB encoding, the debug and GUI colors are already in sRGB
+	if (use_multidraw && DrawBatch::isSupported())
+	{
+		draw_batch->clear();
+		for (int i = 0; i < root.size(); i++)
+			draw_batch->add(root[i]);
+		draw_batch->render(camera);
+	}
+	else
+		for (int i = 0; i < root.size(); i++)
+			root[i]->render(camera);
 
-		if(render_wireframe)
+	if (render_wireframe)
+		for (int i = 0; i < root.size(); i++)
 			root[i]->renderWireframe(camera);
-	}
 
 	//Draw the floor grid
 	if(render_debug)
 		drawGrid();
+
+	//all the debug primitives of the frame at once
+	DebugDraw::flush(camera);
+
+	//the texture decodes when read, the pass encodes again to the backbuffer (the GUI is drawn after, unencoded)
+	if (srgb_fbo)
+	{
+		srgb_fbo->unbind();
+		glDisable(GL_BLEND);
+		glDisable(GL_DEPTH_TEST);
+		srgb_fbo->color_textures[0]->toViewport(Shader::getDefaultShader("srgb_encode"));
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	StreamBuffer::getDefault()->endFrame();
+}
+
+void Application::bindSRGBTarget()
+{
+	Texture* color = srgb_fbo->color_textures[0];
+	if (!color || color->width != window_width || color->height != window_height)
+	{
+		delete color;
+		delete srgb_fbo->depth_texture;
+		color = new Texture(window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, false, NULL, GL_SRGB8_ALPHA8);
+		color->category = TEXTURE_CATEGORY_RENDER_TARGET;
+		Texture* depth = new Texture(window_width, window_height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
+		depth->category = TEXTURE_CATEGORY_RENDER_TARGET;
+		srgb_fbo->createFromTextures(color, NULL, depth);
+	}
+	srgb_fbo->bind();
 }
 
 void Application::update(double seconds_elapsed)
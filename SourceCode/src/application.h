@@ -10,6 +10,10 @@
 #include "utils.h"
 #include "scenenode.h"
 
+class DrawBatch;
+class MaterialAtlas;
+class FBO;
+
 class Application
 {
 public:
@@ -35,12 +39,18 @@ public:
 	static Camera* camera; //our GLOBAL camera
 	bool mouse_locked; //tells if the mouse is locked (not seen)
 	bool render_wireframe;
+	bool use_multidraw; //submit the nodes grouped by material using the DrawBatch
+	DrawBatch* draw_batch;
+	bool use_material_atlas; //opt-in, the PBR materials read their maps from texture arrays, so the batch draws them together
+	MaterialAtlas* material_atlas;
+	FBO* srgb_fbo; //only when the backbuffer is not sRGB: the frame is drawn to an sRGB texture that a last pass encodes
 
 	Application( int window_width, int window_height, SDL_Window* window );
 
 	//main functions
 	void render( void );
 	void update( double dt );
+	void bindSRGBTarget(); //resized with the window
 
 	//events
 	void onKeyDown( SDL_KeyboardEvent event );
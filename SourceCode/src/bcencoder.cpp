@@ -0,0 +1,457 @@
+#include "bcencoder.h"
+#include "threadpool.h"
+
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define BC_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace {
+
+//the 16 pixels of a block as floats, one array per channel so 4 pixels can be processed at once
+struct sBlock
+{
+	float channels[4][16];
+
+	sBlock(const unsigned char* pixels)
+	{
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+				channels[c][i] = pixels[i * 4 + c];
+	}
+};
+
+inline float clamp255(float v) { return v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v); }
+inline int roundToInt(float v) { return (int)(v + 0.5f); }
+
+//for every pixel finds the closest palette entry using the channels [first, first + num), returns the total squared error
+float findClosest(const sBlock& block, int first, int num, const float palette[][4], int num_entries, int* indices)
+{
+	float total = 0.0f;
+#ifdef BC_USE_SSE2
+	for (int g = 0; g < 16; g += 4)
+	{
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i best_index = _mm_setzero_si128();
+		for (int e = 0; e < num_entries; ++e)
+		{
+			__m128 dist = _mm_setzero_ps();
+			for (int c = first; c < first + num; ++c)
+			{
+				__m128 diff = _mm_sub_ps(_mm_loadu_ps(block.channels[c] + g), _mm_set1_ps(palette[e][c]));
+				dist = _mm_add_ps(dist, _mm_mul_ps(diff, diff));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+			best = _mm_min_ps(dist, best);
+			best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, best_index));
+		}
+		_mm_storeu_si128((__m128i*)(indices + g), best_index);
+		float errors[4];
+		_mm_storeu_ps(errors, best);
+		total += errors[0] + errors[1] + errors[2] + errors[3];
+	}
+#else
+	for (int i = 0; i < 16; ++i)
+	{
+		float best = FLT_MAX;
+		for (int e = 0; e < num_entries; ++e)
+		{
+			float dist = 0.0f;
+			for (int c = first; c < first + num; ++c)
+			{
+				float diff = block.channels[c][i] - palette[e][c];
+				dist += diff * diff;
+			}
+			if (dist < best)
+			{
+				best = dist;
+				indices[i] = e;
+			}
+		}
+		total += best;
+	}
+#endif
+	return total;
+}
+
+//axis of maximum variance of the pixels (power iteration over the covariance matrix)
+void principalAxis(const sBlock& block, int first, int num, float* mean, float* axis)
+{
+	float cov[4][4] = {};
+	for (int c = first; c < first + num; ++c)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; ++i)
+			mean[c] += block.channels[c][i];
+		mean[c] /= 16.0f;
+	}
+	for (int i = 0; i < 16; ++i)
+		for (int a = first; a < first + num; ++a)
+			for (int b = first; b < first + num; ++b)
+				cov[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+
+	for (int c = first; c < first + num; ++c)
+		axis[c] = 1.0f;
+	for (int it = 0; it < 8; ++it)
+	{
+		float v[4] = {};
+		float len = 0.0f;
+		for (int a = first; a < first + num; ++a)
+		{
+			for (int b = first; b < first + num; ++b)
+				v[a] += cov[a][b] * axis[b];
+			len += v[a] * v[a];
+		}
+		if (len < 1e-10f)
+			break; //flat block, any axis is fine
+		len = 1.0f / sqrtf(len);
+		for (int c = first; c < first + num; ++c)
+			axis[c] = v[c] * len;
+	}
+}
+
+//endpoints at both ends of the pixels projected on the principal axis, e0 is the end with the largest projection
+void initialEndpoints(const sBlock& block, int first, int num, float inset, float* e0, float* e1)
+{
+	float mean[4], axis[4];
+	principalAxis(block, first, num, mean, axis);
+
+	float lo = FLT_MAX, hi = -FLT_MAX;
+	for (int i = 0; i < 16; ++i)
+	{
+		float d = 0.0f;
+		for (int c = first; c < first + num; ++c)
+			d += (block.channels[c][i] - mean[c]) * axis[c];
+		lo = std::min(lo, d);
+		hi = std::max(hi, d);
+	}
+	float shrink = (hi - lo) * inset;
+	lo += shrink;
+	hi -= shrink;
+	for (int c = first; c < first + num; ++c)
+	{
+		e0[c] = clamp255(mean[c] + axis[c] * hi);
+		e1[c] = clamp255(mean[c] + axis[c] * lo);
+	}
+}
+
+//least squares endpoints for the indices found, weights[index] is the position between e0 (0) and e1 (1)
+bool fitEndpoints(const sBlock& block, int first, int num, const int* indices, const float* weights, float* e0, float* e1)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = weights[indices[i]];
+		float s = 1.0f - t;
+		aa += s * s;
+		ab += s * t;
+		bb += t * t;
+		for (int c = first; c < first + num; ++c)
+		{
+			ax[c] += s * block.channels[c][i];
+			bx[c] += t * block.channels[c][i];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+	det = 1.0f / det;
+	for (int c = first; c < first + num; ++c)
+	{
+		e0[c] = clamp255((bb * ax[c] - ab * bx[c]) * det);
+		e1[c] = clamp255((aa * bx[c] - ab * ax[c]) * det);
+	}
+	return true;
+}
+
+// BC1 *************************************
+
+inline unsigned short to565(const float* c)
+{
+	return (unsigned short)((roundToInt(c[0] * 31.0f / 255.0f) << 11) | (roundToInt(c[1] * 63.0f / 255.0f) << 5) | roundToInt(c[2] * 31.0f / 255.0f));
+}
+
+inline void from565(unsigned short v, float* c)
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+	c[3] = 255.0f;
+}
+
+//always in the 4 colors mode (color0 > color1), so it is valid for BC3 too
+void encodeColor(const sBlock& block, unsigned char* out)
+{
+	static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float e0[4], e1[4];
+	initialEndpoints(block, 0, 3, 1.0f / 16.0f, e0, e1);
+
+	float best_error = FLT_MAX;
+	unsigned short best_c0 = 0, best_c1 = 0;
+	int best_indices[16] = {};
+	for (int it = 0; it < 2; ++it)
+	{
+		unsigned short c0 = to565(e0), c1 = to565(e1);
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		float palette[4][4];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		int indices[16];
+		float error = findClosest(block, 0, 3, palette, c0 == c1 ? 1 : 4, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+		if (c0 == c1 || !fitEndpoints(block, 0, 3, indices, weights, palette[0], palette[1]))
+			break;
+		memcpy(e0, palette[0], sizeof(e0));
+		memcpy(e1, palette[1], sizeof(e1));
+	}
+
+	out[0] = best_c0 & 255; out[1] = best_c0 >> 8;
+	out[2] = best_c1 & 255; out[3] = best_c1 >> 8;
+	unsigned int bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= best_indices[i] << (i * 2);
+	memcpy(out + 4, &bits, 4); //little endian
+}
+
+// BC4 *************************************
+
+void encodeChannel(const sBlock& block, int channel, unsigned char* out)
+{
+	//index 0 is e0, 1 is e1 and 2..7 are in between
+	static const float weights[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+	float e0[4], e1[4];
+	e0[channel] = 0.0f;
+	e1[channel] = 255.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		e0[channel] = std::max(e0[channel], block.channels[channel][i]);
+		e1[channel] = std::min(e1[channel], block.channels[channel][i]);
+	}
+
+	float best_error = FLT_MAX;
+	int best_v0 = 0, best_v1 = 0;
+	int best_indices[16] = {};
+	for (int it = 0; it < 2; ++it)
+	{
+		int v0 = roundToInt(e0[channel]), v1 = roundToInt(e1[channel]);
+		if (v0 < v1)
+			std::swap(v0, v1);
+
+		float palette[8][4];
+		for (int i = 0; i < 8; ++i)
+			palette[i][channel] = v0 + (v1 - v0) * weights[i];
+
+		int indices[16];
+		float error = findClosest(block, channel, 1, palette, v0 == v1 ? 1 : 8, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_v0 = v0;
+			best_v1 = v1;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+		if (v0 == v1 || !fitEndpoints(block, channel, 1, indices, weights, e0, e1))
+			break;
+	}
+
+	//v0 > v1 selects the 8 values mode
+	out[0] = best_v0;
+	out[1] = best_v1;
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (unsigned long long)best_indices[i] << (i * 3);
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (bits >> (i * 8)) & 255;
+}
+
+// BC7 *************************************
+//only mode 6: one subset, RGBA 7 bits endpoints with a shared bit each and 4 bits indices. Good for smooth color and alpha
+
+struct BitWriter
+{
+	unsigned char* out;
+	int pos;
+	BitWriter(unsigned char* out) { this->out = out; pos = 0; memset(out, 0, 16); }
+	void write(unsigned int v, int num_bits)
+	{
+		for (int i = 0; i < num_bits; ++i, ++pos)
+			if ((v >> i) & 1)
+				out[pos >> 3] |= 1 << (pos & 7);
+	}
+};
+
+//7 bits per channel plus the p bit that is shared by the four channels of the endpoint
+void quantizeBC7(const float* e, int* q, int& p)
+{
+	float best = FLT_MAX;
+	for (int pbit = 0; pbit < 2; ++pbit)
+	{
+		int cq[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; ++c)
+		{
+			cq[c] = std::min(127, std::max(0, roundToInt((e[c] - pbit) * 0.5f)));
+			float d = (float)(cq[c] * 2 + pbit) - e[c];
+			error += d * d;
+		}
+		if (error < best)
+		{
+			best = error;
+			memcpy(q, cq, sizeof(cq));
+			p = pbit;
+		}
+	}
+}
+
+void encodeBC7Mode6(const sBlock& block, unsigned char* out)
+{
+	static const int interpolation[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	float weights[16];
+	for (int i = 0; i < 16; ++i)
+		weights[i] = interpolation[i] / 64.0f;
+
+	float e0[4], e1[4];
+	initialEndpoints(block, 0, 4, 1.0f / 32.0f, e0, e1);
+
+	float best_error = FLT_MAX;
+	int best_q[2][4] = {}, best_p[2] = {};
+	int best_indices[16] = {};
+	for (int it = 0; it < 2; ++it)
+	{
+		int q[2][4], p[2];
+		quantizeBC7(e0, q[0], p[0]);
+		quantizeBC7(e1, q[1], p[1]);
+
+		float palette[16][4];
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)
+			{
+				int a = q[0][c] * 2 + p[0], b = q[1][c] * 2 + p[1];
+				palette[i][c] = (float)(((64 - interpolation[i]) * a + interpolation[i] * b + 32) >> 6);
+			}
+
+		int indices[16];
+		float error = findClosest(block, 0, 4, palette, 16, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(best_q, q, sizeof(q));
+			memcpy(best_p, p, sizeof(p));
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+		if (!fitEndpoints(block, 0, 4, indices, weights, e0, e1))
+			break;
+	}
+
+	//the first pixel index is stored with 3 bits, its top bit must be 0
+	if (best_indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(best_q[0][c], best_q[1][c]);
+		std::swap(best_p[0], best_p[1]);
+		for (int i = 0; i < 16; ++i)
+			best_indices[i] = 15 - best_indices[i];
+	}
+
+	BitWriter writer(out);
+	writer.write(1 << 6, 7); //mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		writer.write(best_q[0][c], 7);
+		writer.write(best_q[1][c], 7);
+	}
+	writer.write(best_p[0], 1);
+	writer.write(best_p[1], 1);
+	writer.write(best_indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.write(best_indices[i], 4);
+}
+
+} //namespace
+
+int getBCBlockSize(eBCFormat format)
+{
+	return format == BC1 || format == BC4 ? 8 : 16;
+}
+
+void encodeBC1Block(const unsigned char* pixels, unsigned char* out)
+{
+	encodeColor(sBlock(pixels), out);
+}
+
+void encodeBC3Block(const unsigned char* pixels, unsigned char* out)
+{
+	sBlock block(pixels);
+	encodeChannel(block, 3, out);
+	encodeColor(block, out + 8);
+}
+
+void encodeBC4Block(const unsigned char* pixels, unsigned char* out, int channel)
+{
+	encodeChannel(sBlock(pixels), channel, out);
+}
+
+void encodeBC5Block(const unsigned char* pixels, unsigned char* out)
+{
+	sBlock block(pixels);
+	encodeChannel(block, 0, out);
+	encodeChannel(block, 1, out + 8);
+}
+
+void encodeBC7Block(const unsigned char* pixels, unsigned char* out)
+{
+	encodeBC7Mode6(sBlock(pixels), out);
+}
+
+void encodeBC(eBCFormat format, const unsigned char* rgba, int width, int height, std::vector<unsigned char>& blocks)
+{
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	int block_size = getBCBlockSize(format);
+	blocks.resize(blocks_x * blocks_y * block_size);
+
+	ThreadPool::getDefault()->parallelFor(blocks_y, [&](int by) {
+		unsigned char pixels[16 * 4];
+		unsigned char* out = &blocks[by * blocks_x * block_size];
+		for (int bx = 0; bx < blocks_x; ++bx, out += block_size)
+		{
+			for (int y = 0; y < 4; ++y)
+				for (int x = 0; x < 4; ++x)
+				{
+					int sx = std::min(bx * 4 + x, width - 1);
+					int sy = std::min(by * 4 + y, height - 1);
+					memcpy(pixels + (y * 4 + x) * 4, rgba + (sy * width + sx) * 4, 4);
+				}
+
+			switch (format)
+			{
+				case BC1: encodeBC1Block(pixels, out); break;
+				case BC3: encodeBC3Block(pixels, out); break;
+				case BC4: encodeBC4Block(pixels, out); break;
+				case BC5: encodeBC5Block(pixels, out); break;
+				case BC7: encodeBC7Block(pixels, out); break;
+			}
+		}
+	});
+}
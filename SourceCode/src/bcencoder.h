@@ -0,0 +1,32 @@
+/*  CPU encoder for the GPU block compressed formats (BC1, BC3, BC4, BC5 and BC7).
+	The source is always RGBA8, every 4x4 block is encoded independently so images are split by block rows between the threads.
+	It doesnt use GL, the blocks can be checked on CPU or stored in a KTX to upload them with glCompressedTexImage2D.
+*/
+
+#ifndef BCENCODER_H
+#define BCENCODER_H
+
+#include <vector>
+
+enum eBCFormat {
+	BC1, //rgb, 4 bits per pixel (albedo without alpha)
+	BC3, //rgba, 8 bits per pixel (BC1 color + BC4 alpha)
+	BC4, //single channel, 4 bits per pixel (roughness, metalness, occlusion, height...)
+	BC5, //two channels, 8 bits per pixel (normal maps, xy)
+	BC7  //rgba, 8 bits per pixel, best quality for color
+};
+
+//bytes of every 4x4 block
+int getBCBlockSize(eBCFormat format);
+
+//block encoders, pixels are the 16 RGBA8 pixels of the block row by row
+void encodeBC1Block(const unsigned char* pixels, unsigned char* out);
+void encodeBC3Block(const unsigned char* pixels, unsigned char* out);
+void encodeBC4Block(const unsigned char* pixels, unsigned char* out, int channel = 0);
+void encodeBC5Block(const unsigned char* pixels, unsigned char* out);
+void encodeBC7Block(const unsigned char* pixels, unsigned char* out);
+
+//encodes a whole RGBA8 image using the default ThreadPool, sizes that are not multiple of 4 repeat the border pixels
+void encodeBC(eBCFormat format, const unsigned char* rgba, int width, int height, std::vector<unsigned char>& blocks);
+
+#endif
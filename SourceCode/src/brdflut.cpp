@@ -0,0 +1,129 @@
+#include "brdflut.h"
+#include "texture.h"
+#include "imagekernels.h"
+#include "threadpool.h"
+#include "utils.h"
+#include "envbaker.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct sBRDFLUTHeader {
+	char signature[4]; //BLUT
+	int version;
+	int size;
+	int num_samples;
+};
+
+const int BRDF_LUT_VERSION = 1;
+
+//smith with the schlick approximation, k = a / 2 for the IBL
+inline float geometrySchlick(float NdotX, float k)
+{
+	return NdotX / (NdotX * (1.0f - k) + k);
+}
+
+bool readCache(const char* filename, int size, int num_samples, std::vector<unsigned short>& data)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+
+	sBRDFLUTHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.signature, "BLUT", 4) == 0 &&
+		header.version == BRDF_LUT_VERSION && header.size == size && header.num_samples == num_samples &&
+		fread(&data[0], sizeof(unsigned short), data.size(), f) == data.size();
+	fclose(f);
+	return ok;
+}
+
+void writeCache(const char* filename, int size, int num_samples, const std::vector<unsigned short>& data)
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << " * BRDF LUT: cannot write the cache '" << filename << "'" << std::endl;
+		return;
+	}
+
+	sBRDFLUTHeader header;
+	memcpy(header.signature, "BLUT", 4);
+	header.version = BRDF_LUT_VERSION;
+	header.size = size;
+	header.num_samples = num_samples;
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&data[0], sizeof(unsigned short), data.size(), f);
+	fclose(f);
+}
+
+}
+
+void integrateBRDFLUT(int size, int num_samples, float* rg)
+{
+	//the same hammersley points for every texel, only the lobe changes with the roughness
+	std::vector<float> xi(num_samples * 2);
+	for (int i = 0; i < num_samples; ++i)
+	{
+		xi[i * 2] = (float)i / num_samples;
+		xi[i * 2 + 1] = radicalInverse(i);
+	}
+
+	ThreadPool::getDefault()->parallelFor(size, [&](int y) {
+		//N = (0,0,1) and V in the XZ plane
+		float NdotV = (y + 0.5f) / size;
+		float vx = sqrtf(1.0f - NdotV * NdotV), vz = NdotV;
+		float* dst = rg + (size_t)y * size * 2;
+		for (int x = 0; x < size; ++x)
+		{
+			float roughness = (x + 0.5f) / size;
+			float a = roughness * roughness;
+			float a2 = a * a;
+			float k = a * 0.5f;
+			float scale = 0.0f, bias = 0.0f;
+			for (int i = 0; i < num_samples; ++i)
+			{
+				//importance sampled half vector
+				float cos_theta = sqrtf((1.0f - xi[i * 2 + 1]) / (1.0f + (a2 - 1.0f) * xi[i * 2 + 1]));
+				float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+				float phi = 2.0f * (float)PI * xi[i * 2];
+				float hx = sin_theta * cosf(phi), hz = cos_theta;
+
+				float VdotH = vx * hx + vz * hz;
+				float NdotL = 2.0f * VdotH * hz - vz;
+				if (NdotL <= 0.0f || VdotH <= 0.0f)
+					continue;
+
+				//BRDF * NdotL / pdf without F, pdf = D * NdotH / (4 * VdotH)
+				float G = geometrySchlick(NdotV, k) * geometrySchlick(NdotL, k);
+				float G_vis = G * VdotH / (hz * NdotV);
+				float Fc = powf(1.0f - VdotH, 5.0f);
+				scale += (1.0f - Fc) * G_vis;
+				bias += Fc * G_vis;
+			}
+			dst[x * 2] = scale / num_samples;
+			dst[x * 2 + 1] = bias / num_samples;
+		}
+	});
+}
+
+Texture* createBRDFLUT(int size, int num_samples, const char* cache_filename)
+{
+	std::vector<unsigned short> data((size_t)size * size * 2);
+	if (!cache_filename || !readCache(cache_filename, size, num_samples, data))
+	{
+		long time = getTime();
+		std::vector<float> rg(data.size());
+		integrateBRDFLUT(size, num_samples, &rg[0]);
+		floatToHalf(&rg[0], &data[0], rg.size());
+		std::cout << " + BRDF LUT computed: " << size << "x" << size << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		if (cache_filename)
+			writeCache(cache_filename, size, num_samples, data);
+	}
+
+	//no mipmaps, so the coordinates are clamped
+	return new Texture(size, size, GL_RG, GL_HALF_FLOAT, false, (Uint8*)&data[0], GL_RG16F);
+}
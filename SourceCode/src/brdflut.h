@@ -0,0 +1,18 @@
+/*  BRDF LUT: the split sum of the specular IBL (Karis), the GGX/Smith BRDF integrated over the hemisphere for every roughness
+	and NdotV as a scale (x) and a bias (y) of F0, so the shader only multiplies them by the prefiltered radiance.
+	It is computed on CPU (the rows split between the threads) and kept as RG16F, the half floats are cached in a small binary
+	file next to the data so the next runs only read it.
+*/
+
+#ifndef BRDFLUT_H
+#define BRDFLUT_H
+
+class Texture;
+
+//rg gets size x size pairs, s is the roughness and t the NdotV (at the texel centers)
+void integrateBRDFLUT(int size, int num_samples, float* rg);
+
+//RG16F with clamped coordinates, read from cache_filename if it has the same size and samples, if not computed and saved there
+Texture* createBRDFLUT(int size = 128, int num_samples = 1024, const char* cache_filename = "data/brdfLUT.bin");
+
+#endif
@@ -98,6 +98,9 @@ void Character::render(Camera* camera)
 	mesh->render(GL_TRIANGLES);
 	shader->disable();
 
+	//taken again every frame, the body can change
+	Texture::Release(texture);
+
 	if (0)
 	{
 		glDisable(GL_DEPTH_TEST);
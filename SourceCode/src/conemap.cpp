@@ -0,0 +1,191 @@
+#include "conemap.h"
+#include "texture.h"
+#include "ktx.h"
+#include "threadpool.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+const int CONE_MAP_VERSION = 1;
+const int BLOCK_SIZE = 8; //texels of the blocks of the search
+
+inline int wrap(int i, int size)
+{
+	return ((i % size) + size) % size;
+}
+
+//the ray from the top of the source column through the surface of the texel at (dx,dy) goes on inside the relief,
+//a ray entering the cone there would cross it twice if the cone reached the point where it gets out. Returns the ratio
+//that keeps it out of the cone, or best if it gets out under the apex or too far to narrow it
+float traceRatio(const float* depths, int width, int height, int sx, int sy, float src_depth, int dx, int dy, float best)
+{
+	float dst_depth = depths[wrap(sy + dy, height) * width + wrap(sx + dx, width)];
+	if (dst_depth >= src_depth)
+		return best;
+
+	//half a texel per step, the ratio of the last point inside is kept so the cone stays on the safe side
+	float length = sqrtf((float)(dx * dx + dy * dy));
+	float step_x = dx * 0.5f / length, step_y = dy * 0.5f / length, step_z = dst_depth * 0.5f / length;
+	float x = (float)dx, y = (float)dy, z = dst_depth;
+	float ratio = sqrtf((float)(dx * dx) / (width * width) + (float)(dy * dy) / (height * height)) / (src_depth - z);
+	while (ratio < best)
+	{
+		x += step_x;
+		y += step_y;
+		z += step_z;
+		if (z >= src_depth)
+			return best;
+		if (depths[wrap(sy + (int)floorf(y + 0.5f), height) * width + wrap(sx + (int)floorf(x + 0.5f), width)] > z)
+			return ratio;
+		ratio = sqrtf(x * x / (width * width) + y * y / (height * height)) / (src_depth - z);
+	}
+	return best;
+}
+
+//the highest texel of every factor x factor block
+void reduceDepths(const float* src, int width, int height, int factor, std::vector<float>& dst)
+{
+	int dst_width = width / factor, dst_height = height / factor;
+	dst.resize((size_t)dst_width * dst_height);
+	for (int y = 0; y < dst_height; ++y)
+		for (int x = 0; x < dst_width; ++x)
+		{
+			float depth = 1.0f;
+			for (int j = 0; j < factor; ++j)
+				for (int i = 0; i < factor; ++i)
+					depth = std::min(depth, src[(size_t)(y * factor + j) * width + x * factor + i]);
+			dst[(size_t)y * dst_width + x] = depth;
+		}
+}
+
+}
+
+void buildConeMap(const float* depths, int width, int height, unsigned char* rg)
+{
+	//the highest texel of every block, the blocks that cannot narrow a cone are skipped whole
+	int blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE, blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	std::vector<float> block_depths((size_t)blocks_x * blocks_y, 1.0f);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			float& block_depth = block_depths[(y / BLOCK_SIZE) * blocks_x + x / BLOCK_SIZE];
+			block_depth = std::min(block_depth, depths[(size_t)y * width + x]);
+		}
+
+	int max_ring = (std::max(blocks_x, blocks_y) + 1) / 2;
+	float texel_scale = 1.0f / std::max(width, height);
+	ThreadPool::getDefault()->parallelFor(height, [&](int y) {
+		for (int x = 0; x < width; ++x)
+		{
+			float src_depth = depths[(size_t)y * width + x];
+			float best = 1.0f;
+
+			//rings of blocks around the one of the texel, until the nearest texel of the ring is too far for the cone
+			int src_bx = x / BLOCK_SIZE, src_by = y / BLOCK_SIZE;
+			for (int ring = 0; ring <= max_ring && ((ring - 1) * BLOCK_SIZE + 1) * texel_scale < best * src_depth; ++ring)
+				for (int by = src_by - ring; by <= src_by + ring; ++by)
+				{
+					int step = by == src_by - ring || by == src_by + ring ? 1 : std::max(1, 2 * ring);
+					for (int bx = src_bx - ring; bx <= src_bx + ring; bx += step)
+					{
+						//the block only matters if it is higher than the texel and near enough
+						float block_depth = block_depths[wrap(by, blocks_y) * blocks_x + wrap(bx, blocks_x)];
+						if (block_depth >= src_depth)
+							continue;
+						float near_x = (float)(std::max(bx * BLOCK_SIZE, std::min(x, bx * BLOCK_SIZE + BLOCK_SIZE - 1)) - x) / width;
+						float near_y = (float)(std::max(by * BLOCK_SIZE, std::min(y, by * BLOCK_SIZE + BLOCK_SIZE - 1)) - y) / height;
+						if (sqrtf(near_x * near_x + near_y * near_y) >= best * (src_depth - block_depth))
+							continue;
+
+						for (int dy = by * BLOCK_SIZE - y; dy < (by + 1) * BLOCK_SIZE - y; ++dy)
+							for (int dx = bx * BLOCK_SIZE - x; dx < (bx + 1) * BLOCK_SIZE - x; ++dx)
+								if ((dx || dy) && 2 * std::abs(dx) <= width && 2 * std::abs(dy) <= height)
+									best = traceRatio(depths, width, height, x, y, src_depth, dx, dy, best);
+					}
+				}
+
+			//floor so the quantization doesnt widen the cones
+			unsigned char* dst = rg + ((size_t)y * width + x) * 2;
+			dst[0] = (unsigned char)(src_depth * 255.0f);
+			dst[1] = (unsigned char)(sqrtf(best) * 255.0f);
+		}
+	});
+}
+
+Texture* createConeMap(const char* heigh_filename, int channel, int max_size)
+{
+	std::string name = std::string(heigh_filename) + ".cone.ktx";
+	Texture* texture = Texture::Find(name);
+	if (texture)
+		return Texture::Acquire(texture);
+
+	//the cache is rebuilt if the map changed or it was made from another channel or size
+	char settings[64];
+	sprintf(settings, "%d %d %d", CONE_MAP_VERSION, channel, max_size);
+	KTX ktx;
+	if (!isCacheValid(heigh_filename, name.c_str()) || !ktx.load(name.c_str()) || ktx.metadata["cone_map"] != settings)
+	{
+		Image image;
+		if (!image.load(heigh_filename))
+			return NULL;
+		if (channel >= (int)image.bytes_per_pixel)
+		{
+			std::cout << "[ERROR] Cone map: '" << heigh_filename << "' has no channel " << channel << std::endl;
+			return NULL;
+		}
+
+		long time = getTime();
+		int width = image.width, height = image.height;
+		std::vector<float> depths((size_t)width * height);
+		for (size_t i = 0; i < depths.size(); ++i)
+			depths[i] = 1.0f - image.data[i * image.bytes_per_pixel + channel] / 255.0f;
+
+		int factor = 1;
+		while (std::max(width, height) / factor > max_size)
+			factor *= 2;
+		if (factor > 1)
+		{
+			std::vector<float> reduced;
+			reduceDepths(&depths[0], width, height, factor, reduced);
+			depths.swap(reduced);
+			width /= factor;
+			height /= factor;
+		}
+
+		ktx.width = width;
+		ktx.height = height;
+		ktx.num_faces = 1;
+		ktx.gl_type = GL_UNSIGNED_BYTE;
+		ktx.gl_format = GL_RG;
+		ktx.gl_internal_format = GL_RG8;
+		ktx.gl_base_internal_format = GL_RG;
+		ktx.levels.resize(1);
+		ktx.levels[0].width = width;
+		ktx.levels[0].height = height;
+		ktx.levels[0].data.resize((size_t)width * height * 2);
+		ktx.metadata.clear();
+		ktx.metadata["cone_map"] = settings;
+		buildConeMap(&depths[0], width, height, &ktx.levels[0].data[0]);
+		std::cout << " + Cone map computed: " << name << " Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+
+		if (!ktx.save(name.c_str()))
+			std::cout << "[WARN] cannot write " << name << std::endl;
+	}
+
+	texture = new Texture();
+	texture->load(&ktx, name.c_str(), false);
+
+	//repeated like the heigh map, load only repeats the ones with mipmaps
+	texture->wrapS = texture->wrapT = GL_REPEAT;
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	Texture::Acquire(texture);
+	return texture;
+}
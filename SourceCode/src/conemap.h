@@ -0,0 +1,22 @@
+/*  Relaxed cone step maps (Policarpo and Oliveira) for the relief mapping of the heigh maps: every texel stores the widest cone
+	with the apex on its surface point such that a view ray entering it crosses the relief at most once before the apex depth.
+	The shader steps the ray by the cones and ends with a short binary search, a handful of fetches instead of the many small steps of POM.
+	The cones are computed on CPU, the rows split between the threads: the texels around each one are checked in rings of blocks,
+	the blocks lower than it or too far to narrow its cone are skipped whole and the search stops at the first ring out of reach.
+	Maps bigger than max_size are reduced first keeping the highest texel of each block, so the cones stay conservative.
+	The result is RG8 (depth and square root of the ratio) cached as a KTX next to the heigh map.
+*/
+
+#ifndef CONEMAP_H
+#define CONEMAP_H
+
+class Texture;
+
+//depths: width x height values in [0,1] (0 at the top of the relief), repeated at the borders like the maps.
+//rg gets the depth and the square root of the cone ratio (horizontal texture units per depth unit, up to 1) of every texel
+void buildConeMap(const float* depths, int width, int height, unsigned char* rg);
+
+//from the channel of the heigh map, read from the cache if it is newer than the map. Repeated and without mipmaps
+Texture* createConeMap(const char* heigh_filename, int channel = 0, int max_size = 256);
+
+#endif
@@ -0,0 +1,187 @@
+#include "debugdraw.h"
+
+#ifdef USE_DEBUG_DRAW
+
+#include "includes.h"
+#include "shader.h"
+#include "camera.h"
+#include "streambuffer.h"
+#include "application.h"
+
+#include "extra/stb_easy_font.h"
+
+#include <cmath>
+#include <algorithm>
+
+std::vector<DebugDraw::sVertex> DebugDraw::lines;
+std::vector<DebugDraw::sVertex> DebugDraw::glyphs;
+
+static Vector4ub toColor(const Vector4& c)
+{
+	return Vector4ub((unsigned char)(clamp(c.x, 0.0f, 1.0f) * 255.0f), (unsigned char)(clamp(c.y, 0.0f, 1.0f) * 255.0f),
+		(unsigned char)(clamp(c.z, 0.0f, 1.0f) * 255.0f), (unsigned char)(clamp(c.w, 0.0f, 1.0f) * 255.0f));
+}
+
+static void pushLine(std::vector<DebugDraw::sVertex>& container, const Vector3& a, const Vector3& b, const Vector4ub& color)
+{
+	DebugDraw::sVertex v;
+	v.color = color;
+	v.position = a;
+	container.push_back(v);
+	v.position = b;
+	container.push_back(v);
+}
+
+void DebugDraw::addLine(const Vector3& a, const Vector3& b, const Vector4& color)
+{
+	pushLine(lines, a, b, toColor(color));
+}
+
+void DebugDraw::addBox(const Matrix44& model, const BoundingBox& box, const Vector4& color)
+{
+	//corners in world space, bit 0 is x, bit 1 is y, bit 2 is z
+	Vector3 corners[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector3 local(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+		local.set(box.center.x + local.x * box.halfsize.x, box.center.y + local.y * box.halfsize.y, box.center.z + local.z * box.halfsize.z);
+		corners[i] = model * local;
+	}
+
+	//every edge joins two corners that differ in one bit
+	Vector4ub c = toColor(color);
+	for (int i = 0; i < 8; ++i)
+		for (int bit = 1; bit < 8; bit <<= 1)
+			if (!(i & bit))
+				pushLine(lines, corners[i], corners[i | bit], c);
+}
+
+void DebugDraw::addPoint(const Vector3& position, float size, const Vector4& color)
+{
+	Vector4ub c = toColor(color);
+	float h = size * 0.5f;
+	pushLine(lines, position - Vector3(h, 0, 0), position + Vector3(h, 0, 0), c);
+	pushLine(lines, position - Vector3(0, h, 0), position + Vector3(0, h, 0), c);
+	pushLine(lines, position - Vector3(0, 0, h), position + Vector3(0, 0, h), c);
+}
+
+void DebugDraw::addGrid(const Vector3& camera_position, float dist, const Vector4& color)
+{
+	const int num_lines = 2000;
+
+	//the grid follows the camera in steps so it looks infinite
+	float center_x = floor(camera_position.x / 100.0f) * 100.0f;
+	float center_z = floor(camera_position.z / 100.0f) * 100.0f;
+	float half = dist * num_lines * 0.5f;
+
+	Vector4ub major = toColor(color);
+	Vector4ub minor = toColor(Vector4(color.x * 0.75f, color.y * 0.75f, color.z * 0.75f, color.w * 0.5f));
+
+	lines.reserve(lines.size() + (num_lines + 1) * 4);
+	for (int i = num_lines / -2; i <= num_lines / 2; ++i)
+	{
+		Vector4ub c = i % 10 == 0 ? major : minor;
+		float x = center_x + i * dist;
+		float z = center_z + i * dist;
+
+		//the axis are highlighted
+		Vector4ub cx = x == 0.0f ? Vector4ub(255, 128, 128, c.w) : c;
+		Vector4ub cz = z == 0.0f ? Vector4ub(128, 128, 255, c.w) : c;
+		pushLine(lines, Vector3(x, 0.0f, center_z - half), Vector3(x, 0.0f, center_z + half), cx);
+		pushLine(lines, Vector3(center_x - half, 0.0f, z), Vector3(center_x + half, 0.0f, z), cz);
+	}
+}
+
+void DebugDraw::addText(float x, float y, const std::string& text, const Vector3& color, float scale)
+{
+	static char buffer[99999]; // ~500 chars
+	if (scale == 0)
+		return;
+
+	//stb_easy_font generates quads of 16 bytes vertices (x,y,z,color)
+	int num_quads = stb_easy_font_print(x / scale, y / scale, (char*)(text.c_str()), NULL, buffer, sizeof(buffer));
+
+	Vector4ub c = toColor(Vector4(color.x, color.y, color.z, 1.0f));
+	const float* quad = (const float*)buffer;
+	for (int i = 0; i < num_quads; ++i, quad += 16)
+	{
+		sVertex v[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			v[j].position.set(quad[j * 4] * scale, quad[j * 4 + 1] * scale, 0.0f);
+			v[j].color = c;
+		}
+		glyphs.push_back(v[0]); glyphs.push_back(v[1]); glyphs.push_back(v[2]);
+		glyphs.push_back(v[0]); glyphs.push_back(v[2]); glyphs.push_back(v[3]);
+	}
+}
+
+void DebugDraw::flush(Camera* camera)
+{
+	if (lines.empty() && glyphs.empty())
+		return;
+
+	static GLuint vao = 0;
+	if (!vao)
+		glGenVertexArrays(1, &vao);
+
+	Shader* shader = Shader::getDefaultShader("debug");
+	StreamBuffer* stream = StreamBuffer::getDefault();
+	int vertex_location = shader->attrib_locations[Shader::ATTRIB_VERTEX];
+	int color_location = shader->attrib_locations[Shader::ATTRIB_COLOR];
+
+	shader->enable();
+	glBindVertexArray(vao);
+	glEnableVertexAttribArray(vertex_location);
+	glEnableVertexAttribArray(color_location);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(false);
+	GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+
+	if (lines.size())
+	{
+		//the upload may move to a new buffer when it grows, so it is bound after
+		size_t offset = stream->upload(&lines[0], lines.size() * sizeof(sVertex));
+		glBindBuffer(GL_ARRAY_BUFFER, stream->buffer_id);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, sizeof(sVertex), (void*)offset);
+		glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(sVertex), (void*)(offset + sizeof(Vector3)));
+
+		shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+		shader->setUniform("u_camera_position", camera->eye);
+		shader->setUniform("u_fade_distance", 5000.0f);
+		glEnable(GL_DEPTH_TEST);
+		glDrawArrays(GL_LINES, 0, lines.size());
+	}
+
+	if (glyphs.size())
+	{
+		size_t offset = stream->upload(&glyphs[0], glyphs.size() * sizeof(sVertex));
+		glBindBuffer(GL_ARRAY_BUFFER, stream->buffer_id);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, sizeof(sVertex), (void*)offset);
+		glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(sVertex), (void*)(offset + sizeof(Vector3)));
+
+		Matrix44 projection_matrix;
+		projection_matrix.ortho(0, Application::instance->window_width, Application::instance->window_height, 0, -1, 1);
+		shader->setUniform("u_viewprojection", projection_matrix);
+		shader->setUniform("u_fade_distance", 0.0f);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glDrawArrays(GL_TRIANGLES, 0, glyphs.size());
+	}
+
+	glDepthMask(true);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	if (cull_face)
+		glEnable(GL_CULL_FACE);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	shader->disable();
+
+	lines.clear();
+	glyphs.clear();
+}
+
+#endif
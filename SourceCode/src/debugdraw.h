@@ -0,0 +1,49 @@
+/*  Accumulates debug primitives (lines, boxes, points, grids and text) during the frame and renders all of them in flush,
+	with one draw for the world space lines and another for the text quads.
+	It only exists in debug builds (or defining USE_DEBUG_DRAW), otherwise all the calls are empty and get removed.
+*/
+
+#ifndef DEBUGDRAW_H
+#define DEBUGDRAW_H
+
+#include "framework.h"
+#include <vector>
+#include <string>
+
+#ifdef _DEBUG
+	#define USE_DEBUG_DRAW
+#endif
+
+class Camera;
+
+class DebugDraw
+{
+public:
+#ifdef USE_DEBUG_DRAW
+	struct sVertex {
+		Vector3 position;
+		Vector4ub color;
+	};
+
+	static std::vector<sVertex> lines; //world space, in pairs
+	static std::vector<sVertex> glyphs; //screen space, in triangles
+
+	static void addLine(const Vector3& a, const Vector3& b, const Vector4& color);
+	static void addBox(const Matrix44& model, const BoundingBox& box, const Vector4& color); //box in local space
+	static void addPoint(const Vector3& position, float size, const Vector4& color); //a small cross, size in world units
+	static void addGrid(const Vector3& camera_position, float dist = 10, const Vector4& color = Vector4(0.7f, 0.7f, 0.7f, 0.7f));
+	static void addText(float x, float y, const std::string& text, const Vector3& color, float scale = 1); //in pixels
+
+	static void flush(Camera* camera); //renders everything and clears it, call at the end of the frame
+#else
+	static void addLine(const Vector3&, const Vector3&, const Vector4&) {}
+	static void addBox(const Matrix44&, const BoundingBox&, const Vector4&) {}
+	static void addPoint(const Vector3&, float, const Vector4&) {}
+	static void addGrid(const Vector3&, float = 10, const Vector4& = Vector4(0.7f, 0.7f, 0.7f, 0.7f)) {}
+	static void addText(float, float, const std::string&, const Vector3&, float = 1) {}
+
+	static void flush(Camera*) {}
+#endif
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include "drawbatch.h"
+#include "scenenode.h"
+#include "material.h"
+#include "mesh.h"
+#include "shader.h"
+#include "gpuarena.h"
+#include "streambuffer.h"
+#include "utils.h"
+#include "reflectionprobe.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+const char* DrawBatch::variant_macros = "#version 430 compatibility\n#define USE_MULTIDRAW\n";
+std::map<Shader*, Shader*> DrawBatch::s_variants;
+const int DrawBatch::probe_slots[DrawBatch::MAX_PROBES] = { 2, 3, 5, 6 };
+
+bool DrawBatch::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		supported = getGLVersion() >= 43 ? 1 : 0;
+		if (!supported)
+			std::cout << " * DrawBatch: multidraw indirect not supported (GL " << getGLVersion() << "), nodes rendered one by one" << std::endl;
+	}
+	return supported == 1;
+}
+
+Shader* DrawBatch::getVariant(Shader* shader)
+{
+	auto it = s_variants.find(shader);
+	if (it != s_variants.end())
+		return it->second;
+
+	//only compiled once, if it fails the nodes using it will be rendered one by one
+	Shader* variant = shader->getVariant(variant_macros);
+	if (variant && variant->getAttribLocation("a_draw_id") == -1)
+		variant = NULL; //the vertex shader doesnt support USE_MULTIDRAW
+	s_variants[shader] = variant;
+	return variant;
+}
+
+DrawBatch::DrawBatch()
+{
+	draw_ids_buffer_id = 0;
+	num_draw_ids = 0;
+	commands_start = 0;
+}
+
+DrawBatch::~DrawBatch()
+{
+	if (draw_ids_buffer_id)
+		glDeleteBuffers(1, &draw_ids_buffer_id);
+}
+
+void DrawBatch::clear()
+{
+	groups.clear();
+	group_index.clear();
+	materials.clear();
+	probes.clear();
+	unbatched.clear();
+	blended.clear();
+}
+
+void DrawBatch::add(SceneNode* node)
+{
+	Material* material = node->material;
+	Mesh* mesh = node->mesh;
+	if (!material || !mesh)
+		return;
+
+	//materials sharing their textures (ex: an atlas) go in the same group, drawn with the uniforms of one of them
+	Material* batch_material = material->getBatchMaterial();
+	Shader* variant = NULL;
+	if (node->batchable && material->canBatch() && batch_material->canBatch() && mesh->arena && batch_material->shader)
+		variant = getVariant(batch_material->shader);
+
+	//the probes of the node go with the draw, it is drawn alone only if the batch has too many already
+	const sProbeBlend& blend = ReflectionProbe::getBlend(node->probe_blend, node->model.getTranslation());
+	size_t num_new = 0;
+	for (int i = 0; i < 2; ++i)
+		if (blend.probes[i] && std::find(probes.begin(), probes.end(), blend.probes[i]) == probes.end())
+			num_new++;
+	if (probes.size() + num_new > MAX_PROBES)
+		variant = NULL;
+	bool is_blended = material->isBlended();
+	if (!variant)
+	{
+		if (is_blended)
+		{
+			sBlendedStep step = { node, -1 };
+			blended.push_back(step);
+		}
+		else
+			unbatched.push_back(node);
+		return;
+	}
+
+	//the opaque draws share one group per material, the blended ones only the group of the previous draw to keep the order
+	int index = -1;
+	if (is_blended)
+	{
+		if (blended.size() && !blended.back().node && groups[blended.back().group].material == batch_material)
+			index = blended.back().group;
+	}
+	else
+	{
+		auto it = group_index.find(batch_material);
+		if (it != group_index.end())
+			index = it->second;
+	}
+	if (index == -1)
+	{
+		index = groups.size();
+		groups.resize(index + 1);
+		groups[index].material = batch_material;
+		groups[index].blended = is_blended;
+		materials.push_back(batch_material);
+		if (is_blended)
+		{
+			sBlendedStep step = { NULL, index };
+			blended.push_back(step);
+		}
+		else
+			group_index[batch_material] = index;
+	}
+
+	sGroup& group = groups[index];
+	group.shader = variant;
+
+	sDrawData data;
+	data.model = node->model;
+	data.params = material->getDrawParams();
+	data.params.x = (float)index;
+	data.probes = Vector4(-1.0f, -1.0f, blend.weights[0], blend.weights[1]);
+	for (int i = 0; i < 2; ++i)
+		if (blend.probes[i])
+		{
+			size_t j = std::find(probes.begin(), probes.end(), blend.probes[i]) - probes.begin();
+			if (j == probes.size())
+				probes.push_back(blend.probes[i]);
+			(i == 0 ? data.probes.x : data.probes.y) = (float)j;
+		}
+
+	//one command per submesh, all of them share the node data
+	unsigned int num_submeshes = mesh->material_range.size() ? mesh->material_range.size() : 1;
+	for (unsigned int i = 0; i < num_submeshes; ++i)
+	{
+		unsigned int first, count;
+		mesh->getDrawRange(mesh->material_range.size() ? i + 1 : 0, first, count);
+		if (mesh->first_index != -1)
+		{
+			sElementsCommand command = { count, 1, mesh->first_index + first, mesh->base_vertex, 0 };
+			group.elements.push_back(command);
+			group.draws.insert(group.draws.begin() + group.elements.size() - 1, data); //before the arrays draws
+		}
+		else
+		{
+			sArraysCommand command = { count, 1, mesh->base_vertex + first, 0 };
+			group.arrays.push_back(command);
+			group.draws.push_back(data);
+		}
+	}
+}
+
+unsigned int DrawBatch::getNumCalls()
+{
+	unsigned int num = unbatched.size();
+	for (size_t i = 0; i < blended.size(); ++i)
+		num += blended[i].node ? 1 : 0;
+	for (size_t i = 0; i < groups.size(); ++i)
+		num += (groups[i].elements.size() ? 1 : 0) + (groups[i].arrays.size() ? 1 : 0);
+	return num;
+}
+
+void DrawBatch::render(Camera* camera)
+{
+	//the opaque ones in any order, the depth test sorts them
+	for (size_t i = 0; i < unbatched.size(); ++i)
+		unbatched[i]->render(camera);
+	bool uploaded = uploadGroups();
+	if (uploaded)
+		for (size_t i = 0; i < groups.size(); ++i)
+			if (!groups[i].blended)
+				renderGroup(camera, i);
+
+	//then the blended ones, in the order they were added
+	for (size_t i = 0; i < blended.size(); ++i)
+		if (blended[i].node)
+			blended[i].node->render(camera);
+		else if (uploaded)
+			renderGroup(camera, blended[i].group);
+
+	if (uploaded)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+		assert(glGetError() == GL_NO_ERROR);
+	}
+}
+
+bool DrawBatch::uploadGroups()
+{
+	if (!GPUArena::instance)
+		return false;
+
+	//pack all the groups in the same buffers, draws are ordered like the commands, so the base_instance of a command is its draw id
+	std::vector<sDrawData> draw_data;
+	std::vector<char> commands;
+	commands_offset.resize(groups.size());
+	for (size_t i = 0; i < groups.size(); ++i)
+	{
+		sGroup& group = groups[i];
+		GLuint draw_id = draw_data.size();
+		for (size_t j = 0; j < group.elements.size(); ++j)
+			group.elements[j].base_instance = draw_id++;
+		for (size_t j = 0; j < group.arrays.size(); ++j)
+			group.arrays[j].base_instance = draw_id++;
+		draw_data.insert(draw_data.end(), group.draws.begin(), group.draws.end());
+
+		commands_offset[i] = commands.size();
+		commands.resize(commands.size() + group.elements.size() * sizeof(sElementsCommand) + group.arrays.size() * sizeof(sArraysCommand));
+		char* dst = &commands[commands_offset[i]];
+		if (group.elements.size())
+			memcpy(dst, &group.elements[0], group.elements.size() * sizeof(sElementsCommand));
+		if (group.arrays.size())
+			memcpy(dst + group.elements.size() * sizeof(sElementsCommand), &group.arrays[0], group.arrays.size() * sizeof(sArraysCommand));
+	}
+
+	if (draw_data.empty())
+		return false;
+
+	if (!draw_ids_buffer_id)
+		glGenBuffers(1, &draw_ids_buffer_id);
+
+	//the draw ids buffer only grows
+	if (num_draw_ids < draw_data.size())
+	{
+		num_draw_ids = std::max((unsigned int)draw_data.size(), num_draw_ids * 2);
+		std::vector<GLint> ids(num_draw_ids);
+		for (unsigned int i = 0; i < num_draw_ids; ++i)
+			ids[i] = i;
+		glBindBuffer(GL_ARRAY_BUFFER, draw_ids_buffer_id);
+		glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLint), &ids[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//draw data and commands change every frame
+	StreamBuffer* stream = StreamBuffer::getDefault();
+	stream->bindRange(GL_SHADER_STORAGE_BUFFER, 0, &draw_data[0], draw_data.size() * sizeof(sDrawData));
+	commands_start = stream->upload(&commands[0], commands.size(), 4);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stream->buffer_id);
+	return true;
+}
+
+//one state change per group
+void DrawBatch::renderGroup(Camera* camera, size_t index)
+{
+	sGroup& group = groups[index];
+	if (group.elements.empty() && group.arrays.empty())
+		return;
+
+	if (group.material->linear_output)
+		glEnable(GL_FRAMEBUFFER_SRGB);
+
+	//the material uploads its uniforms to the variant, the model comes from the draw data
+	group.shader->enable();
+	group.material->setUniforms(camera, Matrix44(), group.shader);
+
+	//the shaders without probes ignore them, the unused slots repeat the first one
+	if (probes.size() && group.shader->getUniformLocation("u_probes_max_lods") != -1)
+	{
+		float max_lods[MAX_PROBES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int j = 0; j < MAX_PROBES; ++j)
+		{
+			ReflectionProbe* probe = probes[j < (int)probes.size() ? j : 0];
+			std::string name = "u_probes[" + std::to_string(j) + "]";
+			group.shader->setUniform(name.c_str(), probe->cubemap, probe_slots[j]);
+			max_lods[j] = probe->getMaxLod();
+		}
+		group.shader->setUniform("u_probes_max_lods", Vector4(max_lods[0], max_lods[1], max_lods[2], max_lods[3]));
+	}
+
+	GPUArena::instance->bind(group.shader);
+	int draw_id_location = group.shader->getAttribLocation("a_draw_id");
+	glBindBuffer(GL_ARRAY_BUFFER, draw_ids_buffer_id);
+	glEnableVertexAttribArray(draw_id_location);
+	glVertexAttribIPointer(draw_id_location, 1, GL_INT, 0, NULL);
+	glVertexAttribDivisor(draw_id_location, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	size_t offset = commands_start + commands_offset[index];
+	if (group.elements.size())
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, group.elements.size(), 0);
+	offset += group.elements.size() * sizeof(sElementsCommand);
+	if (group.arrays.size())
+		glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)offset, group.arrays.size(), 0);
+
+	//the arena VAO is shared with the regular path
+	glVertexAttribDivisor(draw_id_location, 0);
+	glDisableVertexAttribArray(draw_id_location);
+	glBindVertexArray(0);
+	group.shader->disable();
+	glDisable(GL_FRAMEBUFFER_SRGB);
+
+	for (size_t j = 0; j < group.elements.size(); ++j)
+		Mesh::num_triangles_rendered += group.elements[j].count / 3;
+	for (size_t j = 0; j < group.arrays.size(); ++j)
+		Mesh::num_triangles_rendered += group.arrays[j].count / 3;
+	Mesh::num_meshes_rendered += group.draws.size();
+}
@@ -0,0 +1,100 @@
+/*  This collects the draws of the scene nodes and submits them with a few glMultiDrawElementsIndirect calls.
+	Draws are grouped by material (same shader and render state), materials sharing textures and uniforms like the ones of a MaterialAtlas
+	go in the same group. The per draw data (model, material index, the params of the material and its reflection probes) is stored
+	in a storage buffer that the shader fetches using the draw id. Both are written to the StreamBuffer every frame. Only meshes stored in the GPUArena can be batched,
+	with materials that allow it (Material::canBatch). The blended ones are drawn after the opaque ones in the order they were added,
+	only the consecutive draws with the same material share a group.
+*/
+
+#ifndef DRAWBATCH_H
+#define DRAWBATCH_H
+
+#include "includes.h"
+#include "framework.h"
+#include <vector>
+#include <map>
+
+class SceneNode;
+class Material;
+class Camera;
+class Shader;
+class ReflectionProbe;
+
+class DrawBatch
+{
+public:
+	static const char* variant_macros; //prepended to the material shader to build its multidraw version
+	static bool isSupported(); //needs GL 4.3 (multidraw indirect and storage buffers)
+
+	//same layout as the GL indirect commands
+	struct sElementsCommand {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance; //used as draw id
+	};
+	struct sArraysCommand {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first;
+		GLuint base_instance; //used as draw id
+	};
+
+	//one per draw, must match the sDrawData struct in the shaders (std430)
+	struct sDrawData {
+		Matrix44 model;
+		Vector4 params; //x: material index, yzw: from Material::getDrawParams
+		Vector4 probes; //xy: index in the probes of the batch (-1 if none), zw: weights
+	};
+
+	//the reflection probes of the draws, bound to every group in these slots (the ones the materials leave for them)
+	static const int MAX_PROBES = 4;
+	static const int probe_slots[MAX_PROBES];
+
+	//draws sharing material, they are submitted with one call
+	struct sGroup {
+		Material* material;
+		Shader* shader; //multidraw variant of the material shader
+		bool blended; //drawn from its step in the blended list
+		std::vector<sElementsCommand> elements;
+		std::vector<sArraysCommand> arrays;
+		std::vector<sDrawData> draws; //elements first, then arrays
+	};
+
+	//a blended node drawn alone, or a group (node NULL) of consecutive blended draws
+	struct sBlendedStep {
+		SceneNode* node;
+		int group;
+	};
+
+	std::vector<sGroup> groups;
+	std::map<Material*, int> group_index; //the opaque groups, one per material
+	std::vector<Material*> materials; //the material index of every draw points here
+	std::vector<ReflectionProbe*> probes; //the probe indices of every draw point here
+	std::vector<SceneNode*> unbatched; //opaque nodes that must be rendered one by one
+	std::vector<sBlendedStep> blended; //after the opaque ones, in the order they were added
+
+	GLuint draw_ids_buffer_id; //0,1,2... read as an instanced attribute so base_instance becomes the draw id
+	unsigned int num_draw_ids;
+
+	DrawBatch();
+	~DrawBatch();
+
+	void clear(); //call every frame before adding the nodes
+	void add(SceneNode* node);
+	void render(Camera* camera);
+
+	unsigned int getNumCalls(); //GL draw calls needed for the current content
+
+private:
+	static std::map<Shader*, Shader*> s_variants; //material shader -> multidraw variant (NULL if it failed)
+	static Shader* getVariant(Shader* shader);
+	std::vector<size_t> commands_offset; //of every group, from commands_start
+	size_t commands_start;
+
+	bool uploadGroups(); //false if there is nothing to draw
+	void renderGroup(Camera* camera, size_t index);
+};
+
+#endif
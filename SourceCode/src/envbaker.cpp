@@ -0,0 +1,312 @@
+#include "envbaker.h"
+#include "threadpool.h"
+#include "sh9.h"
+#include "extra/hdre.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ENVBAKER_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+//the faces of level 0 and its mips (RGB, 6 faces one after another), for the filtered lookups
+struct sCubeMips {
+	int size;
+	std::vector< std::vector<float> > levels;
+};
+
+//samples of the GGX lobe around the normal (z) of a roughness, the same for every texel
+struct sLobe {
+	std::vector<float> x, y, z, weight, lod; //a multiple of 4, the padding has no weight
+};
+
+inline float clampf(float v, float min, float max)
+{
+	return v < min ? min : (v > max ? max : v);
+}
+
+//the inverse of getCubemapDirection, sc and tc in [-1,1]
+inline void directionToFace(float x, float y, float z, int& face, float& sc, float& tc)
+{
+	float ax = fabsf(x), ay = fabsf(y), az = fabsf(z), ma;
+	if (ax >= ay && ax >= az) { face = x > 0.0f ? 0 : 1; ma = ax; sc = x > 0.0f ? -z : z; tc = -y; }
+	else if (ay >= az) { face = y > 0.0f ? 2 : 3; ma = ay; sc = x; tc = y > 0.0f ? z : -z; }
+	else { face = z > 0.0f ? 4 : 5; ma = az; sc = z > 0.0f ? x : -x; tc = -y; }
+	sc /= ma;
+	tc /= ma;
+}
+
+#ifdef ENVBAKER_USE_SSE2
+inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+//directionToFace for 4 directions, with the same choice of face in the ties
+inline void directionToFace4(__m128 x, __m128 y, __m128 z, int* face, float* sc, float* tc)
+{
+	__m128 sign_mask = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps();
+	__m128 ax = _mm_andnot_ps(sign_mask, x), ay = _mm_andnot_ps(sign_mask, y), az = _mm_andnot_ps(sign_mask, z);
+	__m128 is_x = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+	__m128 is_y = _mm_andnot_ps(is_x, _mm_cmpge_ps(ay, az));
+	__m128 pos_x = _mm_cmpgt_ps(x, zero), pos_y = _mm_cmpgt_ps(y, zero), pos_z = _mm_cmpgt_ps(z, zero);
+
+	__m128 ma = select4(is_x, ax, select4(is_y, ay, az));
+	__m128 s = select4(is_x, select4(pos_x, _mm_xor_ps(z, sign_mask), z), select4(is_y, x, select4(pos_z, x, _mm_xor_ps(x, sign_mask))));
+	__m128 t = select4(is_y, select4(pos_y, z, _mm_xor_ps(z, sign_mask)), _mm_xor_ps(y, sign_mask));
+	__m128 f = select4(is_x, select4(pos_x, _mm_set1_ps(0.0f), _mm_set1_ps(1.0f)),
+		select4(is_y, select4(pos_y, _mm_set1_ps(2.0f), _mm_set1_ps(3.0f)), select4(pos_z, _mm_set1_ps(4.0f), _mm_set1_ps(5.0f))));
+
+	_mm_storeu_ps(sc, _mm_div_ps(s, ma));
+	_mm_storeu_ps(tc, _mm_div_ps(t, ma));
+	_mm_storeu_si128((__m128i*)face, _mm_cvttps_epi32(f));
+}
+#endif
+
+//bilinear inside a face, clamped at its borders
+inline void sampleFace(const float* face, int size, float sc, float tc, float* rgb)
+{
+	float x = clampf((sc + 1.0f) * 0.5f * size - 0.5f, 0.0f, (float)(size - 1));
+	float y = clampf((tc + 1.0f) * 0.5f * size - 0.5f, 0.0f, (float)(size - 1));
+	int x0 = (int)x, y0 = (int)y;
+	int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+	float fx = x - x0, fy = y - y0;
+	const float* p00 = face + (y0 * size + x0) * 3;
+	const float* p10 = face + (y0 * size + x1) * 3;
+	const float* p01 = face + (y1 * size + x0) * 3;
+	const float* p11 = face + (y1 * size + x1) * 3;
+	for (int c = 0; c < 3; ++c)
+	{
+		float top = p00[c] + (p10[c] - p00[c]) * fx;
+		float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+		rgb[c] = top + (bottom - top) * fy;
+	}
+}
+
+//trilinear between the mips
+inline void sampleMips(const sCubeMips& mips, int face, float sc, float tc, float lod, float* rgb)
+{
+	lod = clampf(lod, 0.0f, (float)(mips.levels.size() - 1));
+	int l0 = (int)lod;
+	int l1 = std::min(l0 + 1, (int)mips.levels.size() - 1);
+	float f = lod - l0;
+
+	int size0 = std::max(1, mips.size >> l0);
+	sampleFace(&mips.levels[l0][(size_t)face * size0 * size0 * 3], size0, sc, tc, rgb);
+	if (f == 0.0f || l0 == l1)
+		return;
+	float rgb1[3];
+	int size1 = std::max(1, mips.size >> l1);
+	sampleFace(&mips.levels[l1][(size_t)face * size1 * size1 * 3], size1, sc, tc, rgb1);
+	for (int c = 0; c < 3; ++c)
+		rgb[c] += (rgb1[c] - rgb[c]) * f;
+}
+
+//hammersley points on the GGX distribution, reflected around the normal (view = normal). The lod of each sample
+//covers the solid angle it represents (pdf) in texels of level 0
+void buildLobe(float roughness, int num_samples, int size, sLobe& lobe)
+{
+	float a = roughness * roughness;
+	float a2 = a * a;
+	float texel_solid_angle = 4.0f * PI / (6.0f * size * size);
+	for (int i = 0; i < num_samples; ++i)
+	{
+		float xi1 = (float)i / num_samples;
+		float xi2 = radicalInverse(i);
+		float cos_theta = sqrtf((1.0f - xi2) / (1.0f + (a2 - 1.0f) * xi2));
+		float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+		float phi = 2.0f * PI * xi1;
+		float hx = sin_theta * cosf(phi), hy = sin_theta * sinf(phi);
+
+		float lz = 2.0f * cos_theta * cos_theta - 1.0f;
+		if (lz <= 0.0f)
+			continue;
+		float d = a2 / (PI * powf((a2 - 1.0f) * cos_theta * cos_theta + 1.0f, 2.0f));
+		float pdf = d * 0.25f; //D * NdotH / (4 * VdotH) with N = V
+		float sample_solid_angle = 1.0f / (num_samples * pdf);
+
+		lobe.x.push_back(2.0f * cos_theta * hx);
+		lobe.y.push_back(2.0f * cos_theta * hy);
+		lobe.z.push_back(lz);
+		lobe.weight.push_back(lz);
+		lobe.lod.push_back(std::max(0.0f, 0.5f * log2f(sample_solid_angle / texel_solid_angle) + 1.0f));
+	}
+	while (lobe.x.size() % 4)
+	{
+		lobe.x.push_back(0.0f);
+		lobe.y.push_back(0.0f);
+		lobe.z.push_back(1.0f);
+		lobe.weight.push_back(0.0f);
+		lobe.lod.push_back(0.0f);
+	}
+}
+
+//integral of the lobe around the direction n
+void prefilterTexel(const sCubeMips& mips, const sLobe& lobe, const float* n, float* rgb)
+{
+	//tangent frame
+	float up[3] = { 0.0f, 0.0f, 1.0f };
+	if (fabsf(n[2]) > 0.999f)
+		up[0] = 1.0f, up[2] = 0.0f;
+	float t[3] = { up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2], up[0] * n[1] - up[1] * n[0] };
+	float inv_len = 1.0f / sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	t[0] *= inv_len; t[1] *= inv_len; t[2] *= inv_len;
+	float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+
+	float sum[3] = { 0.0f, 0.0f, 0.0f }, total_weight = 0.0f;
+	int face[4];
+	float sc[4], tc[4];
+	for (size_t i = 0; i < lobe.x.size(); i += 4)
+	{
+#ifdef ENVBAKER_USE_SSE2
+		__m128 lx = _mm_loadu_ps(&lobe.x[i]), ly = _mm_loadu_ps(&lobe.y[i]), lz = _mm_loadu_ps(&lobe.z[i]);
+		__m128 wx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(t[0])), _mm_mul_ps(ly, _mm_set1_ps(b[0]))), _mm_mul_ps(lz, _mm_set1_ps(n[0])));
+		__m128 wy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(t[1])), _mm_mul_ps(ly, _mm_set1_ps(b[1]))), _mm_mul_ps(lz, _mm_set1_ps(n[1])));
+		__m128 wz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(t[2])), _mm_mul_ps(ly, _mm_set1_ps(b[2]))), _mm_mul_ps(lz, _mm_set1_ps(n[2])));
+		directionToFace4(wx, wy, wz, face, sc, tc);
+#else
+		for (int j = 0; j < 4; ++j)
+		{
+			float wx = lobe.x[i + j] * t[0] + lobe.y[i + j] * b[0] + lobe.z[i + j] * n[0];
+			float wy = lobe.x[i + j] * t[1] + lobe.y[i + j] * b[1] + lobe.z[i + j] * n[1];
+			float wz = lobe.x[i + j] * t[2] + lobe.y[i + j] * b[2] + lobe.z[i + j] * n[2];
+			directionToFace(wx, wy, wz, face[j], sc[j], tc[j]);
+		}
+#endif
+		for (int j = 0; j < 4; ++j)
+		{
+			float w = lobe.weight[i + j];
+			if (w == 0.0f)
+				continue;
+			float sample[3];
+			sampleMips(mips, face[j], sc[j], tc[j], lobe.lod[i + j], sample);
+			sum[0] += sample[0] * w;
+			sum[1] += sample[1] * w;
+			sum[2] += sample[2] * w;
+			total_weight += w;
+		}
+	}
+	for (int c = 0; c < 3; ++c)
+		rgb[c] = total_weight > 0.0f ? sum[c] / total_weight : 0.0f;
+}
+
+}
+
+void getCubemapDirection(int face, float x, float y, int size, float* dir)
+{
+	float sc = 2.0f * x / size - 1.0f;
+	float tc = 2.0f * y / size - 1.0f;
+	switch (face)
+	{
+		case 0: dir[0] = 1.0f; dir[1] = -tc; dir[2] = -sc; break;
+		case 1: dir[0] = -1.0f; dir[1] = -tc; dir[2] = sc; break;
+		case 2: dir[0] = sc; dir[1] = 1.0f; dir[2] = tc; break;
+		case 3: dir[0] = sc; dir[1] = -1.0f; dir[2] = -tc; break;
+		case 4: dir[0] = sc; dir[1] = -tc; dir[2] = 1.0f; break;
+		default: dir[0] = -sc; dir[1] = -tc; dir[2] = -1.0f; break;
+	}
+	float inv_len = 1.0f / sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	dir[0] *= inv_len;
+	dir[1] *= inv_len;
+	dir[2] *= inv_len;
+}
+
+void bakeEnvironment(const float* equirect, int width, int height, int channels, const sEnvBakeOptions& options, HDRE& hdre)
+{
+	int size = options.size;
+	hdre.create(size, 3);
+
+	//level 0, supersampled when the image has more than one pixel per texel
+	int taps = std::max(1, std::min(4, (int)ceilf(width / (4.0f * size))));
+	ThreadPool::getDefault()->parallelFor(size * 6, [&](int row) {
+		int face = row / size;
+		int y = row % size;
+		float* dst = hdre.getFace(0, face) + (size_t)y * size * 3;
+		for (int x = 0; x < size; ++x)
+		{
+			float sum[3] = { 0.0f, 0.0f, 0.0f };
+			for (int j = 0; j < taps; ++j)
+				for (int i = 0; i < taps; ++i)
+				{
+					float dir[3], rgb[3];
+					getCubemapDirection(face, x + (i + 0.5f) / taps, y + (j + 0.5f) / taps, size, dir);
+					sampleEquirect(width, height, dir, rgb, [&](int px, int py, float* p) {
+						memcpy(p, equirect + ((size_t)py * width + px) * channels, 3 * sizeof(float));
+					});
+					sum[0] += rgb[0]; sum[1] += rgb[1]; sum[2] += rgb[2];
+				}
+			for (int c = 0; c < 3; ++c)
+				dst[x * 3 + c] = sum[c] / (taps * taps);
+		}
+	});
+
+	bakeEnvironmentLevels(options, hdre);
+}
+
+void bakeEnvironmentLevels(const sEnvBakeOptions& options, HDRE& hdre)
+{
+	ThreadPool* pool = ThreadPool::getDefault();
+	int size = hdre.width;
+
+	sCubeMips mips;
+	mips.size = size;
+	mips.levels.push_back(std::vector<float>((size_t)size * size * 3 * 6));
+	for (int f = 0; f < N_FACES; ++f)
+		memcpy(&mips.levels[0][(size_t)f * size * size * 3], hdre.getFace(0, f), (size_t)size * size * 3 * sizeof(float));
+
+	//box mips down to 1x1 for the filtered lookups
+	for (int s = size / 2; s >= 1; s /= 2)
+	{
+		const std::vector<float>& src = mips.levels.back();
+		std::vector<float> level((size_t)s * s * 3 * 6);
+		pool->parallelFor(s * 6, [&](int row) {
+			int face = row / s;
+			int y = row % s;
+			const float* face_src = &src[(size_t)face * s * s * 4 * 3];
+			for (int x = 0; x < s; ++x)
+				for (int c = 0; c < 3; ++c)
+				{
+					const float* p = face_src + ((size_t)(y * 2) * s * 2 + x * 2) * 3 + c;
+					level[((size_t)row * s + x) * 3 + c] = (p[0] + p[3] + p[s * 2 * 3] + p[s * 2 * 3 + 3]) * 0.25f;
+				}
+		});
+		mips.levels.push_back(level);
+	}
+
+	//the rough levels
+	for (int i = 1; i < N_LEVELS; ++i)
+	{
+		sHDRELevel level = hdre.getLevel(i);
+		sLobe lobe;
+		buildLobe((float)i / (N_LEVELS - 1), options.num_samples, size, lobe);
+		pool->parallelFor(level.width * N_FACES, [&](int row) {
+			int face = row / level.width;
+			int y = row % level.width;
+			float* dst = level.faces[face] + (size_t)y * level.width * 3;
+			for (int x = 0; x < level.width; ++x)
+			{
+				float n[3];
+				getCubemapDirection(face, x + 0.5f, y + 0.5f, level.width, n);
+				prefilterTexel(mips, lobe, n, dst + x * 3);
+			}
+		});
+	}
+
+	float coeffs[27];
+	projectSH9(hdre.getFaces(0), size, 3, coeffs);
+	hdre.setSHCoeffs(coeffs);
+
+	float max_luminance = 0.0f;
+	const std::vector<float>& base = mips.levels[0];
+	for (size_t i = 0; i < base.size(); i += 3)
+		max_luminance = std::max(max_luminance, 0.2126f * base[i] + 0.7152f * base[i + 1] + 0.0722f * base[i + 2]);
+	hdre.setMaxLuminance(max_luminance);
+}
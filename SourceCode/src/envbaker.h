@@ -0,0 +1,73 @@
+/*  Environment baker: builds the HDRE levels used for image based lighting from an equirectangular HDR image, all on CPU.
+	Level 0 is the cubemap resampled from the image, every next level is prefiltered with the GGX lobe of its roughness
+	(level / (N_LEVELS - 1), the shader samples it with that lod) by importance sampling the mips of level 0 with a lod that
+	matches the solid angle of each sample, so a few samples are enough and dont show noise. The SH9 of the radiance goes in the header.
+	The texels of a level are split between the threads and the samples are transformed and projected 4 at a time with SSE.
+*/
+
+#ifndef ENVBAKER_H
+#define ENVBAKER_H
+
+#include <cmath>
+#include <algorithm>
+
+class HDRE;
+
+struct sEnvBakeOptions {
+	int size; //of the faces of level 0, a power of two. From 256 every level halves (the HDRE doesnt go below 8 pixels)
+	int num_samples; //per texel of the rough levels
+
+	sEnvBakeOptions() { size = 256; num_samples = 128; }
+};
+
+//equirect has width x height pixels of channels floats (3 or 4), the first row is up (+Y). hdre is created with RGB levels
+void bakeEnvironment(const float* equirect, int width, int height, int channels, const sEnvBakeOptions& options, HDRE& hdre);
+//the same from a level 0 already in an RGB hdre (see HDRE::create), ex: resampled from an RGBEImage
+void bakeEnvironmentLevels(const sEnvBakeOptions& options, HDRE& hdre);
+
+//normalized direction through a position of a face in texels (the center of the first texel is 0.5,0.5), GL order and orientation
+void getCubemapDirection(int face, float x, float y, int size, float* dir);
+
+//bilinear sample of an equirectangular image of width x height pixels in the direction dir, repeating horizontally.
+//decode(x, y, rgb) writes the 3 floats of a pixel, so any pixel format uses the same mapping
+template<typename Decode>
+void sampleEquirect(int width, int height, const float* dir, float* rgb, Decode decode)
+{
+	const float pi = 3.14159265358979f;
+	float u = atan2f(dir[2], dir[0]) * (0.5f / pi) + 0.5f;
+	float v = acosf(std::max(-1.0f, std::min(1.0f, dir[1]))) / pi;
+	float x = u * width - 0.5f;
+	float y = std::max(0.0f, std::min((float)(height - 1), v * height - 0.5f));
+	float fl = floorf(x);
+	float fx = x - fl;
+	int x0 = ((int)fl % width + width) % width;
+	int x1 = (x0 + 1) % width;
+	int y0 = (int)y;
+	int y1 = std::min(y0 + 1, height - 1);
+	float fy = y - y0;
+
+	float p00[3], p10[3], p01[3], p11[3];
+	decode(x0, y0, p00);
+	decode(x1, y0, p10);
+	decode(x0, y1, p01);
+	decode(x1, y1, p11);
+	for (int c = 0; c < 3; ++c)
+	{
+		float top = p00[c] + (p10[c] - p00[c]) * fx;
+		float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+		rgb[c] = top + (bottom - top) * fy;
+	}
+}
+
+//the bits of i mirrored around the point, the second coordinate of the hammersley points (i / n, radicalInverse(i))
+inline float radicalInverse(unsigned int bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return bits * 2.3283064365386963e-10f;
+}
+
+#endif
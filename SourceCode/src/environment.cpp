@@ -0,0 +1,198 @@
+#include "environment.h"
+#include "texture.h"
+#include "brdflut.h"
+#include "shader.h"
+#include "imagekernels.h"
+#include "sh9.h"
+#include "rgbe.h"
+#include "utils.h"
+
+#include <cstring>
+
+std::map<std::string, Environment*> Environment::sEnvironmentsLoaded;
+Environment* Environment::current = NULL;
+eEnvironmentQuality Environment::quality = ENVIRONMENT_QUALITY_HIGH;
+Texture* Environment::brdf_lut = NULL;
+
+//the faces of a level in the storage of the quality, data keeps the converted ones
+static Uint8** convertFaces(sHDRELevel& level, int channels, eEnvironmentQuality quality, std::vector<Uint8>& data, Uint8** faces)
+{
+	if (quality == ENVIRONMENT_QUALITY_FULL)
+		return (Uint8**)level.faces;
+
+	size_t num_pixels = (size_t)level.width * level.height;
+	size_t face_size = quality == ENVIRONMENT_QUALITY_HIGH ? num_pixels * channels * sizeof(unsigned short) : num_pixels * sizeof(unsigned int);
+	data.resize(face_size * N_FACES);
+	for (int i = 0; i < N_FACES; ++i)
+	{
+		faces[i] = &data[face_size * i];
+		if (quality == ENVIRONMENT_QUALITY_HIGH)
+			floatToHalf(level.faces[i], (unsigned short*)faces[i], num_pixels * channels);
+		else
+			floatToR11G11B10F(level.faces[i], channels, (unsigned int*)faces[i], num_pixels);
+	}
+	return faces;
+}
+
+Environment::Environment()
+{
+	cubemap = NULL;
+	num_levels = 0;
+	has_sh = false;
+	max_luminance = 0.0f;
+	memset(sh_coeffs, 0, sizeof(sh_coeffs));
+	memset(sh_diffuse, 0, sizeof(sh_diffuse));
+}
+
+Environment::~Environment()
+{
+	delete cubemap;
+	if (current == this)
+		current = NULL;
+	auto it = sEnvironmentsLoaded.find(filename);
+	if (it != sEnvironmentsLoaded.end() && it->second == this)
+		sEnvironmentsLoaded.erase(it);
+}
+
+bool Environment::load(const char* filename, eEnvironmentQuality quality)
+{
+	HDRE hdre(filename);
+	if (!hdre.getData())
+		return false;
+	return create(hdre, filename, quality);
+}
+
+bool Environment::loadHDR(const char* filename, eEnvironmentQuality quality, const sEnvBakeOptions& options)
+{
+	std::string cache_filename = std::string(filename) + ".hdre";
+	HDRE hdre;
+	if (!isCacheValid(filename, cache_filename.c_str()) || !hdre.load(cache_filename.c_str()))
+	{
+		long time = getTime();
+		RGBEImage image;
+		if (!image.load(filename))
+			return false;
+
+		//level 0 is resampled straight into the HDRE
+		hdre.create(options.size, 3);
+		equirectToCubemap(image, options.size, hdre.getFaces(0));
+		bakeEnvironmentLevels(options, hdre);
+		std::cout << " + Environment baked: " << filename << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		if (!hdre.save(cache_filename.c_str()))
+			std::cout << " * Environment: cannot write the cache '" << cache_filename << "'" << std::endl;
+	}
+	return create(hdre, filename, quality);
+}
+
+bool Environment::create(HDRE& hdre, const char* name, eEnvironmentQuality quality)
+{
+	this->filename = name;
+	//one cubemap with the levels as mips, the HDRE stops halving at 8 pixels so the smaller ones are skipped
+	//the half floats keep the alpha of the file in the upload but not in the storage
+	int channels = hdre.getNumChannels();
+	unsigned int format = channels == 3 ? GL_RGB : GL_RGBA;
+	unsigned int internal_format = channels == 3 ? GL_RGB32F : GL_RGBA32F;
+	unsigned int type = GL_FLOAT;
+	if (quality == ENVIRONMENT_QUALITY_HIGH)
+	{
+		internal_format = GL_RGB16F;
+		type = GL_HALF_FLOAT;
+	}
+	else if (quality == ENVIRONMENT_QUALITY_LOW)
+	{
+		internal_format = GL_R11F_G11F_B10F;
+		format = GL_RGB;
+		type = GL_UNSIGNED_INT_10F_11F_11F_REV;
+	}
+
+	std::vector<Uint8> data;
+	Uint8* faces[N_FACES];
+	sHDRELevel level = hdre.getLevel(0);
+	cubemap = new Texture();
+	cubemap->createCubemap(level.width, level.height, convertFaces(level, channels, quality, data, faces), format, type, false, internal_format);
+	num_levels = 1;
+	for (int i = 1; i < N_LEVELS; ++i, ++num_levels)
+	{
+		sHDRELevel next = hdre.getLevel(i);
+		if (level.width >> i != next.width)
+			break;
+		cubemap->uploadCubemapLevel(i, convertFaces(next, channels, quality, data, faces));
+	}
+
+	max_luminance = hdre.getMaxLuminance();
+	float* coeffs = hdre.getSHCoeffs();
+	has_sh = coeffs != NULL;
+	if (coeffs)
+		memcpy(sh_coeffs, coeffs, sizeof(sh_coeffs));
+	else
+		projectSH9(hdre.getFaces(0), hdre.width, channels, sh_coeffs);
+	getSHDiffuse(sh_coeffs, sh_diffuse);
+
+	if (!brdf_lut)
+		brdf_lut = createBRDFLUT();
+	return true;
+}
+
+void Environment::bind(Shader* shader, int first_slot)
+{
+	shader->setUniform("u_env", cubemap, first_slot);
+	shader->setUniform("u_env_max_lod", (float)(num_levels - 1));
+	shader->setUniform("u_brdf_lut", brdf_lut, first_slot + 1);
+	shader->setUniform3Array("u_sh_diffuse", sh_diffuse, 9);
+}
+
+Environment* Environment::Get(const char* filename)
+{
+	assert(filename);
+	auto it = sEnvironmentsLoaded.find(filename);
+	if (it != sEnvironmentsLoaded.end())
+		return it->second;
+
+	Environment* environment = new Environment();
+	std::string str = filename;
+	std::string ext = str.size() > 4 ? str.substr(str.size() - 4, 4) : "";
+	bool loaded = ext == ".hdr" || ext == ".HDR" ? environment->loadHDR(filename, quality) : environment->load(filename, quality);
+	if (!loaded)
+	{
+		delete environment;
+		return NULL;
+	}
+	return add(environment);
+}
+
+Environment* Environment::Bake(const char* name, const float* equirect, int width, int height, int channels, const sEnvBakeOptions& options)
+{
+	assert(name);
+	auto it = sEnvironmentsLoaded.find(name);
+	if (it != sEnvironmentsLoaded.end())
+		return it->second;
+
+	long time = getTime();
+	HDRE hdre;
+	bakeEnvironment(equirect, width, height, channels, options, hdre);
+	std::cout << " + Environment baked: " << name << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+
+	Environment* environment = new Environment();
+	environment->create(hdre, name, quality);
+	return add(environment);
+}
+
+Environment* Environment::add(Environment* environment)
+{
+	sEnvironmentsLoaded[environment->filename] = environment;
+	if (!current)
+		current = environment;
+	return environment;
+}
+
+void Environment::renderMenu()
+{
+	for (auto it = sEnvironmentsLoaded.begin(); it != sEnvironmentsLoaded.end(); ++it)
+	{
+		if (ImGui::RadioButton(it->first.c_str(), current == it->second))
+			current = it->second;
+		ImGui::SameLine();
+		ImGui::Text("%.1f MBs", it->second->cubemap->memory_size / (1024.0f * 1024.0f));
+	}
+	ImGui::Combo("Quality", (int*)&quality, "Full (32F)\0High (RGB16F)\0Low (R11G11B10F)\0");
+}
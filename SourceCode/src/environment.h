@@ -0,0 +1,63 @@
+/*  Environment: the image based lighting of an HDRE file, loaded once and shared by every material that uses it.
+	It owns the prefiltered cubemap (its mips are the HDRE levels, level 0 is the sky) and the SH9 of the diffuse; the materials only keep a pointer,
+	or none to follow Environment::current, so the lighting of the whole scene can be swapped at runtime without rebuilding them. The BRDF LUT does not depend on the environment, it is shared by all of them.
+*/
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "includes.h"
+#include "extra/hdre.h"
+#include "envbaker.h"
+
+#include <map>
+#include <string>
+
+class Texture;
+class Shader;
+
+//storage of the cubemap on the GPU, the HDRE data is converted when loading
+enum eEnvironmentQuality {
+	ENVIRONMENT_QUALITY_FULL, //floats as in the file, 12 or 16 bytes per texel
+	ENVIRONMENT_QUALITY_HIGH, //RGB16F, 6 bytes
+	ENVIRONMENT_QUALITY_LOW //R11F_G11F_B10F, 4 bytes (no sign, 6 and 5 bits of mantissa)
+};
+
+class Environment
+{
+public:
+	static std::map<std::string, Environment*> sEnvironmentsLoaded;
+	static Environment* current; //used by the materials without their own
+	static eEnvironmentQuality quality; //of the ones loaded after changing it
+
+	std::string filename;
+	Texture* cubemap; //mip i is the HDRE level i, from sharp to the roughest
+	int num_levels;
+	static Texture* brdf_lut; //shared by all the environments, computed (or read from its cache) with the first one
+	float sh_coeffs[27]; //9 RGB coefficients of the radiance, projected from the sharp level if the file has none
+	float sh_diffuse[27]; //the same convolved with the cosine lobe, the diffuse IBL of the shader
+	bool has_sh;
+	float max_luminance;
+
+	Environment();
+	~Environment();
+
+	bool load(const char* filename, eEnvironmentQuality quality = ENVIRONMENT_QUALITY_HIGH); //uploads the levels, the HDRE is not kept in memory
+	//a radiance .hdr equirect, baked once and cached next to it (ex: sky.hdr.hdre), the cache is used while it is newer than the image
+	bool loadHDR(const char* filename, eEnvironmentQuality quality = ENVIRONMENT_QUALITY_HIGH, const sEnvBakeOptions& options = sEnvBakeOptions());
+	bool create(HDRE& hdre, const char* name, eEnvironmentQuality quality = ENVIRONMENT_QUALITY_HIGH); //from levels already in memory
+
+	//u_env (in first_slot), u_env_max_lod, u_brdf_lut (next slot) and u_sh_diffuse
+	void bind(Shader* shader, int first_slot = 0);
+
+	static Environment* Get(const char* filename); //.hdre or .hdr
+	//prefiltered on CPU from an equirectangular image (see envbaker.h), registered with the name
+	static Environment* Bake(const char* name, const float* equirect, int width, int height, int channels, const sEnvBakeOptions& options = sEnvBakeOptions());
+	static void setCurrent(Environment* environment) { current = environment; }
+	static void renderMenu(); //lists the loaded ones to choose the current, and the quality
+
+private:
+	static Environment* add(Environment* environment); //registered, and current if there was none
+};
+
+#endif
@@ -1,28 +1,71 @@
 #include <iostream>
-#include <fstream>
-#include <cmath>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <vector>
 
 #include "hdre.h"
 
-HDRE::HDRE(const char* filename)
+#define HDRE_ALIGNMENT 64 // so every SIMD load of a level is aligned
+
+static int getLevelSize(int size, int level)
 {
-	load(filename);
+	return std::max(8, size >> level);
+}
+
+HDRE::HDRE()
+{
+	buffer = NULL;
+	data = NULL;
+	memset(level_buffers, 0, sizeof(level_buffers));
+	width = height = 0;
+	memset(&header, 0, sizeof(header));
+	clear();
+}
+
+HDRE::HDRE(const char* filename, bool lazy)
+{
+	buffer = NULL;
+	data = NULL;
+	memset(level_buffers, 0, sizeof(level_buffers));
+	width = height = 0;
+	memset(&header, 0, sizeof(header));
+	clear();
+	load(filename, lazy);
 }
 
 HDRE::~HDRE()
 {
-	
+	clear();
+}
+
+void HDRE::clear()
+{
+	delete[] buffer;
+	buffer = NULL;
+	data = NULL;
+	for (int i = 0; i < N_LEVELS; i++)
+	{
+		delete[] level_buffers[i];
+		level_buffers[i] = NULL;
+		loaded[i] = false;
+		for (int j = 0; j < N_FACES; j++)
+			pixels[i][j] = NULL;
+	}
+	for (int i = 0; i <= N_LEVELS; i++)
+		level_offsets[i] = 0;
 }
 
 sHDRELevel HDRE::getLevel(int n)
 {
 	sHDRELevel level;
 
-	level.width = std::max(8, (int)(this->width / pow(2.0, n)));
-	level.height = std::max(8, (int)(this->height / pow(2.0, n)));
-	level.data = this->faces_array[n];
+	level.width = getLevelSize(this->width, n);
+	level.height = getLevelSize(this->height, n);
+	level.data = loadLevel(n) ? this->pixels[n][0] : NULL;
 	level.faces = this->getFaces(n);
 
 	return level;
@@ -30,104 +73,200 @@ sHDRELevel HDRE::getLevel(int n)
 
 float* HDRE::getData()
 {
+	// the lazy levels read until now are moved to one buffer
+	if (!this->data && this->level_offsets[N_LEVELS])
+	{
+		float* levels[N_LEVELS];
+		for (int i = 0; i < N_LEVELS; i++)
+			levels[i] = this->pixels[i][0];
+		allocate();
+		for (int i = 0; i < N_LEVELS; i++)
+			if (this->level_buffers[i])
+			{
+				memcpy(this->data + this->level_offsets[i], levels[i], (this->level_offsets[i + 1] - this->level_offsets[i]) * sizeof(float));
+				delete[] this->level_buffers[i];
+				this->level_buffers[i] = NULL;
+			}
+	}
+
+	for (int i = 0; i < N_LEVELS; i++)
+		if (!loadLevel(i))
+			return NULL;
 	return this->data;
 }
 
 float* HDRE::getFace(int level, int face)
 {
-	return this->pixels[level][face];
+	return loadLevel(level) ? this->pixels[level][face] : NULL;
 }
 
 float** HDRE::getFaces(int level)
 {
-	return this->pixels[level];
+	return loadLevel(level) ? this->pixels[level] : NULL;
 }
 
-bool HDRE::load(const char* filename)
+bool HDRE::loadLevel(int level)
 {
-	FILE *f;
-	assert(filename);
+	assert(level >= 0 && level < N_LEVELS);
+	if (this->loaded[level])
+		return true;
+	if (!this->level_offsets[N_LEVELS])
+		return false;
 
-	fopen_s(&f, filename, "rb");
+	FILE* f = fopen(this->filename.c_str(), "rb");
 	if (f == NULL)
+	{
+		std::cout << "[ERROR] HDRE: cannot open '" << this->filename << "'" << std::endl;
 		return false;
+	}
 
-	sHDREHeader HDREHeader;
-
-	fread(&HDREHeader, sizeof(sHDREHeader), 1, f);
-
-	if (HDREHeader.type != 3)
-		throw("ArrayType not supported. Please export in Float32Array.");
+	size_t num_floats = this->level_offsets[level + 1] - this->level_offsets[level];
+	float* dst = this->data ? this->data + this->level_offsets[level] : allocateLevel(level);
+	bool ok = fseek(f, this->header.headerSize + this->level_offsets[level] * sizeof(float), SEEK_SET) == 0 &&
+		fread(dst, sizeof(float), num_floats, f) == num_floats;
+	fclose(f);
 
-	this->header = HDREHeader;
+	if (!ok)
+		std::cout << "[ERROR] HDRE: '" << this->filename << "' is truncated at level " << level << std::endl;
+	this->loaded[level] = ok;
+	return ok;
+}
 
-	int width = HDREHeader.width;
-	int height = HDREHeader.height;
+void HDRE::computeOffsets()
+{
+	// Get number of floats inside the HDRE, per channel & per face
+	for (int i = 0; i < N_LEVELS; i++)
+	{
+		int w = getLevelSize(this->width, i);
+		this->level_offsets[i + 1] = this->level_offsets[i] + (size_t)w * w * N_FACES * this->header.numChannels;
+	}
+}
 
-	this->width = width;
-	this->height = height;
+float* HDRE::allocateLevel(int level)
+{
+	size_t num_floats = this->level_offsets[level + 1] - this->level_offsets[level];
+	delete[] this->level_buffers[level];
+	this->level_buffers[level] = new char[num_floats * sizeof(float) + HDRE_ALIGNMENT];
+	float* level_data = (float*)(((uintptr_t)this->level_buffers[level] + HDRE_ALIGNMENT - 1) & ~(uintptr_t)(HDRE_ALIGNMENT - 1));
+
+	size_t face_size = num_floats / N_FACES;
+	for (int j = 0; j < N_FACES; j++)
+		this->pixels[level][j] = level_data + j * face_size;
+	return level_data;
+}
 
-	int dataSize = 0;
-	int w = width;
-	int h = height;
+void HDRE::allocate()
+{
+	// one allocation for everything, levels and faces point inside
+	size_t data_size = this->level_offsets[N_LEVELS];
+	this->buffer = new char[data_size * sizeof(float) + HDRE_ALIGNMENT];
+	this->data = (float*)(((uintptr_t)this->buffer + HDRE_ALIGNMENT - 1) & ~(uintptr_t)(HDRE_ALIGNMENT - 1));
 
-	// Get number of floats inside the HDRE
-	// Per channel & Per face
 	for (int i = 0; i < N_LEVELS; i++)
 	{
-		int mip_level = i + 1;
-		dataSize += w * w * N_FACES * HDREHeader.numChannels;
-		w = std::max(8, (int)(width / pow(2.0, mip_level)));
+		int w = getLevelSize(this->width, i);
+		size_t face_size = (size_t)w * w * this->header.numChannels;
+		for (int j = 0; j < N_FACES; j++)
+			this->pixels[i][j] = this->data + this->level_offsets[i] + j * face_size;
 	}
+}
 
-	this->data = new float[dataSize];
-
-	fseek(f, HDREHeader.headerSize, SEEK_SET);
+void HDRE::create(int size, int num_channels)
+{
+	clear();
+	memset(&this->header, 0, sizeof(this->header));
+	memcpy(this->header.signature, "HDRE", 4);
+	this->header.version = 2.0f;
+	this->header.width = this->header.height = (short)size;
+	this->header.numChannels = (short)num_channels;
+	this->header.bitsPerChannel = 32;
+	this->header.headerSize = (short)sizeof(sHDREHeader);
+	this->header.type = 3;
+	this->width = this->height = size;
+	this->filename.clear();
+
+	computeOffsets();
+	allocate();
+	for (int i = 0; i < N_LEVELS; i++)
+		this->loaded[i] = true;
+}
 
-	fread(this->data, sizeof(float) * dataSize, 1, f);
-	fclose(f);
+void HDRE::setSHCoeffs(const float* coeffs)
+{
+	this->header.includesSH = coeffs ? 1 : 0;
+	this->header.numCoeffs = coeffs ? 9.0f : 0.0f;
+	if (coeffs)
+		memcpy(this->header.coeffs, coeffs, sizeof(this->header.coeffs));
+}
 
-	// get separated levels
+bool HDRE::save(const char* filename)
+{
+	float* data = getData();
+	if (!data)
+		return false;
 
-	w = width;
-	int mapOffset = 0;
-	
-	for (int i = 0; i < N_LEVELS; i++)
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
 	{
-		int mip_level = i + 1;
-		int faceSize = w * w * HDREHeader.numChannels;
-		int mapSize = faceSize * N_FACES;
-		
-		int faceOffset = 0;
-		int facePixel = 0;
+		std::cout << "[ERROR] HDRE: cannot write '" << filename << "'" << std::endl;
+		return false;
+	}
 
-		this->faces_array[i] = new float[mapSize];
+	// the data starts at headerSize, the space after the header is zeroed
+	std::vector<char> header_data(std::max((size_t)this->header.headerSize, sizeof(sHDREHeader)), 0);
+	memcpy(&header_data[0], &this->header, sizeof(sHDREHeader));
+	bool ok = fwrite(&header_data[0], 1, this->header.headerSize, f) == (size_t)this->header.headerSize &&
+		fwrite(data, sizeof(float), this->level_offsets[N_LEVELS], f) == this->level_offsets[N_LEVELS];
+	fclose(f);
+	return ok;
+}
 
-		for (int j = 0; j < N_FACES; j++)
-		{
-			// allocate memory
-			this->pixels[i][j] = new float[faceSize];
+bool HDRE::load(const char* filename, bool lazy)
+{
+	assert(filename);
+	clear();
 
-			// set data
-			for (int k = 0; k < faceSize; k++) {
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] HDRE: file not found '" << filename << "'" << std::endl;
+		return false;
+	}
 
-				float value = this->data[mapOffset + faceOffset + k];
+	sHDREHeader HDREHeader;
+	if (fread(&HDREHeader, sizeof(sHDREHeader), 1, f) != 1 || HDREHeader.type != 3)
+	{
+		std::cout << "[ERROR] HDRE: ArrayType not supported in '" << filename << "'. Please export in Float32Array." << std::endl;
+		fclose(f);
+		return false;
+	}
 
-				this->pixels[i][j][k] = value;
-				this->faces_array[i][facePixel] = value;
-				facePixel++;
-			}
+	this->header = HDREHeader;
+	this->filename = filename;
+	this->width = HDREHeader.width;
+	this->height = HDREHeader.height;
 
-			// update face offset
-			faceOffset += faceSize;
-		}	
+	computeOffsets();
+	size_t data_size = this->level_offsets[N_LEVELS];
 
-		// update level offset
-		mapOffset += mapSize;
-		// reassign width for next level
-		w = std::max(8, (int)(width / pow(2.0, mip_level)));
+	if (!lazy)
+	{
+		// the whole chain with one read
+		allocate();
+		bool ok = fseek(f, HDREHeader.headerSize, SEEK_SET) == 0 && fread(this->data, sizeof(float), data_size, f) == data_size;
+		fclose(f);
+		if (!ok)
+		{
+			std::cout << "[ERROR] HDRE: '" << filename << "' is truncated" << std::endl;
+			clear();
+			return false;
+		}
+		for (int i = 0; i < N_LEVELS; i++)
+			this->loaded[i] = true;
 	}
+	else
+		fclose(f);
 
-	std::cout << std::endl << " + '" << filename << "' loaded successfully" << std::endl;
+	std::cout << std::endl << " + '" << filename << "' " << (lazy ? "opened" : "loaded") << " successfully" << std::endl;
 	return true;
-}
\ No newline at end of file
+}
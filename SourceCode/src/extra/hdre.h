@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #define N_LEVELS 6
 #define N_FACES 6
 
@@ -37,34 +39,54 @@ typedef struct {
 
 } sHDRELevel;
 
+// All the levels are read in one aligned buffer, levels and faces are views into it (faces of a level are consecutive)
+// With lazy loading only the header is read at first, every level is allocated and read from the file the first time it is requested
+// (getData moves them to one buffer)
+// It can also be created empty to be filled (ex: by the environment baker) and saved
 class HDRE {
 
 private:
-	
+
+	char * buffer; // allocation of data, not aligned
+	char * level_buffers[N_LEVELS]; // lazy levels, allocated on their own until getData
 	float * data; // only f32 now
 	float * pixels[N_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
-	float * faces_array[N_LEVELS];
+	size_t level_offsets[N_LEVELS + 1]; // in floats, the last one is the size of data
+	bool loaded[N_LEVELS];
 
+	std::string filename;
 	sHDREHeader header;
 
+	bool loadLevel(int level);
+	void clear();
+	void computeOffsets(); // level_offsets from the header
+	void allocate(); // buffer and views
+	float* allocateLevel(int level); // a level alone and its views
+
 public:
 
 	int width;
 	int height;
 
-	HDRE(const char* filename);
+	HDRE();
+	HDRE(const char* filename, bool lazy = false);
 	~HDRE();
 
-	bool load(const char* filename);
+	bool load(const char* filename, bool lazy = false);
+	bool save(const char* filename);
+
+	void create(int size, int num_channels); // all the levels allocated to be written through getFace
+	void setSHCoeffs(const float* coeffs); // 9 RGB
+	void setMaxLuminance(float value) { this->header.maxLuminance = value; }
 
 	// useful methods
 	float getMaxLuminance() { return this->header.maxLuminance; };
-	float* getSHCoeffs() { if(this->header.numCoeffs > 0) return this->header.coeffs; }
+	float* getSHCoeffs() { return this->header.numCoeffs > 0 ? this->header.coeffs : NULL; }
+	int getNumChannels() { return this->header.numChannels; }
 
-	float* getData(); // All pixel data
+	float* getData(); // All pixel data, loads every level
 	float* getFace(int level, int face);	// Specific level and face
 	float** getFaces(int level = 0);		// [[]]: Array per face with all level data
 
 	sHDRELevel getLevel(int level = 0);
 };
-
@@ -50,8 +50,12 @@ bool FBO::create( int width, int height, int format, int type, int num_textures
 
 	//create textures
 	for (int i = 0; i < num_textures; ++i)
+	{
 		color_textures[i] = new Texture(width, height, format, type, false );
+		color_textures[i]->category = TEXTURE_CATEGORY_RENDER_TARGET;
+	}
 	depth_texture = new Texture(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
+	depth_texture->category = TEXTURE_CATEGORY_RENDER_TARGET;
 
 	glGenFramebuffersEXT(1, &fbo_id);
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
@@ -143,6 +147,7 @@ bool FBO::createDepthOnly(int width, int height)
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER_EXT, renderbuffer_color);
 
 	depth_texture = new Texture(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
+	depth_texture->category = TEXTURE_CATEGORY_RENDER_TARGET;
 	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
 
 	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
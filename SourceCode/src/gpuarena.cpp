@@ -0,0 +1,368 @@
+#include "gpuarena.h"
+#include "mesh.h"
+#include "shader.h"
+#include "utils.h"
+
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+
+// OFFSET ALLOCATOR *************************
+
+void OffsetAllocator::reset(unsigned int capacity)
+{
+	this->capacity = capacity;
+	used = 0;
+	free_ranges.clear();
+	if (capacity)
+		free_ranges[0] = capacity;
+}
+
+void OffsetAllocator::grow(unsigned int new_capacity)
+{
+	assert(new_capacity >= capacity);
+	if (new_capacity == capacity)
+		return;
+	unsigned int old_capacity = capacity;
+	capacity = new_capacity;
+
+	//extend the last free range if it reaches the old end
+	if (!free_ranges.empty())
+	{
+		auto last = std::prev(free_ranges.end());
+		if (last->first + last->second == old_capacity)
+		{
+			last->second += new_capacity - old_capacity;
+			return;
+		}
+	}
+	free_ranges[old_capacity] = new_capacity - old_capacity;
+}
+
+int OffsetAllocator::allocate(unsigned int size)
+{
+	if (!size)
+		return -1;
+
+	//best fit: the smallest range where it fits, to keep big ranges for big meshes
+	auto best = free_ranges.end();
+	for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+		if (it->second >= size && (best == free_ranges.end() || it->second < best->second))
+		{
+			best = it;
+			if (it->second == size)
+				break;
+		}
+
+	if (best == free_ranges.end())
+		return -1;
+
+	unsigned int offset = best->first;
+	unsigned int remaining = best->second - size;
+	free_ranges.erase(best);
+	if (remaining)
+		free_ranges[offset + size] = remaining;
+	used += size;
+	return (int)offset;
+}
+
+void OffsetAllocator::free(unsigned int offset, unsigned int size)
+{
+	if (!size)
+		return;
+	assert(offset + size <= capacity);
+	assert(used >= size);
+	used -= size;
+
+	auto next = free_ranges.lower_bound(offset);
+
+	//merge with the following range
+	if (next != free_ranges.end() && offset + size == next->first)
+	{
+		size += next->second;
+		next = free_ranges.erase(next);
+	}
+
+	//merge with the previous range
+	if (next != free_ranges.begin())
+	{
+		auto prev = std::prev(next);
+		assert(prev->first + prev->second <= offset && "range freed twice");
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+
+	free_ranges[offset] = size;
+}
+
+unsigned int OffsetAllocator::getLargestFreeRange()
+{
+	unsigned int largest = 0;
+	for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+		largest = std::max(largest, it->second);
+	return largest;
+}
+
+float OffsetAllocator::getFragmentation()
+{
+	unsigned int free_space = capacity - used;
+	if (!free_space)
+		return 0.0f;
+	return 1.0f - getLargestFreeRange() / (float)free_space;
+}
+
+// GPU ARENA *************************
+
+GPUArena* GPUArena::instance = NULL;
+
+GPUArena* GPUArena::getDefault()
+{
+	if (!instance)
+		instance = new GPUArena();
+	return instance;
+}
+
+GPUArena::GPUArena(unsigned int vertex_capacity, unsigned int index_capacity)
+{
+	vertices_vbo_id = indices_vbo_id = 0;
+	vertex_allocator.reset(0);
+	index_allocator.reset(0);
+	resize(vertex_capacity, index_capacity);
+}
+
+GPUArena::~GPUArena()
+{
+	for (size_t i = 0; i < meshes.size(); ++i)
+		meshes[i].mesh->arena = NULL;
+	clearVAOs();
+	if (vertices_vbo_id)
+		glDeleteBuffers(1, &vertices_vbo_id);
+	if (indices_vbo_id)
+		glDeleteBuffers(1, &indices_vbo_id);
+	if (instance == this)
+		instance = NULL;
+}
+
+void GPUArena::clearVAOs()
+{
+	for (auto it = vaos.begin(); it != vaos.end(); ++it)
+		glDeleteVertexArrays(1, &it->second);
+	vaos.clear();
+}
+
+//creates bigger buffers and copies the old content, meshes keep their offsets
+void GPUArena::resize(unsigned int vertex_capacity, unsigned int index_capacity)
+{
+	glBindVertexArray(0);
+
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * sizeof(Mesh::tInterleaved), NULL, GL_STATIC_DRAW);
+	if (vertices_vbo_id)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, vertices_vbo_id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertex_allocator.capacity * sizeof(Mesh::tInterleaved));
+		glDeleteBuffers(1, &vertices_vbo_id);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+	glBufferData(GL_COPY_WRITE_BUFFER, index_capacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+	if (indices_vbo_id)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, indices_vbo_id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, index_allocator.capacity * sizeof(unsigned int));
+		glDeleteBuffers(1, &indices_vbo_id);
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	vertices_vbo_id = buffers[0];
+	indices_vbo_id = buffers[1];
+	vertex_allocator.grow(vertex_capacity);
+	index_allocator.grow(index_capacity);
+
+	//VAOs point to the old buffers
+	clearVAOs();
+	checkGLErrors();
+}
+
+bool GPUArena::add(Mesh* mesh)
+{
+	assert(mesh && mesh->interleaved.size() && "only interleaved meshes can be stored in the arena");
+	assert(!mesh->arena && "mesh already in an arena");
+
+	unsigned int num_vertices = mesh->interleaved.size();
+	unsigned int num_indices = mesh->indices.size() * 3;
+
+	//find room, defragmenting first if there is enough space but scattered
+	int vertex_offset = vertex_allocator.allocate(num_vertices);
+	int index_offset = num_indices ? index_allocator.allocate(num_indices) : 0;
+	if (vertex_offset == -1 || index_offset == -1)
+	{
+		if (vertex_offset != -1)
+			vertex_allocator.free(vertex_offset, num_vertices);
+		if (index_offset != -1 && num_indices)
+			index_allocator.free(index_offset, num_indices);
+
+		bool fits = (vertex_allocator.capacity - vertex_allocator.used) >= num_vertices && (index_allocator.capacity - index_allocator.used) >= num_indices;
+		if (fits)
+			defragment();
+		else
+			resize(std::max(vertex_allocator.capacity * 2, vertex_allocator.used + num_vertices), std::max(index_allocator.capacity * 2, index_allocator.used + num_indices));
+
+		vertex_offset = vertex_allocator.allocate(num_vertices);
+		index_offset = num_indices ? index_allocator.allocate(num_indices) : 0;
+		assert(vertex_offset != -1 && index_offset != -1);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertices_vbo_id);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset * sizeof(Mesh::tInterleaved), num_vertices * sizeof(Mesh::tInterleaved), &mesh->interleaved[0]);
+	if (num_indices)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indices_vbo_id);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset * sizeof(unsigned int), num_indices * sizeof(unsigned int), &mesh->indices[0]);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	mesh->arena = this;
+	mesh->base_vertex = vertex_offset;
+	mesh->first_index = num_indices ? index_offset : -1;
+	sArenaMesh entry = { mesh, num_vertices, num_indices };
+	meshes.push_back(entry);
+
+	return checkGLErrors();
+}
+
+void GPUArena::remove(Mesh* mesh)
+{
+	assert(mesh->arena == this);
+
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		if (meshes[i].mesh != mesh)
+			continue;
+		vertex_allocator.free(mesh->base_vertex, meshes[i].num_vertices);
+		if (mesh->first_index != -1)
+			index_allocator.free(mesh->first_index, meshes[i].num_indices);
+		meshes.erase(meshes.begin() + i);
+		break;
+	}
+
+	mesh->arena = NULL;
+	mesh->base_vertex = mesh->first_index = -1;
+}
+
+static bool sortByBaseVertex(const GPUArena::sArenaMesh& a, const GPUArena::sArenaMesh& b) { return a.mesh->base_vertex < b.mesh->base_vertex; }
+
+//copies every mesh to new buffers one after another, indices are relative to the base vertex so they dont change
+void GPUArena::defragment()
+{
+	glBindVertexArray(0);
+
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_allocator.capacity * sizeof(Mesh::tInterleaved), NULL, GL_STATIC_DRAW);
+
+	std::sort(meshes.begin(), meshes.end(), sortByBaseVertex);
+
+	unsigned int vertex_offset = 0;
+	glBindBuffer(GL_COPY_READ_BUFFER, vertices_vbo_id);
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		Mesh* mesh = meshes[i].mesh;
+		unsigned int size = meshes[i].num_vertices * sizeof(Mesh::tInterleaved);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mesh->base_vertex * sizeof(Mesh::tInterleaved), vertex_offset * sizeof(Mesh::tInterleaved), size);
+		mesh->base_vertex = vertex_offset;
+		vertex_offset += meshes[i].num_vertices;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+	glBufferData(GL_COPY_WRITE_BUFFER, index_allocator.capacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+	unsigned int index_offset = 0;
+	glBindBuffer(GL_COPY_READ_BUFFER, indices_vbo_id);
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		Mesh* mesh = meshes[i].mesh;
+		if (mesh->first_index == -1)
+			continue;
+		unsigned int num_indices = meshes[i].num_indices;
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mesh->first_index * sizeof(unsigned int), index_offset * sizeof(unsigned int), num_indices * sizeof(unsigned int));
+		mesh->first_index = index_offset;
+		index_offset += num_indices;
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &vertices_vbo_id);
+	glDeleteBuffers(1, &indices_vbo_id);
+	vertices_vbo_id = buffers[0];
+	indices_vbo_id = buffers[1];
+
+	//all the used space is now at the beginning
+	vertex_allocator.reset(vertex_allocator.capacity);
+	vertex_allocator.allocate(vertex_offset);
+	index_allocator.reset(index_allocator.capacity);
+	index_allocator.allocate(index_offset);
+
+	clearVAOs();
+	checkGLErrors();
+}
+
+unsigned int GPUArena::bind(Shader* shader)
+{
+	GLuint& vao = vaos[shader->attrib_layout];
+	if (vao)
+	{
+		glBindVertexArray(vao);
+		return vao;
+	}
+
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo_id);
+
+	int stride = sizeof(Mesh::tInterleaved);
+	int vertex_location = shader->attrib_locations[Shader::ATTRIB_VERTEX];
+	int normal_location = shader->attrib_locations[Shader::ATTRIB_NORMAL];
+	int uv_location = shader->attrib_locations[Shader::ATTRIB_UV];
+	if (vertex_location != -1)
+	{
+		glEnableVertexAttribArray(vertex_location);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	}
+	if (normal_location != -1)
+	{
+		glEnableVertexAttribArray(normal_location);
+		glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, stride, (void*)sizeof(Vector3));
+	}
+	if (uv_location != -1)
+	{
+		glEnableVertexAttribArray(uv_location);
+		glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(Vector3) * 2));
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id); //stored in the VAO
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	assert(glGetError() == GL_NO_ERROR);
+	return vao;
+}
+
+std::string GPUArena::getStats()
+{
+	float vertex_mb = sizeof(Mesh::tInterleaved) / (1024.0f * 1024.0f);
+	float index_mb = sizeof(unsigned int) / (1024.0f * 1024.0f);
+	char str[256];
+	sprintf(str, "Arena: %d meshes  VB %.1f/%.1fMBs (frag %d%%)  IB %.1f/%.1fMBs (frag %d%%)", (int)meshes.size(),
+		vertex_allocator.used * vertex_mb, vertex_allocator.capacity * vertex_mb, int(vertex_allocator.getFragmentation() * 100),
+		index_allocator.used * index_mb, index_allocator.capacity * index_mb, int(index_allocator.getFragmentation() * 100));
+	return str;
+}
@@ -0,0 +1,72 @@
+/*  This allows to store the geometry of many meshes inside a few big GPU buffers.
+	Meshes only store where their vertices and indices start, so consecutive draws of different meshes don't need to rebind buffers.
+*/
+
+#ifndef GPUARENA_H
+#define GPUARENA_H
+
+#include "includes.h"
+#include <map>
+#include <vector>
+#include <string>
+
+class Mesh;
+class Shader;
+
+//Hands out ranges of a linear space (offsets and sizes in elements), freed ranges are merged with their neighbours
+class OffsetAllocator
+{
+public:
+	unsigned int capacity;
+	unsigned int used;
+	std::map<unsigned int, unsigned int> free_ranges; //offset -> size, sorted by offset
+
+	OffsetAllocator(unsigned int capacity = 0) { reset(capacity); }
+
+	void reset(unsigned int capacity);
+	void grow(unsigned int new_capacity); //adds the new space at the end
+	int allocate(unsigned int size); //returns the offset or -1 if there is no range big enough (best fit)
+	void free(unsigned int offset, unsigned int size);
+
+	unsigned int getLargestFreeRange();
+	float getFragmentation(); //0 when all the free space is contiguous, close to 1 when it is scattered in small ranges
+};
+
+//Big vertex and index buffers shared by the meshes uploaded to VRAM (only interleaved vertex,normal,uv meshes)
+class GPUArena
+{
+public:
+	static GPUArena* instance;
+	static GPUArena* getDefault();
+
+	GLuint vertices_vbo_id; //interleaved vertices (Mesh::tInterleaved)
+	GLuint indices_vbo_id; //unsigned ints, relative to the base vertex of every mesh
+
+	OffsetAllocator vertex_allocator; //in vertices
+	OffsetAllocator index_allocator; //in indices
+
+	struct sArenaMesh {
+		Mesh* mesh;
+		unsigned int num_vertices;
+		unsigned int num_indices;
+	};
+	std::vector<sArenaMesh> meshes; //meshes stored, to update them when defragmenting
+	std::map<unsigned int, unsigned int> vaos; //one VAO per shader attribute layout, shared by all the meshes
+
+	GPUArena(unsigned int vertex_capacity = 1 << 18, unsigned int index_capacity = 1 << 20);
+	~GPUArena();
+
+	bool add(Mesh* mesh); //uploads the mesh and sets its base_vertex and first_index
+	void remove(Mesh* mesh);
+	void defragment(); //packs all the meshes at the beginning of the buffers
+
+	unsigned int bind(Shader* shader); //binds the VAO for this shader, returns its id
+
+	std::string getStats();
+
+private:
+	void resize(unsigned int vertex_capacity, unsigned int index_capacity);
+	void clearVAOs();
+};
+
+#endif
@@ -0,0 +1,354 @@
+#include "imagekernels.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define IMAGE_USE_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined(IMAGE_USE_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+	#define IMAGE_USE_SSSE3
+	#include <tmmintrin.h>
+#endif
+#if defined(IMAGE_USE_SSE2) && defined(__AVX2__)
+	#define IMAGE_USE_AVX2
+	#include <immintrin.h>
+#endif
+
+namespace {
+
+//texel indices and weight along one axis, the same math the SSE version does for 4 coordinates
+inline void setupAxis(float v, int size, float inv_size, bool repeat, int& i0, int& i1, float& f)
+{
+	if (repeat)
+		v -= floorf(v * inv_size) * size;
+	else
+		v = std::min(std::max(v, 0.0f), (float)(size - 1));
+	float fl = floorf(v);
+	f = v - fl;
+	if (fl >= size)
+		fl = 0.0f; //rounding of the wrap
+	i0 = (int)fl;
+	i1 = i0 + 1;
+	if (i1 >= size)
+		i1 = repeat ? 0 : size - 1;
+}
+
+#ifdef IMAGE_USE_SSE2
+inline __m128 floor4(__m128 v)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+}
+
+void setupAxis4(__m128 v, int size, float inv_size, bool repeat, int* i0, int* i1, float* f)
+{
+	__m128 fsize = _mm_set1_ps((float)size);
+	__m128 last = _mm_set1_ps((float)(size - 1));
+	if (repeat)
+		v = _mm_sub_ps(v, _mm_mul_ps(floor4(_mm_mul_ps(v, _mm_set1_ps(inv_size))), fsize));
+	else
+		v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), last);
+	__m128 fl = floor4(v);
+	_mm_storeu_ps(f, _mm_sub_ps(v, fl));
+	fl = _mm_andnot_ps(_mm_cmpge_ps(fl, fsize), fl);
+	__m128 next = _mm_add_ps(fl, _mm_set1_ps(1.0f));
+	if (repeat)
+		next = _mm_andnot_ps(_mm_cmpge_ps(next, fsize), next);
+	else
+		next = _mm_min_ps(next, last);
+	_mm_storeu_si128((__m128i*)i0, _mm_cvttps_epi32(fl));
+	_mm_storeu_si128((__m128i*)i1, _mm_cvttps_epi32(next));
+}
+
+//4 floats in [0,255] from a texel of 1 to 4 channels
+inline __m128 loadTexel(const unsigned char* p, int channels)
+{
+	unsigned int v = channels < 4 ? 0xFF000000 : 0;
+	memcpy(&v, p, channels);
+	__m128i zero = _mm_setzero_si128();
+	__m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero));
+}
+#endif
+
+inline unsigned char toUnorm(float v)
+{
+	v = v * 255.0f + 0.5f;
+	return (unsigned char)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+}
+
+} //namespace
+
+void sampleBilinear(const unsigned char* data, int width, int height, int channels, const float* coords, int count, float* result, bool repeat)
+{
+	float inv_width = 1.0f / width, inv_height = 1.0f / height;
+	size_t row_size = (size_t)width * channels;
+	int i = 0;
+#ifdef IMAGE_USE_SSE2
+	//the coordinates of 4 samples at once, then every sample interpolates its 4 channels together
+	__m128 inv_255 = _mm_set1_ps(1.0f / 255.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(coords + i * 2);
+		__m128 b = _mm_loadu_ps(coords + i * 2 + 4);
+		int x0[4], x1[4], y0[4], y1[4];
+		float fx[4], fy[4];
+		setupAxis4(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), width, inv_width, repeat, x0, x1, fx);
+		setupAxis4(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), height, inv_height, repeat, y0, y1, fy);
+		for (int j = 0; j < 4; ++j)
+		{
+			const unsigned char* row0 = data + y0[j] * row_size;
+			const unsigned char* row1 = data + y1[j] * row_size;
+			__m128 wx = _mm_set1_ps(fx[j]);
+			__m128 t00 = loadTexel(row0 + x0[j] * channels, channels);
+			__m128 t01 = loadTexel(row1 + x0[j] * channels, channels);
+			__m128 top = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(loadTexel(row0 + x1[j] * channels, channels), t00), wx));
+			__m128 bottom = _mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(loadTexel(row1 + x1[j] * channels, channels), t01), wx));
+			__m128 v = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(fy[j])));
+			_mm_storeu_ps(result + (i + j) * 4, _mm_mul_ps(v, inv_255));
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		int x0, x1, y0, y1;
+		float fx, fy;
+		setupAxis(coords[i * 2], width, inv_width, repeat, x0, x1, fx);
+		setupAxis(coords[i * 2 + 1], height, inv_height, repeat, y0, y1, fy);
+		const unsigned char* row0 = data + y0 * row_size;
+		const unsigned char* row1 = data + y1 * row_size;
+		float* r = result + i * 4;
+		for (int c = 0; c < 4; ++c)
+		{
+			if (c >= channels)
+			{
+				r[c] = c == 3 ? 1.0f : 0.0f;
+				continue;
+			}
+			float t00 = row0[x0 * channels + c], t01 = row1[x0 * channels + c];
+			float top = t00 + (row0[x1 * channels + c] - t00) * fx;
+			float bottom = t01 + (row1[x1 * channels + c] - t01) * fx;
+			r[c] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+		}
+	}
+}
+
+void flipRows(unsigned char* data, size_t row_size, int height)
+{
+	for (int y = 0; y < height / 2; ++y)
+	{
+		unsigned char* a = data + y * row_size;
+		unsigned char* b = data + (height - y - 1) * row_size;
+		size_t i = 0;
+#ifdef IMAGE_USE_AVX2
+		for (; i + 32 <= row_size; i += 32)
+		{
+			__m256i va = _mm256_loadu_si256((__m256i*)(a + i));
+			_mm256_storeu_si256((__m256i*)(a + i), _mm256_loadu_si256((__m256i*)(b + i)));
+			_mm256_storeu_si256((__m256i*)(b + i), va);
+		}
+#endif
+#ifdef IMAGE_USE_SSE2
+		for (; i + 16 <= row_size; i += 16)
+		{
+			__m128i va = _mm_loadu_si128((__m128i*)(a + i));
+			_mm_storeu_si128((__m128i*)(a + i), _mm_loadu_si128((__m128i*)(b + i)));
+			_mm_storeu_si128((__m128i*)(b + i), va);
+		}
+#endif
+		for (; i < row_size; ++i)
+			std::swap(a[i], b[i]);
+	}
+}
+
+void convertRGBToRGBA(const unsigned char* src, unsigned char* dst, size_t num_pixels, unsigned char alpha)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSSE3
+	//reads 16 bytes for 4 pixels, so the last ones go through the scalar loop
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i alpha_mask = _mm_set1_epi32((int)((unsigned int)alpha << 24));
+	for (; i + 6 <= num_pixels; i += 4)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 3)), shuffle);
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(v, alpha_mask));
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		dst[i * 4] = src[i * 3];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = alpha;
+	}
+}
+
+void convertRGBAToRGB(const unsigned char* src, unsigned char* dst, size_t num_pixels)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSSE3
+	//writes 16 bytes for 4 pixels, the extra 4 are overwritten by the next ones
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	for (; i + 6 <= num_pixels; i += 4)
+		_mm_storeu_si128((__m128i*)(dst + i * 3), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 4)), shuffle));
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		dst[i * 3] = src[i * 4];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+void unormToFloat(const unsigned char* src, float* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_AVX2
+	__m256 scale8 = _mm256_set1_ps(1.0f / 255.0f);
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)))), scale8));
+#endif
+#ifdef IMAGE_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128 scale = _mm_set1_ps(1.0f / 255.0f);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = src[i] * (1.0f / 255.0f);
+}
+
+void floatToUnorm(const float* src, unsigned char* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSE2
+	__m128 scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+	__m128i v[4];
+	for (; i + 16 <= count; i += 16)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			__m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + j * 4), scale), half);
+			v[j] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(f, zero), scale)); //max first so NaN gives 0
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = toUnorm(src[i]);
+}
+
+namespace {
+
+inline unsigned int asUint(float f) { unsigned int u; memcpy(&u, &f, 4); return u; }
+inline float asFloat(unsigned int u) { float f; memcpy(&f, &u, 4); return f; }
+
+//the bits of a positive float to a float with a 5 bit exponent and mbits of mantissa (no sign), rounded to nearest even
+inline unsigned int toSmallFloat(unsigned int x, int mbits)
+{
+	int shift = 23 - mbits;
+	if (x >= 0x47800000u) //inf or NaN
+		return (0x1fu << mbits) | (x > 0x7f800000u ? 1u << (mbits - 1) : 0u);
+	if (x < 0x38800000u) //denormal or zero, the float addition aligns the mantissa bits and rounds them
+	{
+		unsigned int magic = (unsigned int)(127 - 15 + shift + 1) << 23;
+		return asUint(asFloat(x) + asFloat(magic)) - magic;
+	}
+	unsigned int mant_odd = (x >> shift) & 1u;
+	x = x - (112u << 23) + (1u << (shift - 1)) - 1u + mant_odd; //rebias the exponent
+	return x >> shift;
+}
+
+#ifdef IMAGE_USE_SSE2
+inline __m128i select4(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+//the same for 4 values
+inline __m128i toSmallFloat4(__m128i x, int mbits)
+{
+	int shift = 23 - mbits;
+	__m128i shift_count = _mm_cvtsi32_si128(shift);
+	__m128i magic = _mm_set1_epi32((127 - 15 + shift + 1) << 23);
+	__m128i is_big = _mm_cmpgt_epi32(x, _mm_set1_epi32(0x47800000 - 1));
+	__m128i is_nan = _mm_cmpgt_epi32(x, _mm_set1_epi32(0x7f800000));
+	__m128i is_small = _mm_cmplt_epi32(x, _mm_set1_epi32(0x38800000));
+
+	__m128i big = _mm_or_si128(_mm_set1_epi32(0x1f << mbits), _mm_and_si128(is_nan, _mm_set1_epi32(1 << (mbits - 1))));
+	__m128i small = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(magic))), magic);
+	__m128i mant_odd = _mm_and_si128(_mm_srl_epi32(x, shift_count), _mm_set1_epi32(1));
+	__m128i normal = _mm_add_epi32(x, _mm_set1_epi32(-(112 << 23) + (1 << (shift - 1)) - 1));
+	normal = _mm_srl_epi32(_mm_add_epi32(normal, mant_odd), shift_count);
+	return select4(is_big, big, select4(is_small, small, normal));
+}
+#endif
+
+}
+
+void floatToHalf(const float* src, unsigned short* dst, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSE2
+	__m128i sign_mask = _mm_set1_epi32((int)0x80000000u);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i v[2];
+		for (int j = 0; j < 2; ++j)
+		{
+			__m128i x = _mm_castps_si128(_mm_loadu_ps(src + i + j * 4));
+			__m128i sign = _mm_srli_epi32(_mm_and_si128(x, sign_mask), 16);
+			__m128i h = _mm_or_si128(toSmallFloat4(_mm_andnot_si128(sign_mask, x), 10), sign);
+			v[j] = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16); //sign extended so the saturation keeps the 16 bits
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(v[0], v[1]));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		unsigned int x = asUint(src[i]);
+		dst[i] = (unsigned short)(toSmallFloat(x & 0x7fffffffu, 10) | ((x >> 16) & 0x8000u));
+	}
+}
+
+void floatToR11G11B10F(const float* src, int channels, unsigned int* dst, size_t num_pixels)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 4 <= num_pixels; i += 4)
+	{
+		const float* p = src + i * channels;
+		__m128i packed = zero;
+		for (int c = 0; c < 3; ++c)
+		{
+			__m128i x = _mm_castps_si128(_mm_setr_ps(p[c], p[channels + c], p[channels * 2 + c], p[channels * 3 + c]));
+			x = _mm_andnot_si128(_mm_cmplt_epi32(x, zero), x); //negative (sign bit set) to 0
+			packed = _mm_or_si128(packed, _mm_slli_epi32(toSmallFloat4(x, c == 2 ? 5 : 6), c * 11));
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), packed);
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		const float* p = src + i * channels;
+		unsigned int packed = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			unsigned int x = asUint(p[c]);
+			packed |= toSmallFloat(x & 0x80000000u ? 0u : x, c == 2 ? 5 : 6) << (c * 11);
+		}
+		dst[i] = packed;
+	}
+}
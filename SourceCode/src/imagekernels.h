@@ -0,0 +1,31 @@
+/*  Image kernels: batch operations over 8 bit pixel buffers (1 to 4 channels, rows packed) used by Image, the mesh displacement
+	and the texture bakers, and the conversions of float (HDR) data to the smaller formats of the GPU. They work on whole arrays of pixels or coordinates so the inner loops use SSE2 (SSSE3 and AVX2 when the
+	compiler enables them), with a scalar version for other targets that gives the same results.
+*/
+
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <cstddef>
+
+//coords are (x,y) pairs in pixels, with the texel centers at the integer positions like Image::getPixelInterpolated.
+//result gets 4 floats in [0,1] per sample (missing channels are 0 and alpha 1). repeat wraps the coordinates, if not they are clamped
+void sampleBilinear(const unsigned char* data, int width, int height, int channels, const float* coords, int count, float* result, bool repeat = false);
+
+//swaps the rows in place
+void flipRows(unsigned char* data, size_t row_size, int height);
+
+//src and dst must not overlap, except for RGBA to RGB that can be done in place (dst == src)
+void convertRGBToRGBA(const unsigned char* src, unsigned char* dst, size_t num_pixels, unsigned char alpha = 255);
+void convertRGBAToRGB(const unsigned char* src, unsigned char* dst, size_t num_pixels);
+
+//every value (not pixel) from [0,255] to [0,1] and back, rounded and clamped
+void unormToFloat(const unsigned char* src, float* dst, size_t count);
+void floatToUnorm(const float* src, unsigned char* dst, size_t count);
+
+//floats to GL_HALF_FLOAT values, rounded to nearest even like the GPU (too big ones are infinite)
+void floatToHalf(const float* src, unsigned short* dst, size_t count);
+//the first 3 of every channels floats to GL_UNSIGNED_INT_10F_11F_11F_REV, negative values are 0
+void floatToR11G11B10F(const float* src, int channels, unsigned int* dst, size_t num_pixels);
+
+#endif
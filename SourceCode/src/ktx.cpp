@@ -0,0 +1,163 @@
+#include "ktx.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const unsigned char ktx_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const unsigned int ktx_endianness = 0x04030201;
+
+//after the identifier, all the fields are 32 bits
+struct sKTXHeader {
+	unsigned int endianness;
+	unsigned int gl_type;
+	unsigned int gl_type_size;
+	unsigned int gl_format;
+	unsigned int gl_internal_format;
+	unsigned int gl_base_internal_format;
+	unsigned int pixel_width;
+	unsigned int pixel_height;
+	unsigned int pixel_depth;
+	unsigned int num_array_elements;
+	unsigned int num_faces;
+	unsigned int num_mipmap_levels;
+	unsigned int bytes_of_key_value_data;
+};
+
+KTX::KTX()
+{
+	gl_type = gl_format = gl_internal_format = gl_base_internal_format = 0;
+	width = height = 0;
+	num_faces = 1;
+}
+
+bool KTX::load(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	unsigned char identifier[12];
+	sKTXHeader header;
+	if (fread(identifier, 1, 12, file) != 12 || memcmp(identifier, ktx_identifier, 12) != 0 ||
+		fread(&header, sizeof(header), 1, file) != 1 || header.endianness != ktx_endianness ||
+		header.pixel_depth > 1 || header.num_array_elements > 0 || (header.num_faces != 1 && header.num_faces != 6))
+	{
+		fclose(file);
+		return false;
+	}
+
+	//every pair is its size, the key and the value (both null terminated) and padding to 4 bytes
+	metadata.clear();
+	std::vector<char> key_values(header.bytes_of_key_value_data + 1, 0);
+	if (header.bytes_of_key_value_data && fread(&key_values[0], 1, header.bytes_of_key_value_data, file) != header.bytes_of_key_value_data)
+	{
+		fclose(file);
+		return false;
+	}
+	for (unsigned int pos = 0; pos + 4 <= header.bytes_of_key_value_data;)
+	{
+		unsigned int size;
+		memcpy(&size, &key_values[pos], 4);
+		pos += 4;
+		if (size > header.bytes_of_key_value_data - pos)
+			break;
+		std::string key = &key_values[pos];
+		if (key.size() < size)
+			metadata[key] = std::string(&key_values[pos + key.size() + 1], size - key.size() - 1).c_str();
+		pos += (size + 3) & ~3;
+	}
+
+	gl_type = header.gl_type;
+	gl_format = header.gl_format;
+	gl_internal_format = header.gl_internal_format;
+	gl_base_internal_format = header.gl_base_internal_format;
+	width = header.pixel_width;
+	height = header.pixel_height;
+	num_faces = header.num_faces;
+	levels.resize(header.num_mipmap_levels ? header.num_mipmap_levels : 1);
+
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		sLevel& level = levels[i];
+		level.width = width >> i ? width >> i : 1;
+		level.height = height >> i ? height >> i : 1;
+
+		//cubemaps store the size of one face, every face is padded to 4 bytes
+		unsigned int image_size = 0;
+		if (fread(&image_size, 4, 1, file) != 1)
+		{
+			fclose(file);
+			return false;
+		}
+		unsigned int face_size = num_faces == 6 ? image_size : image_size / num_faces;
+		unsigned int padding = (4 - (face_size & 3)) & 3;
+		level.data.resize(face_size * num_faces);
+		for (unsigned int f = 0; f < num_faces; ++f)
+		{
+			if (fread(&level.data[f * face_size], 1, face_size, file) != face_size)
+			{
+				fclose(file);
+				return false;
+			}
+			fseek(file, padding, SEEK_CUR);
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool KTX::save(const char* filename) const
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	sKTXHeader header;
+	memset(&header, 0, sizeof(header));
+	header.endianness = ktx_endianness;
+	header.gl_type = gl_type;
+	header.gl_type_size = 1;
+	header.gl_format = gl_format;
+	header.gl_internal_format = gl_internal_format;
+	header.gl_base_internal_format = gl_base_internal_format;
+	header.pixel_width = width;
+	header.pixel_height = height;
+	header.num_faces = num_faces;
+	header.num_mipmap_levels = (unsigned int)levels.size();
+
+	std::vector<char> key_values;
+	for (auto it = metadata.begin(); it != metadata.end(); ++it)
+	{
+		unsigned int size = (unsigned int)(it->first.size() + it->second.size() + 2);
+		size_t pos = key_values.size();
+		key_values.resize(pos + 4 + ((size + 3) & ~3), 0);
+		memcpy(&key_values[pos], &size, 4);
+		memcpy(&key_values[pos + 4], it->first.c_str(), it->first.size() + 1);
+		memcpy(&key_values[pos + 4 + it->first.size() + 1], it->second.c_str(), it->second.size() + 1);
+	}
+	header.bytes_of_key_value_data = (unsigned int)key_values.size();
+
+	fwrite(ktx_identifier, 1, 12, file);
+	fwrite(&header, sizeof(header), 1, file);
+	if (key_values.size())
+		fwrite(&key_values[0], 1, key_values.size(), file);
+
+	const unsigned char zeros[4] = { 0, 0, 0, 0 };
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		unsigned int face_size = getFaceSize((int)i);
+		unsigned int image_size = num_faces == 6 ? face_size : face_size * num_faces;
+		unsigned int padding = (4 - (face_size & 3)) & 3;
+		fwrite(&image_size, 4, 1, file);
+		for (unsigned int f = 0; f < num_faces; ++f)
+		{
+			fwrite(getFace((int)i, f), 1, face_size, file);
+			fwrite(zeros, 1, padding, file);
+		}
+	}
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
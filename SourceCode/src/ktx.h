@@ -0,0 +1,42 @@
+/*  KTX (version 1) container: a texture with all its mip levels already in the GL format,
+	so it can be uploaded level by level without converting anything (glCompressedTexImage2D or glTexImage2D).
+	Only 2D textures and cubemaps, no arrays. It doesnt use GL so it can be read and written from any thread.
+*/
+
+#ifndef KTX_H
+#define KTX_H
+
+#include <vector>
+#include <map>
+#include <string>
+
+class KTX
+{
+public:
+	struct sLevel {
+		unsigned int width;
+		unsigned int height;
+		std::vector<unsigned char> data; //all the faces one after another
+	};
+
+	unsigned int gl_type; //0 when compressed
+	unsigned int gl_format; //0 when compressed
+	unsigned int gl_internal_format;
+	unsigned int gl_base_internal_format; //GL_RED, GL_RG, GL_RGB, GL_RGBA
+	unsigned int width;
+	unsigned int height;
+	unsigned int num_faces; //1 or 6 for cubemaps
+	std::vector<sLevel> levels;
+	std::map<std::string, std::string> metadata; //key/value data, ex: how it was baked
+
+	KTX();
+
+	bool isCompressed() const { return gl_type == 0; }
+	unsigned int getFaceSize(int level) const { return (unsigned int)levels[level].data.size() / num_faces; }
+	const unsigned char* getFace(int level, int face) const { return &levels[level].data[0] + face * getFaceSize(level); }
+
+	bool load(const char* filename);
+	bool save(const char* filename) const;
+};
+
+#endif
@@ -15,6 +15,9 @@
 #include "utils.h"
 #include "input.h"
 #include "application.h"
+#include "texturestreamer.h"
+#include "environment.h"
+#include "reflectionprobe.h"
 
 #include <iostream> //to output
 
@@ -37,6 +40,7 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16); //or 24
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1); //the shaders output linear colors
 
 	//SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	//SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
@@ -103,12 +107,28 @@ void renderDebug(SDL_Window* window, Application * game)
 		ImGui::Text(getGPUStats().c_str());					   // Display some text (you can use a format strings too)
 		
 		ImGui::Checkbox("Render Wireframe", &Application::instance->render_wireframe);
+		ImGui::Checkbox("Multidraw", &Application::instance->use_multidraw);
 
 		if (ImGui::TreeNode("Camera")) {
 			game->camera->renderInMenu();
 			ImGui::TreePop();
 		}
 
+		if (ImGui::TreeNode("Texture Streaming")) {
+			TextureStreamer::getDefault()->renderInMenu();
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Environment")) {
+			Environment::renderMenu();
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Reflection Probes")) {
+			ReflectionProbe::renderMenu();
+			ImGui::TreePop();
+		}
+
 
 		//Scene graph
 		if (ImGui::TreeNode("Lights"))
@@ -1,7 +1,10 @@
 #include "material.h"
 #include "texture.h"
 #include "application.h"
-#include "extra/hdre.h"
+#include "texturestreamer.h"
+#include "materialatlas.h"
+#include "reflectionprobe.h"
+#include <cstring>
 
 StandardMaterial::StandardMaterial()
 {
@@ -14,8 +17,11 @@ StandardMaterial::~StandardMaterial()
 
 }
 
-void StandardMaterial::setUniforms(Camera* camera, Matrix44 model)
+void StandardMaterial::setUniforms(Camera* camera, Matrix44 model, Shader* shader)
 {
+	if (!shader)
+		shader = this->shader;
+
 	//upload node uniforms
 	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
 	shader->setUniform("u_camera_position", camera->eye);
@@ -85,6 +91,7 @@ ReflectiveMaterial::ReflectiveMaterial()
 {
 	color = vec4(1.f, 1.f, 1.f, 1.f);
 	shader = Shader::Get("data/shaders/basic.vs", "data/shaders/reflective.fs");
+	linear_output = true; //reads the HDR environment
 }
 
 ReflectiveMaterial::~ReflectiveMaterial()
@@ -92,6 +99,21 @@ ReflectiveMaterial::~ReflectiveMaterial()
 
 }
 
+void ReflectiveMaterial::setUniforms(Camera* camera, Matrix44 model, Shader* shader)
+{
+	if (!shader)
+		shader = this->shader;
+
+	StandardMaterial::setUniforms(camera, model, shader);
+
+	//the probe with more weight reflects the scene around, if not the cubemap of the material
+	if (ReflectionProbe::rendering)
+		return;
+	sProbeBlend blend = ReflectionProbe::getBlend(model.getTranslation());
+	if (blend.probes[0])
+		shader->setUniform("u_texture", blend.probes[0]->cubemap);
+}
+
 void ReflectiveMaterial::renderInMenu()
 {
 	ImGui::ColorEdit3("Color", (float*)&color); // Edit 3 floats representing a color
@@ -108,8 +130,11 @@ PhongMaterial::~PhongMaterial()
 
 }
 
-void PhongMaterial::setUniforms(Camera* camera, Matrix44 model)
+void PhongMaterial::setUniforms(Camera* camera, Matrix44 model, Shader* shader)
 {
+	if (!shader)
+		shader = this->shader;
+
 	//upload node uniforms
 	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
 	shader->setUniform("u_camera_position", camera->eye);
@@ -151,61 +176,92 @@ void PhongMaterial::renderInMenu()
 
 }
 
-PBRMaterial::PBRMaterial(HDRE* environment)
+PBRMaterial::PBRMaterial(Environment* environment)
 {
 	color = vec4(1.f, 1.f, 1.f, 1.f);
 	shader = Shader::Get("data/shaders/basic.vs", "data/shaders/skeleton_pbr.fs");
+	linear_output = true;
 
 	roughness = 0.29;
 	emission_factor = 0.1;
 	metallic_factor = 0.1;
 	occlusion_factor = 1;
 
+	this->environment = environment;
 	albedo_map = NULL;
 	rough_map = NULL;
 	metal_map = NULL;
 	normal_map = NULL;
 	emission_map = NULL;
 	occlusion_map = NULL;
-
-	sHDRELevel level = environment->getLevel(0);
-	Texture* cubemapTex = new Texture();
-	cubemapTex->createCubemap(level.width, level.height, (uint8**)level.faces);
-	prem_levels.push_back(cubemapTex);
-
-	sHDRELevel level1 = environment->getLevel(1);
-	Texture* cubemapTex1 = new Texture();
-	cubemapTex1->createCubemap(level1.width, level1.height, (uint8**)level1.faces);
-	prem_levels.push_back(cubemapTex1);
-
-	sHDRELevel level2 = environment->getLevel(2);
-	Texture* cubemapTex2 = new Texture();
-	cubemapTex2->createCubemap(level2.width, level2.height, (uint8**)level2.faces);
-	prem_levels.push_back(cubemapTex2);
-
-	sHDRELevel level3 = environment->getLevel(3);
-	Texture* cubemapTex3 = new Texture();
-	cubemapTex3->createCubemap(level3.width, level3.height, (uint8**)level3.faces);
-	prem_levels.push_back(cubemapTex3);
-
-	sHDRELevel level4 = environment->getLevel(4);
-	Texture* cubemapTex4 = new Texture();
-	cubemapTex4->createCubemap(level4.width, level4.height, (uint8**)level4.faces);
-	prem_levels.push_back(cubemapTex4);
-
-	sHDRELevel level5 = environment->getLevel(5);
-	Texture* cubemapTex5 = new Texture();
-	cubemapTex5->createCubemap(level5.width, level5.height, (uint8**)level5.faces);
-	prem_levels.push_back(cubemapTex5);
+	opacity_map = NULL;
+	heigh_map = NULL;
+	cone_map = NULL;
+	relief_depth = 0.05f;
+	orm_map = NULL;
+	ohe_map = NULL;
+	atlas = NULL;
+	atlas_layer = -1;
 }
 
 PBRMaterial::~PBRMaterial()
 {
-	
+	//they stay in the manager until the budget needs the memory
+	Texture* maps[] = { albedo_map, normal_map, rough_map, metal_map, opacity_map, emission_map, occlusion_map, heigh_map, orm_map, ohe_map, cone_map };
+	for (int i = 0; i < 11; ++i)
+		Texture::Release(maps[i]);
+}
+
+void PBRMaterial::setPackedMaps(Texture* orm_map, Texture* ohe_map)
+{
+	this->orm_map = orm_map;
+	this->ohe_map = ohe_map;
+	if (orm_map && ohe_map)
+		shader = Shader::Get("data/shaders/basic.vs", "data/shaders/skeleton_pbr.fs", "#define USE_PACKED_MAPS\n");
+	else
+		shader = Shader::Get("data/shaders/basic.vs", "data/shaders/skeleton_pbr.fs");
+}
+
+bool PBRMaterial::setAtlas(MaterialAtlas* atlas)
+{
+	int layer = atlas->add(this);
+	if (layer == -1)
+		return false;
+	this->atlas = atlas;
+	atlas_layer = layer;
+	shader = Shader::Get("data/shaders/basic.vs", "data/shaders/skeleton_pbr.fs", "#define USE_PACKED_MAPS\n#define USE_MATERIAL_ATLAS\n");
+	return true;
+}
+
+Material* PBRMaterial::getBatchMaterial()
+{
+	//the group is drawn with the uniforms of the first material of the atlas that has the same ones (only the draw params change per draw)
+	if (atlas)
+		for (size_t i = 0; i < atlas->materials.size(); ++i)
+			if (atlas->materials[i] == this || hasSameUniforms(atlas->materials[i]))
+				return atlas->materials[i];
+	return this;
+}
+
+bool PBRMaterial::hasSameUniforms(PBRMaterial* other)
+{
+	if (other->getEnvironment() != getEnvironment() || other->color.x != color.x || other->color.y != color.y || other->color.z != color.z || other->color.w != color.w)
+		return false;
+	if (other->emission_factor != emission_factor || other->occlusion_factor != occlusion_factor || other->relief_depth != relief_depth || other->cone_map != cone_map)
+		return false;
+	return memcmp(other->use_properties, use_properties, sizeof(use_properties)) == 0;
 }
 
-void PBRMaterial::setUniforms(Camera* camera, Matrix44 model)
+Vector4 PBRMaterial::getDrawParams()
 {
+	return Vector4(0.0f, (float)atlas_layer, roughness, metallic_factor);
+}
+
+void PBRMaterial::setUniforms(Camera* camera, Matrix44 model, Shader* shader)
+{
+	if (!shader)
+		shader = this->shader;
+
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -219,44 +275,64 @@ void PBRMaterial::setUniforms(Camera* camera, Matrix44 model)
 	//color
 	shader->setUniform("u_color", color);
 
-	//HDRE levels
-	shader->setUniform("u_texture", prem_levels[0],0);
-	shader->setUniform("u_texture_prem_0", prem_levels[1],1);
-	shader->setUniform("u_texture_prem_1", prem_levels[2],2);
-	shader->setUniform("u_texture_prem_2", prem_levels[3],3);
-	shader->setUniform("u_texture_prem_3", prem_levels[4],4);
-	shader->setUniform("u_texture_prem_4", prem_levels[5],5);
-
-	//BRDF LUT
-	shader->setUniform("u_brdf_lut", brdfLUT, 6);
+	//prefiltered HDRE and BRDF LUT (slots 0 and 1)
+	Environment* environment = getEnvironment();
+	if (environment)
+		environment->bind(shader, 0);
 
-	//albedo map
-	shader->setUniform("u_albedo_map", albedo_map, 7);
+	//the nearest reflection probes (slots 2 and 3)
+	ReflectionProbe::bind(shader, model.getTranslation(), 2);
 
 	//roughness & roughness map	
 	shader->setUniform("u_roughness", roughness);
-	shader->setUniform("u_roughness_map", rough_map, 8);
 
 	//metallic & metallic map
 	shader->setUniform("u_metallic_fact", metallic_factor);
-	shader->setUniform("u_metal_map",metal_map, 9);
 
-	//normal map
-	shader->setUniform("u_normal_map",normal_map, 10);
-
-	//opacity map
-	shader->setUniform("u_opacity_map", opacity_map, 11);
-
-	//emission & emission map
+	//emission & occlusion factors
 	shader->setUniform("u_emission_fact", emission_factor);
-	shader->setUniform("u_emission_map", emission_map, 12);
-
-	//occlusion map
 	shader->setUniform("u_occlusion_factor", occlusion_factor);
-	shader->setUniform("u_occlusion_map", occlusion_map, 13);
 
-	//heigh map
-	shader->setUniform("u_heigh_map", heigh_map, 14);
+	//relief mapping (slot 4), the heigh comes from its map, the packed ones or the atlas
+	if (cone_map)
+		shader->setUniform("u_cone_map", cone_map, 4);
+	shader->setUniform("u_relief_depth", relief_depth);
+
+	//the arrays of the atlas use the same slots, the layer and factors come with the draw
+	if (atlas)
+	{
+		shader->setUniform("u_albedo_atlas", atlas->arrays[ATLAS_ALBEDO], 7);
+		shader->setUniform("u_orm_atlas", atlas->arrays[ATLAS_ORM], 8);
+		shader->setUniform("u_ohe_atlas", atlas->arrays[ATLAS_OHE], 9);
+		shader->setUniform("u_normal_atlas", atlas->arrays[ATLAS_NORMAL], 10);
+		shader->setUniform("u_normal_map_xy", atlas->arrays[ATLAS_NORMAL]->format == GL_RG);
+		shader->setUniform("u_draw_params", getDrawParams());
+	}
+	else
+	{
+		//albedo map
+		shader->setUniform("u_albedo_map", albedo_map, 7);
+
+		//normal map
+		shader->setUniform("u_normal_map", normal_map, 10);
+		shader->setUniform("u_normal_map_xy", normal_map && normal_map->format == GL_RG);
+
+		//single channel maps, or the two textures with all of them packed
+		if (orm_map && ohe_map)
+		{
+			shader->setUniform("u_orm_map", orm_map, 8);
+			shader->setUniform("u_ohe_map", ohe_map, 9);
+		}
+		else
+		{
+			shader->setUniform("u_roughness_map", rough_map, 8);
+			shader->setUniform("u_metal_map", metal_map, 9);
+			shader->setUniform("u_opacity_map", opacity_map, 11);
+			shader->setUniform("u_emission_map", emission_map, 12);
+			shader->setUniform("u_occlusion_map", occlusion_map, 13);
+			shader->setUniform("u_heigh_map", heigh_map, 14);
+		}
+	}
 
 	//send lights to shader
 	shader->setUniform("u_lights_position_1", Application::instance->lights[0]->position);
@@ -272,12 +348,29 @@ void PBRMaterial::setUniforms(Camera* camera, Matrix44 model)
 	shader->setUniform("u_use_opacity_map", use_properties[OPACITY_MAP]);
 	shader->setUniform("u_use_emission_map", use_properties[EMISSION_MAP]);
 	shader->setUniform("u_use_occlusion_map", use_properties[OCCLUSION_MAP]);
-	shader->setUniform("u_use_heigh_map", use_properties[HEIGH_MAP]);
+	shader->setUniform("u_use_heigh_map", use_properties[HEIGH_MAP] && cone_map != NULL);
 
 	//if (texture)
 	//	shader->setUniform("u_texture", texture);
 }
 
+void PBRMaterial::requestTextures(Mesh* mesh, Matrix44 model, Camera* camera)
+{
+	//the maps are repeated 3 times in the shader
+	TextureStreamer* streamer = TextureStreamer::getDefault();
+
+	//the arrays of the atlas stream their levels for all the layers, its own maps are not used
+	if (atlas)
+	{
+		atlas->request(streamer->getLevel(atlas->size, mesh, model, camera, 3.0f));
+		return;
+	}
+
+	Texture* maps[] = { albedo_map, normal_map, rough_map, metal_map, opacity_map, emission_map, occlusion_map, heigh_map, orm_map, ohe_map };
+	for (int i = 0; i < 10; ++i)
+		streamer->request(maps[i], mesh, model, camera, 3.0f);
+}
+
 void PBRMaterial::renderInMenu()
 {
 	ImGui::Checkbox("Punctual Light", &use_properties[PUNCTUAL_LIGHT]);
@@ -297,4 +390,5 @@ void PBRMaterial::renderInMenu()
 	ImGui::Checkbox("Occlusion Map", &use_properties[OCCLUSION_MAP]);
 	ImGui::Checkbox("Emission Map", &use_properties[EMISSION_MAP]);
 	ImGui::Checkbox("Heigh Map", &use_properties[HEIGH_MAP]);
+	ImGui::SliderFloat("Relief Depth", &relief_depth, 0.0f, 0.2f);
 }
\ No newline at end of file
@@ -5,7 +5,9 @@
 #include "shader.h"
 #include "camera.h"
 #include "mesh.h"
-#include "extra/hdre.h"
+#include "environment.h"
+
+class MaterialAtlas;
 
 class Material {
 public:
@@ -13,10 +15,21 @@ public:
 	Shader* shader = NULL;
 	Texture* texture = NULL;
 	vec4 color;
+	bool linear_output = false; //the shader outputs linear colors, drawn with GL_FRAMEBUFFER_SRGB so they are encoded when written
 
-	virtual void setUniforms(Camera* camera, Matrix44 model) = 0;
+	virtual void setUniforms(Camera* camera, Matrix44 model, Shader* shader = NULL) = 0; //to the material shader, or to a variant of it
 	virtual void render(Mesh* mesh, Matrix44 model, Camera * camera) = 0;
 	virtual void renderInMenu() = 0;
+	virtual void requestTextures(Mesh* mesh, Matrix44 model, Camera* camera) {} //tells the streamer which mips are needed to draw the mesh
+
+	//for the DrawBatch and the layered probes, that only enable the shader and call setUniforms: true if that is all render does
+	//and the uniforms dont depend on the model, the materials with render state of their own are drawn one by one
+	virtual bool canBatch() { return false; }
+	virtual bool isBlended() { return false; } //the DrawBatch draws them after the opaque ones, in the order they come
+
+	//for the DrawBatch: materials returning the same one are drawn in the same group with its uniforms, the params go with every draw (x is overwritten with the group)
+	virtual Material* getBatchMaterial() { return this; }
+	virtual Vector4 getDrawParams() { return Vector4(); }
 };
 
 class StandardMaterial : public Material {
@@ -25,9 +38,10 @@ public:
 	StandardMaterial();
 	~StandardMaterial();
 
-	void setUniforms(Camera* camera, Matrix44 model);
+	void setUniforms(Camera* camera, Matrix44 model, Shader* shader = NULL);
 	void render(Mesh* mesh, Matrix44 model, Camera * camera);
 	void renderInMenu();
+	bool canBatch() { return true; }
 };
 
 class WireframeMaterial : public StandardMaterial {
@@ -37,6 +51,7 @@ public:
 	~WireframeMaterial();
 
 	void render(Mesh* mesh, Matrix44 model, Camera * camera);
+	bool canBatch() { return false; } //polygon mode
 };
 
 class ReflectiveMaterial : public StandardMaterial {
@@ -44,7 +59,9 @@ public:
 
 	ReflectiveMaterial();
 	~ReflectiveMaterial();
+	void setUniforms(Camera* camera, Matrix44 model, Shader* shader = NULL);
 	void renderInMenu();
+	bool canBatch() { return false; } //the probe is chosen with the model
 };
 
 class PhongMaterial : public StandardMaterial {
@@ -66,7 +83,7 @@ public:
 	PhongMaterial();
 	~PhongMaterial();
 
-	void setUniforms(Camera* camera, Matrix44 model);
+	void setUniforms(Camera* camera, Matrix44 model, Shader* shader = NULL);
 	void renderInMenu();
 };
 
@@ -74,14 +91,9 @@ enum{PUNCTUAL_LIGHT, IBL, ALBEDO_MAP, ROUGH_MAP, METAL_MAP, NORMAL_MAP, OPACITY_
 class PBRMaterial : public StandardMaterial {
 public:
 	
-	bool use_properties[9] = { 0,0,0,0,0,0,0,0,0 };
+	bool use_properties[10] = { 0,0,0,0,0,0,0,0,0,0 };
 	//Material properties
-	HDRE* environment;
-	//Texture* cubemapTex;
-	std::vector<Texture*> prem_levels;
-
-	//BRDF LUT
-	Texture* brdfLUT;
+	Environment* environment; //shared IBL, NULL to use Environment::current
 
 	//in case of color mapping
 	Texture* albedo_map; //this is an image indicating the color for each coordinate
@@ -103,12 +115,31 @@ public:
 	Texture* occlusion_map; //this is an image indicating the occlusion map ((that will be updated as the scene is computed)
 
 	Texture* heigh_map;
+	Texture* cone_map; //relaxed cones of the heigh map for the relief mapping, used with the packed maps and the atlas too
+	float relief_depth; //of the heigh map in texture coordinates
 
-	PBRMaterial(HDRE* environment);
+	//packed versions of the single channel maps, used instead of them when set
+	Texture* orm_map; //occlusion, roughness, metalness
+	Texture* ohe_map; //opacity, heigh, emission
+
+	//the maps are read from the layer of the atlas instead (the first material of the atlas with the same uniforms gives them, except the draw params)
+	MaterialAtlas* atlas;
+	int atlas_layer;
+
+	PBRMaterial(Environment* environment = NULL);
 	~PBRMaterial();
 
-	void setUniforms(Camera* camera, Matrix44 model);
+	void setPackedMaps(Texture* orm_map, Texture* ohe_map);
+	bool setAtlas(MaterialAtlas* atlas); //needs the packed maps set and baked, false if they dont fit in the atlas
+
+	void setUniforms(Camera* camera, Matrix44 model, Shader* shader = NULL);
 	void renderInMenu();
+	void requestTextures(Mesh* mesh, Matrix44 model, Camera* camera);
+	Environment* getEnvironment() { return environment ? environment : Environment::current; }
+	bool isBlended() { return color.w < 1.0f || use_properties[OPACITY_MAP]; }
+	Material* getBatchMaterial();
+	bool hasSameUniforms(PBRMaterial* other); //all but the draw params, so they can share a group of the DrawBatch
+	Vector4 getDrawParams(); //y: layer, z: roughness, w: metallic factor
 };
 
 
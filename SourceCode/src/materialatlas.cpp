@@ -0,0 +1,191 @@
+#include "materialatlas.h"
+#include "material.h"
+#include "texture.h"
+#include "texturestreamer.h"
+
+#include <iostream>
+#include <algorithm>
+
+MaterialAtlas::MaterialAtlas(unsigned int size, unsigned int max_layers)
+{
+	this->size = size;
+	this->max_layers = max_layers;
+	capacity = 0;
+	for (int i = 0; i < NUM_ATLAS_MAPS; ++i)
+		arrays[i] = NULL;
+	num_levels = 1;
+	tail_level = resident_level = 0;
+	keep_frames = 60;
+	frame = 0;
+}
+
+MaterialAtlas::~MaterialAtlas()
+{
+	for (int i = 0; i < NUM_ATLAS_MAPS; ++i)
+		delete arrays[i];
+	for (size_t i = 0; i < layers.size(); ++i)
+		delete layers[i];
+}
+
+bool MaterialAtlas::loadMaps(PBRMaterial* material, KTX* ktx)
+{
+	static const char* names[] = { "albedo", "normal", "orm", "ohe" };
+	Texture* maps[] = { material->albedo_map, material->normal_map, material->orm_map, material->ohe_map };
+
+	//the textures may be streamed or still uploading, the whole chain is in their cache
+	for (int i = 0; i < NUM_ATLAS_MAPS; ++i)
+	{
+		if (!maps[i] || !ktx[i].load(maps[i]->filename.c_str()))
+		{
+			std::cout << "[WARN] MaterialAtlas: the " << names[i] << " map is missing or not baked" << std::endl;
+			return false;
+		}
+		if (ktx[i].width != size || ktx[i].height != size || ktx[i].num_faces != 1)
+		{
+			std::cout << "[WARN] MaterialAtlas: " << maps[i]->filename << " is " << ktx[i].width << "x" << ktx[i].height << ", the atlas is " << size << "x" << size << std::endl;
+			return false;
+		}
+		if (arrays[i] && (ktx[i].gl_internal_format != arrays[i]->internal_format || (int)ktx[i].levels.size() < num_levels))
+		{
+			std::cout << "[WARN] MaterialAtlas: " << maps[i]->filename << " has another format than the atlas" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int MaterialAtlas::add(PBRMaterial* material)
+{
+	if (materials.size() >= max_layers)
+	{
+		std::cout << "[WARN] MaterialAtlas: full (" << max_layers << " layers)" << std::endl;
+		return -1;
+	}
+
+	//everything is checked first so a failed material leaves nothing
+	sLayer* maps = new sLayer();
+	if (!loadMaps(material, maps->maps))
+	{
+		delete maps;
+		return -1;
+	}
+
+	//the first material decides the format of every array and the levels streamed
+	if (layers.empty())
+	{
+		num_levels = (int)maps->maps[0].levels.size();
+		for (int i = 1; i < NUM_ATLAS_MAPS; ++i)
+			num_levels = std::min(num_levels, (int)maps->maps[i].levels.size());
+		tail_level = 0;
+		while (tail_level < num_levels - 1 && (size >> tail_level) > TextureStreamer::getDefault()->tail_size)
+			tail_level++;
+		resident_level = tail_level;
+		level_used.assign(num_levels, -keep_frames - 1);
+	}
+
+	int layer = (int)layers.size();
+	layers.push_back(maps);
+	bool uploaded = true;
+	if (layers.size() > capacity)
+	{
+		createArrays(std::min(max_layers, std::max(1u, capacity * 2)));
+		for (int i = 0; i < NUM_ATLAS_MAPS && uploaded; ++i)
+			for (int j = 0; j <= layer && uploaded; ++j)
+				uploaded = arrays[i]->uploadLayer(j, &layers[j]->maps[i]);
+	}
+	else
+		for (int i = 0; i < NUM_ATLAS_MAPS && uploaded; ++i)
+			uploaded = arrays[i]->uploadLayer(layer, &maps->maps[i]);
+
+	if (!uploaded)
+	{
+		std::cout << "[ERROR] MaterialAtlas: cannot upload layer " << layer << std::endl;
+		layers.pop_back();
+		delete maps;
+		return -1;
+	}
+	materials.push_back(material);
+	return layer;
+}
+
+void MaterialAtlas::createArrays(unsigned int capacity)
+{
+	//only the resident levels are allocated, the layers are uploaded again by add
+	for (int i = 0; i < NUM_ATLAS_MAPS; ++i)
+	{
+		KTX& k = layers[0]->maps[i];
+		delete arrays[i];
+		arrays[i] = new Texture();
+		arrays[i]->createArray(size, size, capacity, k.gl_internal_format, k.isCompressed() ? k.gl_base_internal_format : k.gl_format, k.gl_type, num_levels, true, resident_level);
+		arrays[i]->category = TEXTURE_CATEGORY_MATERIAL;
+	}
+	this->capacity = capacity;
+}
+
+void MaterialAtlas::request(int level)
+{
+	if (layers.empty())
+		return;
+	level = std::min(std::max(level, 0), tail_level);
+	for (int i = level; i <= tail_level; ++i)
+		level_used[i] = frame;
+}
+
+void MaterialAtlas::update()
+{
+	if (layers.empty())
+		return;
+
+	//a level is kept some frames after it was needed, the finer ones come one per frame
+	int target = tail_level;
+	while (target > 0 && frame - level_used[target - 1] <= keep_frames)
+		target--;
+	if (target > resident_level)
+		setResidentLevel(target);
+	else if (target < resident_level)
+		setResidentLevel(resident_level - 1);
+	frame++;
+}
+
+void MaterialAtlas::setResidentLevel(int level)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < NUM_ATLAS_MAPS; ++i)
+	{
+		Texture* array = arrays[i];
+		bool compressed = layers[0]->maps[i].isCompressed();
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture_id);
+
+		//finer levels are allocated for every layer and filled, the dropped ones are respecified empty so the driver can free them
+		for (int l = level; l < resident_level; ++l)
+		{
+			unsigned int w = std::max(1u, size >> l);
+			GLsizei layer_size = (GLsizei)layers[0]->maps[i].levels[l].data.size();
+			if (compressed)
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, array->internal_format, w, w, capacity, 0, layer_size * capacity, NULL);
+			else
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, l, array->internal_format, w, w, capacity, 0, array->format, array->type, NULL);
+			for (size_t j = 0; j < layers.size(); ++j)
+			{
+				KTX::sLevel& data = layers[j]->maps[i].levels[l];
+				if (compressed)
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, (GLint)j, w, w, 1, array->internal_format, (GLsizei)data.data.size(), &data.data[0]);
+				else
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, (GLint)j, w, w, 1, array->format, array->type, &data.data[0]);
+			}
+		}
+		for (int l = resident_level; l < level; ++l)
+		{
+			if (compressed)
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, array->internal_format, 0, 0, 0, 0, 0, NULL);
+			else
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, l, array->internal_format, 0, 0, 0, 0, array->format, array->type, NULL);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level);
+		array->memory_size = Texture::computeMemorySize(std::max(1u, size >> level), std::max(1u, size >> level), 1, array->internal_format, array->format, array->type, num_levels - level, capacity);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	resident_level = level;
+}
@@ -0,0 +1,59 @@
+/*  Material atlas: the maps of several PBR materials of the same size stored as layers of texture arrays (one array per kind of map),
+	so all of them use the same shader and texture bindings and the DrawBatch submits the ones with the same uniforms in one group.
+	Every material has its layer, that reaches the shader as per draw data. The maps are copied from their baked KTX files,
+	only the packed layout is supported (albedo, normal, orm and ohe) and they must have the same size and compressed format.
+	The arrays only have the layers added (the capacity doubles when they are full) and their levels are streamed like the
+	TextureStreamer does: the materials request the level they need and the finer ones are uploaded or dropped for all the
+	layers at once, GL_TEXTURE_BASE_LEVEL of the arrays is the finest one resident.
+*/
+
+#ifndef MATERIALATLAS_H
+#define MATERIALATLAS_H
+
+#include "includes.h"
+#include "ktx.h"
+#include <vector>
+
+class Texture;
+class PBRMaterial;
+
+enum eAtlasMap { ATLAS_ALBEDO, ATLAS_NORMAL, ATLAS_ORM, ATLAS_OHE, NUM_ATLAS_MAPS };
+
+class MaterialAtlas
+{
+public:
+	unsigned int size; //of the first level of every map
+	unsigned int max_layers;
+	unsigned int capacity; //layers allocated in the arrays
+	Texture* arrays[NUM_ATLAS_MAPS]; //created with the first material
+	std::vector<PBRMaterial*> materials; //the index is the layer
+
+	//streaming, the same levels for every layer
+	int num_levels;
+	int tail_level; //always resident
+	int resident_level; //finest level uploaded
+	int keep_frames; //frames without being requested before a level is dropped
+
+	MaterialAtlas(unsigned int size, unsigned int max_layers = 64);
+	~MaterialAtlas();
+
+	//copies the maps of the material to a new layer, -1 if they dont fit (the material keeps using its own textures)
+	int add(PBRMaterial* material);
+
+	void request(int level); //the level a material of the atlas needs this frame
+	void update(); //once per frame after the requests, uploads one level or drops the ones not needed
+
+private:
+	struct sLayer {
+		KTX maps[NUM_ATLAS_MAPS]; //the levels to upload again
+	};
+	std::vector<sLayer*> layers;
+	std::vector<long> level_used; //last frame every level was needed
+	long frame;
+
+	bool loadMaps(PBRMaterial* material, KTX* ktx);
+	void createArrays(unsigned int capacity); //with the resident levels of the layers added
+	void setResidentLevel(int level);
+};
+
+#endif
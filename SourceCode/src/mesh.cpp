@@ -13,12 +13,17 @@
 #include "camera.h"
 #include "texture.h"
 #include "animation.h"
+#include "gpuarena.h"
+#include "streambuffer.h"
+#include "debugdraw.h"
 #include "extra/coldet/coldet.h"
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 bool Mesh::use_binary = true;
 bool Mesh::auto_upload_to_vram = true;
 bool Mesh::interleave_meshes = true;
+bool Mesh::use_vaos = true;
+bool Mesh::use_arena = true;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 
@@ -31,6 +36,9 @@ Mesh::Mesh()
 {
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	bound_vao = 0;
+	arena = NULL;
+	base_vertex = first_index = -1;
 	collision_model = NULL;
 	clear();
 }
@@ -43,6 +51,11 @@ Mesh::~Mesh()
 
 void Mesh::clear()
 {
+	clearVAOs();
+
+	if (arena)
+		arena->remove(this);
+
 	//Free VBOs
 	if (vertices_vbo_id) 
 		glDeleteBuffersARB(1,&vertices_vbo_id);
@@ -73,6 +86,7 @@ void Mesh::clear()
 	indices.clear();
 	bones.clear();
 	weights.clear();
+	uv_density = -1;
 
 	if (collision_model)
 		delete collision_model;
@@ -85,73 +99,133 @@ int color_location = -1;
 int bones_location = -1;
 int weights_location = -1;
 
+void Mesh::clearVAOs()
+{
+	for (auto it = vaos.begin(); it != vaos.end(); ++it)
+		glDeleteVertexArrays(1, &it->second);
+	vaos.clear();
+	bound_vao = 0;
+}
+
 void Mesh::enableBuffers(Shader* sh)
 {
-	vertex_location = sh->getAttribLocation("a_vertex");
-	assert(vertex_location != -1 && "No a_vertex found in shader");
+	assert(sh->attrib_locations[Shader::ATTRIB_VERTEX] != -1 && "No a_vertex found in shader");
+
+	//meshes in the arena share the VAO of the arena, so there is nothing to rebind between them
+	if (arena)
+	{
+		bound_vao = arena->bind(sh);
+		return;
+	}
+
+	//meshes in VRAM store the attribute setup in a VAO, shared by all the shaders with the same attribute layout
+	bound_vao = 0;
+	if (use_vaos && (vertices_vbo_id || interleaved_vbo_id))
+	{
+		GLuint& vao = vaos[sh->attrib_layout];
+		if (vao == 0)
+		{
+			glGenVertexArrays(1, &vao);
+			glBindVertexArray(vao);
+			setAttributes(sh);
+			if (indices_vbo_id)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id); //stored in the VAO
+		}
+		else
+			glBindVertexArray(vao);
+		bound_vao = vao;
+		return;
+	}
+
+	setAttributes(sh);
+}
+
+//meshes not stored in VRAM (dynamic geometry) copy their streams to the StreamBuffer every draw
+static void streamAttribute(int location, int components, GLenum type, const void* data, unsigned int size)
+{
+	StreamBuffer* stream = StreamBuffer::getDefault();
+	unsigned int offset = stream->upload(data, size);
+	glBindBuffer(GL_ARRAY_BUFFER, stream->buffer_id);
+	glVertexAttribPointer(location, components, type, GL_FALSE, 0, (void*)(size_t)offset);
+}
 
+void Mesh::setAttributes(Shader* sh)
+{
+	vertex_location = sh->attrib_locations[Shader::ATTRIB_VERTEX];
 	if (vertex_location == -1)
 		return;
 
 	int spacing = 0;
-	int offset_normal = 0;
-	int offset_uv = 0;
+	size_t offset_vertex = 0;
+	size_t offset_normal = 0;
+	size_t offset_uv = 0;
+	GLuint interleaved_id = interleaved_vbo_id;
 
 	if (interleaved.size())
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(Vector3);
 		offset_uv = sizeof(Vector3) + sizeof(Vector3);
+
+		//all the interleaved streams are uploaded at once
+		if (!interleaved_vbo_id)
+		{
+			StreamBuffer* stream = StreamBuffer::getDefault();
+			offset_vertex = stream->upload(&interleaved[0], interleaved.size() * sizeof(tInterleaved));
+			offset_normal += offset_vertex;
+			offset_uv += offset_vertex;
+			interleaved_id = stream->buffer_id;
+		}
 	}
 
 	glEnableVertexAttribArray(vertex_location);
 
-	if (vertices_vbo_id || interleaved_vbo_id)
+	if (vertices_vbo_id || interleaved_id)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : vertices_vbo_id);
+		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_vertex);
 	}
 	else
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+		streamAttribute(vertex_location, 3, GL_FLOAT, &vertices[0], vertices.size() * sizeof(Vector3));
 
 	normal_location = -1;
 	if (normals.size() || spacing)
 	{
-		normal_location = sh->getAttribLocation("a_normal");
+		normal_location = sh->attrib_locations[Shader::ATTRIB_NORMAL];
 		if (normal_location != -1)
 		{
 			glEnableVertexAttribArray(normal_location);
-			if (normals_vbo_id || interleaved_vbo_id)
+			if (normals_vbo_id || interleaved_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
+				glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : normals_vbo_id);
 				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
 			}
 			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+				streamAttribute(normal_location, 3, GL_FLOAT, &normals[0], normals.size() * sizeof(Vector3));
 		}
 	}
 
 	uv_location = -1;
 	if (uvs.size() || spacing)
 	{
-		uv_location = sh->getAttribLocation("a_uv");
+		uv_location = sh->attrib_locations[Shader::ATTRIB_UV];
 		if (uv_location != -1)
 		{
 			glEnableVertexAttribArray(uv_location);
-			if (uvs_vbo_id || interleaved_vbo_id)
+			if (uvs_vbo_id || interleaved_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
+				glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : uvs_vbo_id);
 				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
 			}
 			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
+				streamAttribute(uv_location, 2, GL_FLOAT, &uvs[0], uvs.size() * sizeof(Vector2));
 		}
 	}
 
 	color_location = -1;
 	if (colors.size())
 	{
-		color_location = sh->getAttribLocation("a_color");
+		color_location = sh->attrib_locations[Shader::ATTRIB_COLOR];
 		if (color_location != -1)
 		{
 			glEnableVertexAttribArray(color_location);
@@ -161,14 +235,14 @@ void Mesh::enableBuffers(Shader* sh)
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
+				streamAttribute(color_location, 4, GL_FLOAT, &colors[0], colors.size() * sizeof(Vector4));
 		}
 	}
 
 	bones_location = -1;
 	if (bones.size())
 	{
-		bones_location = sh->getAttribLocation("a_bones");
+		bones_location = sh->attrib_locations[Shader::ATTRIB_BONES];
 		if (bones_location != -1)
 		{
 			glEnableVertexAttribArray(bones_location);
@@ -178,13 +252,13 @@ void Mesh::enableBuffers(Shader* sh)
 				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, &bones[0]);
+				streamAttribute(bones_location, 4, GL_UNSIGNED_BYTE, &bones[0], bones.size() * sizeof(Vector4ub));
 		}
 	}
 	weights_location = -1;
 	if (weights.size())
 	{
-		weights_location = sh->getAttribLocation("a_weights");
+		weights_location = sh->attrib_locations[Shader::ATTRIB_WEIGHTS];
 		if (weights_location != -1)
 		{
 			glEnableVertexAttribArray(weights_location);
@@ -194,7 +268,7 @@ void Mesh::enableBuffers(Shader* sh)
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
+				streamAttribute(weights_location, 4, GL_FLOAT, &weights[0], weights.size() * sizeof(Vector4));
 		}
 	}
 
@@ -222,8 +296,78 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	disableBuffers(shader);
 }
 
+void Mesh::getDrawRange(int submesh_id, unsigned int& first, unsigned int& count)
+{
+	first = 0;
+	count = indices.size() ? indices.size() * 3 : getNumVertices();
+	if (submesh_id > 0 && !material_range.empty())
+	{
+		submesh_id -= 1;
+		first = submesh_id == 0 ? 0 : material_range[submesh_id - 1] * 3;
+		count = material_range[submesh_id] * 3 - first;
+	}
+}
+
+float Mesh::getUVDensity()
+{
+	if (uv_density >= 0)
+		return uv_density;
+
+	bool use_interleaved = interleaved.size() > 0;
+	unsigned int num_vertices = getNumVertices();
+	if (!use_interleaved && uvs.size() != vertices.size())
+		return uv_density = 0; //no uvs
+
+	//sqrt of the ratio between the area in object space and in uv space
+	double area = 0.0, uv_area = 0.0;
+	unsigned int num_triangles = indices.size() ? (unsigned int)indices.size() : num_vertices / 3;
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		unsigned int t[3] = { i * 3, i * 3 + 1, i * 3 + 2 };
+		if (indices.size())
+		{
+			t[0] = indices[i].x; t[1] = indices[i].y; t[2] = indices[i].z;
+		}
+		Vector3 p[3];
+		Vector2 uv[3];
+		for (int j = 0; j < 3; ++j)
+		{
+			p[j] = use_interleaved ? interleaved[t[j]].vertex : vertices[t[j]];
+			uv[j] = use_interleaved ? interleaved[t[j]].uv : uvs[t[j]];
+		}
+		area += (p[1] - p[0]).cross(p[2] - p[0]).length() * 0.5;
+		uv_area += fabs((uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y)) * 0.5;
+	}
+	uv_density = uv_area > 0.0 ? (float)sqrt(area / uv_area) : 0.0f;
+	return uv_density;
+}
+
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 {
+	//inside the arena vertices start at base_vertex and indices at first_index
+	if (arena)
+	{
+		unsigned int first, count;
+		getDrawRange(submesh_id, first, count);
+		if (first_index != -1)
+		{
+			void* offset = (void*)((first_index + first) * sizeof(unsigned int));
+			if (num_instances > 0)
+				glDrawElementsInstancedBaseVertex(primitive, count, GL_UNSIGNED_INT, offset, num_instances, base_vertex);
+			else
+				glDrawElementsBaseVertex(primitive, count, GL_UNSIGNED_INT, offset, base_vertex);
+		}
+		else if (num_instances > 0)
+			glDrawArraysInstanced(primitive, base_vertex + first, count, num_instances);
+		else
+			glDrawArrays(primitive, base_vertex + first, count);
+
+		assert(glGetError() == GL_NO_ERROR);
+		num_triangles_rendered += (count / 3) * (num_instances ? num_instances : 1);
+		num_meshes_rendered++;
+		return;
+	}
+
 	int start = 0;
 	int size = vertices.size();
 	if (indices.size())
@@ -245,20 +389,31 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			if (!bound_vao)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3)), num_instances);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			if (!bound_vao)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
 		{
-			if (indices_vbo_id)
+			if (bound_vao) //the VAO already has the indices bound
+				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
+			else if (indices_vbo_id)
 			{
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			}
 			else
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&indices[0] + start)); //no multiply, its a vector3u pointer)
+			{
+				//dynamic meshes stream their indices too
+				StreamBuffer* stream = StreamBuffer::getDefault();
+				unsigned int offset = stream->upload(&indices[0] + start, size * sizeof(Vector3u)); //no multiply, its a vector3u pointer
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream->buffer_id);
+				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(size_t)offset);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			}
 		}
 	}
 	else
@@ -277,6 +432,13 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 
 void Mesh::disableBuffers(Shader* shader)
 {
+	if (bound_vao)
+	{
+		glBindVertexArray(0);
+		bound_vao = 0;
+		return;
+	}
+
 	glDisableVertexAttribArray(vertex_location);
 	if (normal_location != -1) glDisableVertexAttribArray(normal_location);
 	if (uv_location != -1) glDisableVertexAttribArray(uv_location);
@@ -287,8 +449,6 @@ void Mesh::disableBuffers(Shader* shader)
 	assert(glGetError() == GL_NO_ERROR);
 }
 
-GLuint instances_buffer_id = 0;
-
 //should be faster but in some system it is slower
 void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
 {
@@ -298,35 +458,40 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 	Shader* shader = Shader::current;
 	assert(shader && "shader must be enabled");
 
-	if (instances_buffer_id == 0)
-		glGenBuffersARB(1, &instances_buffer_id);
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
-
 	int attribLocation = shader->getAttribLocation("u_model");
 	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
 	if (attribLocation == -1)
 		return; //this shader doesnt support instanced model
 
+	//bind the mesh buffers first, so the instanced attribs are set in the same VAO
+	enableBuffers(shader);
+
+	//the matrices are written in the stream buffer, no reallocation every call
+	StreamBuffer* stream = StreamBuffer::getDefault();
+	unsigned int instances_offset = stream->upload(instanced_models, num_instances * sizeof(Matrix44));
+	glBindBuffer(GL_ARRAY_BUFFER, stream->buffer_id);
+
 	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
 	for (int k = 0; k < 4; ++k)
 	{
 		glEnableVertexAttribArray(attribLocation + k );
-		int offset = sizeof(float) * 4 * k;
+		size_t offset = instances_offset + sizeof(float) * 4 * k;
 		const Uint8* addr = (Uint8*) offset;
 		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr); 
 		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 	}
 
-	//regular render
-	render(primitive, 0, num_instances);
+	//draw call
+	drawCall(primitive, 0, num_instances);
 
-	//disable instanced attribs
+	//disable instanced attribs (the VAO is shared with non instanced draws)
 	for (int k = 0; k < 4; ++k)
 	{
 		glDisableVertexAttribArray(attribLocation + k);
 		glVertexAttribDivisor(attribLocation + k, 0);
 	}
+
+	disableBuffers(shader);
 }
 
 //super obsolete rendering method, do not use
@@ -418,6 +583,21 @@ void Mesh::uploadToVRAM()
 {
 	assert(vertices.size() || interleaved.size());
 
+	//streams may have changed, the VAOs will be recreated in the next draw
+	clearVAOs();
+
+	if (arena)
+		arena->remove(this);
+
+	//simple interleaved meshes go to the shared buffers
+	if (use_arena && interleaved.size() && !colors.size() && !bones.size() && !weights.size())
+	{
+		if (GPUArena::getDefault()->add(this))
+			return;
+		if (arena) //upload failed, fallback to its own buffers
+			arena->remove(this);
+	}
+
 	if (glGenBuffersARB == 0)
 	{
 		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
@@ -1320,14 +1500,19 @@ void Mesh::displace(Image* heightmap, float altitude)
 	int num = is_interleaved ? interleaved.size() : vertices.size();
 	assert(num && "no vertices found");
 
+	//all the vertices sampled in one batch
+	std::vector<Vector2> coords(num);
+	std::vector<Vector4> heights(num);
+	for (int i = 0; i < num; ++i)
+		coords[i].set(uvs[i].x * heightmap->width, uvs[i].y * heightmap->height);
+	heightmap->getPixelsInterpolated(&coords[0], num, &heights[0]);
+
 	for (int i = 0; i < num; ++i)
 	{
-		Vector2& uv = uvs[i];
-		Color c = heightmap->getPixelInterpolated(uv.x * heightmap->width, uv.y * heightmap->height);
 		if (is_interleaved)
-			interleaved[i].vertex.y = (c.x / 255.0f) * altitude;
+			interleaved[i].vertex.y = heights[i].x * altitude;
 		else
-			vertices[i].y = (c.x / 255.0f) * altitude;
+			vertices[i].y = heights[i].x * altitude;
 	}
 	box.center.y += altitude*0.5f;
 	box.halfsize.y += altitude*0.5f;
@@ -1355,41 +1540,12 @@ void Mesh::createGrid(float dist)
 	}
 }
 
-Mesh* wire_box = NULL;
-
 void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
 {
-	if (!wire_box)
-	{
-		wire_box = new Mesh();
-		wire_box->createWireBox();
-		wire_box->uploadToVRAM();
-	}
-
-	Shader* sh = Shader::getDefaultShader("flat");
-	sh->enable();
-	sh->setUniform("u_viewprojection", Camera::last_enabled->viewprojection_matrix);
-
-	Matrix44 matrix;
-	matrix.translate(box.center.x, box.center.y, box.center.z);
-	matrix.scale(box.halfsize.x, box.halfsize.y, box.halfsize.z);
-
-	sh->setUniform("u_color", Vector4(1, 1, 0, 1));
-	sh->setUniform("u_model", matrix * model);
-	wire_box->render(GL_LINES);
+	DebugDraw::addBox(model, box, Vector4(1, 1, 0, 1));
 
 	if (world_bounding)
-	{
-		BoundingBox AABB = transformBoundingBox(model, box);
-		matrix.setIdentity();
-		matrix.translate(AABB.center.x, AABB.center.y, AABB.center.z);
-		matrix.scale(AABB.halfsize.x, AABB.halfsize.y, AABB.halfsize.z);
-		sh->setUniform("u_model", matrix);
-		sh->setUniform("u_color", Vector4(0, 1, 1, 1));
-		wire_box->render(GL_LINES);
-	}
-
-	sh->disable();
+		DebugDraw::addBox(Matrix44(), transformBoundingBox(model, box), Vector4(0, 1, 1, 1));
 }
 
 
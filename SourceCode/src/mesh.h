@@ -10,6 +10,7 @@
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class GPUArena; //for meshes stored in shared buffers
 
 #define MESH_BIN_VERSION 7 //this is used to regenerate bins if the format changes
 
@@ -25,6 +26,8 @@ public:
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static bool use_vaos; //cache the attribute setup of uploaded meshes in Vertex Array Objects
+	static bool use_arena; //interleaved meshes are uploaded to the shared buffers of the GPUArena instead of having their own
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 
@@ -59,6 +62,7 @@ public:
 	BoundingBox box;
 
 	float radius;
+	float uv_density; //object units per uv unit, -1 until computed
 
 	unsigned int vertices_vbo_id;
 	unsigned int uvs_vbo_id;
@@ -70,6 +74,14 @@ public:
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
 
+	std::map<unsigned int, unsigned int> vaos; //one VAO per shader attribute layout (see Shader::attrib_layout)
+	unsigned int bound_vao; //VAO used in the current draw, 0 if the attributes were set manually
+
+	//when stored in an arena the mesh has no VBOs, only where its data starts inside the arena buffers
+	GPUArena* arena;
+	int base_vertex;
+	int first_index; //-1 if not indexed
+
 	Mesh();
 	~Mesh();
 
@@ -84,6 +96,8 @@ public:
 	void enableBuffers(Shader* shader);
 	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
 	void disableBuffers(Shader* shader);
+	void clearVAOs();
+	void getDrawRange(int submesh_id, unsigned int& first, unsigned int& count); //in indices if indexed, in vertices otherwise
 
 	bool readBin(const char* filename);
 	bool writeBin(const char* filename);
@@ -91,6 +105,7 @@ public:
 	unsigned int getNumSubmaterials() { return material_name.size(); }
 	unsigned int getNumSubmeshes() { return material_range.size(); }
 	unsigned int getNumVertices() { return interleaved.size() ? interleaved.size() : vertices.size(); }
+	float getUVDensity(); //how big one uv unit is in object space, from the area of the triangles (used to choose texture mips)
 
 	//collision testing
 	void* collision_model;
@@ -119,6 +134,8 @@ public:
 	bool interleaveBuffers();
 
 private:
+	void setAttributes(Shader* shader);
+
 	bool loadASE(const char* filename);
 	bool loadOBJ(const char* filename);
 	bool loadMESH(const char* filename); //personal format used for animations
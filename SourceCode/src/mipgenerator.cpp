@@ -0,0 +1,264 @@
+#include "mipgenerator.h"
+#include "threadpool.h"
+#include "imagekernels.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define MIP_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+inline float sinc(float x)
+{
+	if (fabsf(x) < 1e-4f)
+		return 1.0f;
+	return sinf(PI * x) / (PI * x);
+}
+
+//modified bessel function of order 0, for the kaiser window
+float bessel0(float x)
+{
+	float sum = 1.0f, term = 1.0f;
+	for (int k = 1; k < 30; ++k)
+	{
+		float t = x / (2.0f * k);
+		term *= t * t;
+		sum += term;
+		if (term < sum * 1e-7f)
+			break;
+	}
+	return sum;
+}
+
+//radius in destination pixels
+float getFilterRadius(eMipFilter filter)
+{
+	return filter == MIP_FILTER_BOX ? 0.5f : 3.0f;
+}
+
+float evalFilter(eMipFilter filter, float x)
+{
+	float ax = fabsf(x);
+	switch (filter)
+	{
+	case MIP_FILTER_BOX:
+		return ax <= 0.5f ? 1.0f : 0.0f;
+	case MIP_FILTER_KAISER:
+	{
+		const float width = 3.0f, alpha = 4.0f;
+		if (ax >= width)
+			return 0.0f;
+		float t = x / width;
+		return sinc(x) * bessel0(alpha * sqrtf(1.0f - t * t)) / bessel0(alpha);
+	}
+	case MIP_FILTER_LANCZOS:
+		return ax < 3.0f ? sinc(x) * sinc(x / 3.0f) : 0.0f;
+	}
+	return 0.0f;
+}
+
+//source pixels and weights of every destination pixel along one axis
+struct sTaps
+{
+	std::vector<int> first; //offset in indices/weights of every destination pixel
+	std::vector<int> count;
+	std::vector<int> indices;
+	std::vector<float> weights;
+
+	void build(int src_size, int dst_size, eMipFilter filter, bool wrap)
+	{
+		float scale = src_size / (float)dst_size;
+		float support = getFilterRadius(filter) * scale;
+		first.resize(dst_size);
+		count.resize(dst_size);
+		indices.clear();
+		weights.clear();
+		for (int i = 0; i < dst_size; ++i)
+		{
+			float center = (i + 0.5f) * scale;
+			int start = (int)floorf(center - support);
+			int end = (int)ceilf(center + support);
+			first[i] = (int)indices.size();
+			float sum = 0.0f;
+			for (int s = start; s <= end; ++s)
+			{
+				float w = evalFilter(filter, (s + 0.5f - center) / scale);
+				if (w == 0.0f)
+					continue;
+				int index = wrap ? ((s % src_size) + src_size) % src_size : std::min(std::max(s, 0), src_size - 1);
+				indices.push_back(index);
+				weights.push_back(w);
+				sum += w;
+			}
+			count[i] = (int)indices.size() - first[i];
+			for (int k = first[i]; k < first[i] + count[i]; ++k)
+				weights[k] /= sum;
+		}
+	}
+};
+
+//dst = sum of src[index * stride] * weight, for RGBA float pixels
+inline void filterPixel(const float* src, int stride, const sTaps& taps, int i, float* dst)
+{
+	const int* indices = &taps.indices[taps.first[i]];
+	const float* weights = &taps.weights[taps.first[i]];
+	int count = taps.count[i];
+#ifdef MIP_USE_SSE2
+	__m128 acc = _mm_setzero_ps();
+	for (int k = 0; k < count; ++k)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + indices[k] * stride), _mm_set1_ps(weights[k])));
+	_mm_storeu_ps(dst, acc);
+#else
+	float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int k = 0; k < count; ++k)
+	{
+		const float* p = src + indices[k] * stride;
+		for (int c = 0; c < 4; ++c)
+			acc[c] += p[c] * weights[k];
+	}
+	memcpy(dst, acc, sizeof(acc));
+#endif
+}
+
+inline float srgbToLinear(float v) { return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f); }
+inline float linearToSrgb(float v) { return v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f; }
+
+inline unsigned char toByte(float v)
+{
+	v = v * 255.0f + 0.5f;
+	return (unsigned char)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+}
+
+//pixels to the space where they are filtered
+void decodePixels(const unsigned char* src, float* dst, size_t num_pixels, const sMipOptions& options)
+{
+	if (!options.srgb && !options.normal_map)
+	{
+		unormToFloat(src, dst, num_pixels * 4);
+		return;
+	}
+
+	float table[256];
+	for (int i = 0; i < 256; ++i)
+		table[i] = options.srgb ? srgbToLinear(i / 255.0f) : (options.normal_map ? i / 127.5f - 1.0f : i / 255.0f);
+	for (size_t i = 0; i < num_pixels; ++i, src += 4, dst += 4)
+	{
+		dst[0] = table[src[0]];
+		dst[1] = table[src[1]];
+		dst[2] = table[src[2]];
+		dst[3] = src[3] / 255.0f;
+	}
+}
+
+void normalizePixels(float* pixels, size_t num_pixels)
+{
+	for (size_t i = 0; i < num_pixels; ++i, pixels += 4)
+	{
+		float len = sqrtf(pixels[0] * pixels[0] + pixels[1] * pixels[1] + pixels[2] * pixels[2]);
+		if (len < 1e-6f)
+		{
+			pixels[0] = pixels[1] = 0.0f;
+			pixels[2] = 1.0f; //flat
+			continue;
+		}
+		for (int c = 0; c < 3; ++c)
+			pixels[c] /= len;
+	}
+}
+
+void encodePixels(const float* src, unsigned char* dst, size_t num_pixels, const sMipOptions& options)
+{
+	if (!options.srgb && !options.normal_map)
+	{
+		floatToUnorm(src, dst, num_pixels * 4);
+		return;
+	}
+
+	for (size_t i = 0; i < num_pixels; ++i, src += 4, dst += 4)
+	{
+		if (options.normal_map)
+			for (int c = 0; c < 3; ++c)
+				dst[c] = toByte(src[c] * 0.5f + 0.5f);
+		else if (options.srgb)
+			for (int c = 0; c < 3; ++c)
+				dst[c] = toByte(linearToSrgb(std::max(src[c], 0.0f)));
+		else
+			for (int c = 0; c < 3; ++c)
+				dst[c] = toByte(src[c]);
+		dst[3] = toByte(src[3]);
+	}
+}
+
+} //namespace
+
+const char* getMipFilterName(eMipFilter filter)
+{
+	switch (filter)
+	{
+		case MIP_FILTER_BOX: return "box";
+		case MIP_FILTER_KAISER: return "kaiser";
+		case MIP_FILTER_LANCZOS: return "lanczos";
+	}
+	return "";
+}
+
+void generateMips(const unsigned char* rgba, int width, int height, int num_faces, const sMipOptions& options, std::vector< std::vector<unsigned char> >& levels)
+{
+	ThreadPool* pool = ThreadPool::getDefault();
+	levels.clear();
+	levels.push_back(std::vector<unsigned char>(rgba, rgba + (size_t)width * height * 4 * num_faces));
+
+	//the previous level is kept in float so the error doesnt accumulate
+	std::vector<float> current((size_t)width * height * 4 * num_faces);
+	decodePixels(rgba, &current[0], (size_t)width * height * num_faces, options);
+
+	std::vector<float> temp, next;
+	sTaps taps_x, taps_y;
+	while (width > 1 || height > 1)
+	{
+		int dst_width = std::max(1, width / 2);
+		int dst_height = std::max(1, height / 2);
+		taps_x.build(width, dst_width, options.filter, options.wrap);
+		taps_y.build(height, dst_height, options.filter, options.wrap);
+
+		//horizontal pass, every source row to the destination width
+		temp.resize((size_t)dst_width * height * 4 * num_faces);
+		pool->parallelFor(height * num_faces, [&](int row) {
+			const float* src = &current[(size_t)row * width * 4];
+			float* dst = &temp[(size_t)row * dst_width * 4];
+			for (int x = 0; x < dst_width; ++x)
+				filterPixel(src, 4, taps_x, x, dst + x * 4);
+		});
+
+		//vertical pass
+		next.resize((size_t)dst_width * dst_height * 4 * num_faces);
+		pool->parallelFor(dst_height * num_faces, [&](int row) {
+			int face = row / dst_height;
+			int y = row % dst_height;
+			const float* src = &temp[(size_t)face * dst_width * height * 4];
+			float* dst = &next[(size_t)row * dst_width * 4];
+			for (int x = 0; x < dst_width; ++x)
+				filterPixel(src + x * 4, dst_width * 4, taps_y, y, dst + x * 4);
+		});
+
+		width = dst_width;
+		height = dst_height;
+		current.swap(next);
+
+		levels.push_back(std::vector<unsigned char>((size_t)width * height * 4 * num_faces));
+		std::vector<unsigned char>& level = levels.back();
+		pool->parallelFor(height * num_faces, [&](int row) {
+			float* pixels = &current[(size_t)row * width * 4];
+			if (options.normal_map)
+				normalizePixels(pixels, width); //before the next level too
+			encodePixels(pixels, &level[(size_t)row * width * 4], width, options);
+		});
+	}
+}
@@ -0,0 +1,31 @@
+/*  Builds the whole mip chain of a RGBA8 image on CPU, to bake it with the texture instead of using glGenerateMipmap at load.
+	Filtering is done in float with a separable windowed sinc (or a box), in linear space for sRGB colors and renormalizing normal maps.
+	Every level is made from the previous one, the rows (and faces) of a level are split between the threads.
+*/
+
+#ifndef MIPGENERATOR_H
+#define MIPGENERATOR_H
+
+#include <vector>
+
+enum eMipFilter {
+	MIP_FILTER_BOX, //like the driver
+	MIP_FILTER_KAISER, //sharp and without much ringing
+	MIP_FILTER_LANCZOS
+};
+
+struct sMipOptions {
+	eMipFilter filter;
+	bool srgb; //rgb is averaged in linear space
+	bool normal_map; //rgb is a normal in [0,255], renormalized in every level
+	bool wrap; //the texture repeats, if not the borders are clamped
+
+	sMipOptions() { filter = MIP_FILTER_KAISER; srgb = false; normal_map = false; wrap = true; }
+};
+
+const char* getMipFilterName(eMipFilter filter);
+
+//levels[0] is a copy of the source, the last one is 1x1. Faces are stored one after another (6 for cubemaps) in the source and in every level
+void generateMips(const unsigned char* rgba, int width, int height, int num_faces, const sMipOptions& options, std::vector< std::vector<unsigned char> >& levels);
+
+#endif
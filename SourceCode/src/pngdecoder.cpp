@@ -0,0 +1,628 @@
+#include "pngdecoder.h"
+#include "texture.h"
+
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define PNG_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+// INFLATE *********************************
+// zlib stream decoder (RFC 1950/1951) with table based huffman decoding and a 64 bits bit buffer
+
+namespace {
+
+const int FAST_BITS = 11;
+const int FAST_MASK = (1 << FAST_BITS) - 1;
+
+const unsigned short length_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+const unsigned char length_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+const unsigned short dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+const unsigned char dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+const unsigned char code_length_order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+struct BitReader
+{
+	const uint8_t* p;
+	const uint8_t* end;
+	uint64_t bits;
+	int count;
+	int padding; //zero bytes added after the end of the data
+
+	BitReader(const uint8_t* data, size_t size) { p = data; end = data + size; bits = 0; count = 0; padding = 0; }
+
+	//leaves at least 56 bits in the buffer
+	inline void refill()
+	{
+		if (end - p >= 8)
+		{
+			uint64_t v;
+			memcpy(&v, p, 8); //little endian
+			bits |= v << count;
+			p += (63 - count) >> 3;
+			count |= 56;
+			return;
+		}
+		while (count <= 56)
+		{
+			if (p < end)
+				bits |= (uint64_t)*p++ << count;
+			else
+				padding++;
+			count += 8;
+		}
+	}
+
+	inline unsigned int get(int n)
+	{
+		unsigned int v = (unsigned int)(bits & ((1ull << n) - 1));
+		bits >>= n;
+		count -= n;
+		return v;
+	}
+};
+
+struct Huffman
+{
+	unsigned short fast[1 << FAST_BITS]; //(symbol << 4) | length, 0 if the code is longer than FAST_BITS
+	unsigned short count[16]; //number of codes of every length
+	unsigned short symbols[288]; //sorted by code
+
+	bool build(const unsigned char* lengths, int num)
+	{
+		memset(count, 0, sizeof(count));
+		memset(fast, 0, sizeof(fast));
+		for (int i = 0; i < num; ++i)
+			count[lengths[i]]++;
+		count[0] = 0;
+
+		//over-subscribed sets are invalid, incomplete ones are allowed
+		int left = 1;
+		for (int len = 1; len < 16; ++len)
+		{
+			left = (left << 1) - count[len];
+			if (left < 0)
+				return false;
+		}
+
+		unsigned short offsets[16];
+		offsets[1] = 0;
+		for (int len = 1; len < 15; ++len)
+			offsets[len + 1] = offsets[len] + count[len];
+		for (int i = 0; i < num; ++i)
+			if (lengths[i])
+				symbols[offsets[lengths[i]]++] = i;
+
+		//canonical codes, the short ones go to the fast table (bit reversed, deflate reads them LSB first)
+		int next_code[16];
+		int code = 0;
+		for (int len = 1; len < 16; ++len)
+		{
+			code = (code + count[len - 1]) << 1;
+			next_code[len] = code;
+		}
+		for (int i = 0; i < num; ++i)
+		{
+			int len = lengths[i];
+			if (!len)
+				continue;
+			int c = next_code[len]++;
+			if (len > FAST_BITS)
+				continue;
+			int rev = 0;
+			for (int j = 0; j < len; ++j)
+				rev |= ((c >> j) & 1) << (len - 1 - j);
+			for (int j = rev; j <= FAST_MASK; j += 1 << len)
+				fast[j] = (unsigned short)((i << 4) | len);
+		}
+		return true;
+	}
+
+	//the bit reader must have 15 bits at least
+	inline int decode(BitReader& br) const
+	{
+		unsigned short e = fast[br.bits & FAST_MASK];
+		if (e)
+		{
+			br.get(e & 15);
+			return e >> 4;
+		}
+
+		//long codes, canonical decoding bit by bit
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16; ++len)
+		{
+			code |= (int)(br.bits >> (len - 1)) & 1;
+			int num = count[len];
+			if (code - num < first)
+			{
+				br.get(len);
+				return symbols[index + (code - first)];
+			}
+			index += num;
+			first = (first + num) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+struct FixedTables
+{
+	Huffman lit;
+	Huffman dist;
+
+	FixedTables()
+	{
+		unsigned char lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		lit.build(lengths, 288);
+		memset(lengths, 5, 30);
+		dist.build(lengths, 30);
+	}
+};
+
+bool readDynamicTables(BitReader& br, Huffman& lit, Huffman& dist)
+{
+	br.refill();
+	int num_lit = br.get(5) + 257;
+	int num_dist = br.get(5) + 1;
+	int num_code_lengths = br.get(4) + 4;
+
+	unsigned char lengths[288 + 32];
+	memset(lengths, 0, 19);
+	for (int i = 0; i < num_code_lengths; ++i)
+	{
+		br.refill();
+		lengths[code_length_order[i]] = br.get(3);
+	}
+	Huffman code_lengths;
+	if (!code_lengths.build(lengths, 19))
+		return false;
+
+	int n = 0;
+	while (n < num_lit + num_dist)
+	{
+		br.refill();
+		int sym = code_lengths.decode(br);
+		if (sym < 0)
+			return false;
+		if (sym < 16)
+		{
+			lengths[n++] = sym;
+			continue;
+		}
+		int repeat = 0;
+		unsigned char value = 0;
+		if (sym == 16)
+		{
+			if (!n)
+				return false;
+			value = lengths[n - 1];
+			repeat = 3 + br.get(2);
+		}
+		else if (sym == 17)
+			repeat = 3 + br.get(3);
+		else
+			repeat = 11 + br.get(7);
+		if (n + repeat > num_lit + num_dist)
+			return false;
+		memset(lengths + n, value, repeat);
+		n += repeat;
+	}
+
+	if (lengths[256] == 0) //no end of block code
+		return false;
+	return lit.build(lengths, num_lit) && dist.build(lengths + num_lit, num_dist);
+}
+
+//decompresses into out, that must have the exact size of the uncompressed data
+bool inflateZlib(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size)
+{
+	if (in_size < 2)
+		return false;
+	int cmf = in[0], flg = in[1];
+	if ((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32))
+		return false;
+
+	static const FixedTables fixed;
+	Huffman dynamic_lit, dynamic_dist;
+
+	BitReader br(in + 2, in_size - 2);
+	uint8_t* dst = out;
+	uint8_t* dst_end = out + out_size;
+	bool final_block = false;
+
+	while (!final_block)
+	{
+		br.refill();
+		final_block = br.get(1) != 0;
+		int type = br.get(2);
+
+		if (type == 0) //stored
+		{
+			//back to the byte boundary, the bytes in the bit buffer (without the padding) are read again from the input
+			br.get(br.count & 7);
+			int buffered = (br.count >> 3) - br.padding;
+			if (buffered < 0)
+				return false;
+			br.p -= buffered;
+			br.bits = 0;
+			br.count = 0;
+			br.padding = 0;
+
+			if (br.end - br.p < 4)
+				return false;
+			unsigned int len = br.p[0] | (br.p[1] << 8);
+			unsigned int nlen = br.p[2] | (br.p[3] << 8);
+			br.p += 4;
+			if ((len ^ 0xFFFF) != nlen || len > (size_t)(dst_end - dst) || len > (size_t)(br.end - br.p))
+				return false;
+			memcpy(dst, br.p, len);
+			dst += len;
+			br.p += len;
+			continue;
+		}
+
+		const Huffman* lit = &fixed.lit;
+		const Huffman* dist = &fixed.dist;
+		if (type == 2)
+		{
+			if (!readDynamicTables(br, dynamic_lit, dynamic_dist))
+				return false;
+			lit = &dynamic_lit;
+			dist = &dynamic_dist;
+		}
+		else if (type != 1)
+			return false;
+
+		while (true)
+		{
+			br.refill(); //enough for three codes, the extra bits of a length and its distance need another one
+			int sym = lit->decode(br);
+			if (sym < 256)
+			{
+				if (sym < 0 || dst == dst_end)
+					return false;
+				*dst++ = (uint8_t)sym;
+				sym = lit->decode(br);
+				if (sym < 256)
+				{
+					if (sym < 0 || dst == dst_end)
+						return false;
+					*dst++ = (uint8_t)sym;
+					sym = lit->decode(br);
+					if (sym < 256)
+					{
+						if (sym < 0 || dst == dst_end)
+							return false;
+						*dst++ = (uint8_t)sym;
+						continue;
+					}
+				}
+			}
+			if (sym == 256)
+				break;
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+			br.refill(); //the length extra (5) and the distance (15+13)
+			int length = length_base[sym] + br.get(length_extra[sym]);
+			int dsym = dist->decode(br);
+			if (dsym < 0 || dsym >= 30)
+				return false;
+			int distance = dist_base[dsym] + br.get(dist_extra[dsym]);
+			if (distance > dst - out || length > dst_end - dst)
+				return false;
+
+			const uint8_t* src = dst - distance;
+			if (distance >= 8 && dst_end - dst >= length + 8)
+			{
+				//8 bytes at a time, may write a few bytes more that will be overwritten later
+				for (int i = 0; i < length; i += 8)
+				{
+					uint64_t v;
+					memcpy(&v, src + i, 8);
+					memcpy(dst + i, &v, 8);
+				}
+				dst += length;
+			}
+			else
+				for (int i = 0; i < length; ++i)
+					*dst++ = src[i];
+		}
+
+		if (br.padding > 8)
+			return false; //truncated stream
+	}
+
+	return dst == dst_end;
+}
+
+// UNFILTER *********************************
+
+inline int paeth(int a, int b, int c)
+{
+	int pa = abs(b - c);
+	int pb = abs(a - c);
+	int pc = abs(a + b - 2 * c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+#ifdef PNG_USE_SSE2
+inline __m128i load4(const uint8_t* p) { int v; memcpy(&v, p, 4); return _mm_cvtsi32_si128(v); }
+inline void store4(uint8_t* p, __m128i v) { int i = _mm_cvtsi128_si32(v); memcpy(p, &i, 4); }
+inline __m128i abs16(__m128i v) { return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v)); }
+inline __m128i select(__m128i mask, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+#endif
+
+//src is the filtered row (without the filter byte), prev the previous unfiltered row (zeros for the first one)
+void unfilterRow(uint8_t* dst, const uint8_t* src, const uint8_t* prev, int filter, int bpp, size_t row_bytes)
+{
+	size_t i = 0;
+	switch (filter)
+	{
+	case 0: //none
+		memcpy(dst, src, row_bytes);
+		return;
+	case 1: //sub
+#ifdef PNG_USE_SSE2
+		if (bpp == 4)
+		{
+			__m128i a = _mm_setzero_si128();
+			for (; i < row_bytes; i += 4)
+			{
+				a = _mm_add_epi8(a, load4(src + i));
+				store4(dst + i, a);
+			}
+			return;
+		}
+#endif
+		for (; i < (size_t)bpp; ++i)
+			dst[i] = src[i];
+		for (; i < row_bytes; ++i)
+			dst[i] = src[i] + dst[i - bpp];
+		return;
+	case 2: //up
+#ifdef PNG_USE_SSE2
+		for (; i + 16 <= row_bytes; i += 16)
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(src + i)), _mm_loadu_si128((const __m128i*)(prev + i))));
+#endif
+		for (; i < row_bytes; ++i)
+			dst[i] = src[i] + prev[i];
+		return;
+	case 3: //average
+#ifdef PNG_USE_SSE2
+		if (bpp == 4)
+		{
+			__m128i a = _mm_setzero_si128();
+			__m128i one = _mm_set1_epi8(1);
+			for (; i < row_bytes; i += 4)
+			{
+				__m128i b = load4(prev + i);
+				//_mm_avg_epu8 rounds up, the spec rounds down
+				__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+				a = _mm_add_epi8(load4(src + i), avg);
+				store4(dst + i, a);
+			}
+			return;
+		}
+#endif
+		for (; i < (size_t)bpp; ++i)
+			dst[i] = src[i] + (prev[i] >> 1);
+		for (; i < row_bytes; ++i)
+			dst[i] = src[i] + ((dst[i - bpp] + prev[i]) >> 1);
+		return;
+	case 4: //paeth
+#ifdef PNG_USE_SSE2
+		if (bpp == 4)
+		{
+			__m128i zero = _mm_setzero_si128();
+			__m128i a = zero, c = zero;
+			for (; i < row_bytes; i += 4)
+			{
+				__m128i b = _mm_unpacklo_epi8(load4(prev + i), zero);
+				__m128i x = load4(src + i);
+				__m128i pa = _mm_sub_epi16(b, c); //p - a
+				__m128i pb = _mm_sub_epi16(a, c); //p - b
+				__m128i pc = _mm_add_epi16(pa, pb); //p - c
+				pa = abs16(pa);
+				pb = abs16(pb);
+				pc = abs16(pc);
+				__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+				__m128i nearest = select(_mm_cmpeq_epi16(pb, smallest), b, c);
+				nearest = select(_mm_cmpeq_epi16(pa, smallest), a, nearest);
+				a = _mm_unpacklo_epi8(_mm_add_epi8(x, _mm_packus_epi16(nearest, nearest)), zero);
+				store4(dst + i, _mm_packus_epi16(a, a));
+				c = b;
+			}
+			return;
+		}
+#endif
+		for (; i < (size_t)bpp; ++i)
+			dst[i] = src[i] + prev[i];
+		for (; i < row_bytes; ++i)
+			dst[i] = src[i] + paeth(dst[i - bpp], prev[i], prev[i - bpp]);
+		return;
+	}
+}
+
+inline uint32_t readU32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+
+} //namespace
+
+// PNG *********************************
+
+bool decodePNGFast(Image* image, const unsigned char* data, size_t size, bool flip_y)
+{
+	static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	if (size < 33 || memcmp(data, signature, 8) != 0)
+		return false;
+
+	uint32_t width = 0, height = 0;
+	int depth = 0, color_type = 0, interlace = 0;
+	uint8_t palette[256 * 4];
+	memset(palette, 255, sizeof(palette));
+	int trns_key[3] = { -1, -1, -1 }; //transparent color for gray and rgb images
+
+	//idat chunks are concatenated only if there are several
+	const uint8_t* idat = NULL;
+	size_t idat_size = 0;
+	std::vector<uint8_t> idat_buffer;
+
+	const uint8_t* p = data + 8;
+	const uint8_t* end = data + size;
+	while (p + 12 <= end)
+	{
+		uint32_t length = readU32(p);
+		const uint8_t* type = p + 4;
+		const uint8_t* chunk = p + 8;
+		if (length > (size_t)(end - chunk) - 4)
+			return false;
+
+		if (!memcmp(type, "IHDR", 4))
+		{
+			width = readU32(chunk);
+			height = readU32(chunk + 4);
+			depth = chunk[8];
+			color_type = chunk[9];
+			interlace = chunk[12];
+		}
+		else if (!memcmp(type, "PLTE", 4))
+		{
+			for (uint32_t i = 0; i < length / 3 && i < 256; ++i)
+				memcpy(palette + i * 4, chunk + i * 3, 3);
+		}
+		else if (!memcmp(type, "tRNS", 4))
+		{
+			if (color_type == 3)
+				for (uint32_t i = 0; i < length && i < 256; ++i)
+					palette[i * 4 + 3] = chunk[i];
+			else if (color_type == 0 && length >= 2)
+				trns_key[0] = trns_key[1] = trns_key[2] = chunk[1];
+			else if (color_type == 2 && length >= 6)
+				for (int i = 0; i < 3; ++i)
+					trns_key[i] = chunk[i * 2 + 1];
+		}
+		else if (!memcmp(type, "IDAT", 4))
+		{
+			if (!idat)
+			{
+				idat = chunk;
+				idat_size = length;
+			}
+			else
+			{
+				if (idat_buffer.empty())
+					idat_buffer.assign(idat, idat + idat_size);
+				idat_buffer.insert(idat_buffer.end(), chunk, chunk + length);
+			}
+		}
+		else if (!memcmp(type, "IEND", 4))
+			break;
+
+		p = chunk + length + 4; //skip crc
+	}
+
+	//only the usual formats, the rest goes through picopng
+	if (!idat || !width || !height || depth != 8 || interlace != 0)
+		return false;
+	int channels = 0;
+	switch (color_type)
+	{
+		case 0: channels = 1; break; //gray
+		case 2: channels = 3; break; //rgb
+		case 3: channels = 1; break; //palette
+		case 4: channels = 2; break; //gray + alpha
+		case 6: channels = 4; break; //rgba
+		default: return false;
+	}
+	if (!idat_buffer.empty())
+	{
+		idat = &idat_buffer[0];
+		idat_size = idat_buffer.size();
+	}
+
+	size_t row_bytes = (size_t)width * channels;
+	//not a vector, it would clear the memory before inflating over it
+	size_t filtered_size = height * (row_bytes + 1);
+	std::unique_ptr<uint8_t[]> filtered(new uint8_t[filtered_size]);
+	if (!inflateZlib(idat, idat_size, filtered.get(), filtered_size))
+		return false;
+
+	image->clear();
+	image->width = width;
+	image->height = height;
+	image->bytes_per_pixel = 4;
+	image->data = new Uint8[(size_t)width * height * 4];
+
+	//rgba rows are unfiltered in their final place, the previous row is the one written before
+	size_t out_stride = (size_t)width * 4;
+	std::vector<uint8_t> zeros(row_bytes, 0);
+	std::vector<uint8_t> rows(color_type == 6 ? 0 : row_bytes * 2);
+	const uint8_t* prev = &zeros[0];
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const uint8_t* src = filtered.get() + y * (row_bytes + 1);
+		uint8_t* out = image->data + (flip_y ? height - 1 - y : y) * out_stride;
+		int filter = src[0];
+		if (filter > 4)
+		{
+			image->clear();
+			return false;
+		}
+
+		if (color_type == 6)
+		{
+			unfilterRow(out, src + 1, prev, filter, 4, row_bytes);
+			prev = out;
+			continue;
+		}
+
+		uint8_t* row = &rows[(y & 1) * row_bytes];
+		unfilterRow(row, src + 1, prev, filter, channels, row_bytes);
+		prev = row;
+
+		switch (color_type)
+		{
+		case 0:
+			for (uint32_t x = 0; x < width; ++x, out += 4)
+			{
+				out[0] = out[1] = out[2] = row[x];
+				out[3] = row[x] == trns_key[0] ? 0 : 255;
+			}
+			break;
+		case 2:
+			for (uint32_t x = 0; x < width; ++x, out += 4)
+			{
+				const uint8_t* c = row + x * 3;
+				out[0] = c[0]; out[1] = c[1]; out[2] = c[2];
+				out[3] = (c[0] == trns_key[0] && c[1] == trns_key[1] && c[2] == trns_key[2]) ? 0 : 255;
+			}
+			break;
+		case 3:
+			for (uint32_t x = 0; x < width; ++x, out += 4)
+				memcpy(out, palette + row[x] * 4, 4);
+			break;
+		case 4:
+			for (uint32_t x = 0; x < width; ++x, out += 4)
+			{
+				out[0] = out[1] = out[2] = row[x * 2];
+				out[3] = row[x * 2 + 1];
+			}
+			break;
+		}
+	}
+
+	return true;
+}
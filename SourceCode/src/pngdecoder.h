@@ -0,0 +1,15 @@
+/*  Fast PNG decoder for the common case (8 bits per channel, not interlaced).
+	It inflates and unfilters straight into the RGBA image, writing the rows already flipped if needed.
+	Returns false for the formats it doesnt handle so the caller can fallback to picopng.
+*/
+
+#ifndef PNGDECODER_H
+#define PNGDECODER_H
+
+#include <cstddef>
+
+class Image;
+
+bool decodePNGFast(Image* image, const unsigned char* data, size_t size, bool flip_y);
+
+#endif
@@ -0,0 +1,490 @@
+#include "reflectionprobe.h"
+#include "scenenode.h"
+#include "material.h"
+#include "mesh.h"
+#include "shader.h"
+#include "texture.h"
+#include "camera.h"
+#include "environment.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+std::vector<ReflectionProbe*> ReflectionProbe::probes;
+int ReflectionProbe::max_updates_per_frame = 1;
+int ReflectionProbe::max_checks_per_frame = 4;
+float ReflectionProbe::max_enclosing_size = 0.25f;
+ReflectionProbe* ReflectionProbe::rendering = NULL;
+const sProbeBlend* ReflectionProbe::node_blend = NULL;
+int ReflectionProbe::next_check = 0;
+unsigned int ReflectionProbe::probes_signature = 1;
+std::map<Shader*, Shader*> ReflectionProbe::s_variants;
+std::map<int, Texture*> ReflectionProbe::s_captures;
+
+static const char* layered_macros = "#version 430 compatibility\n#define USE_LAYERED_CUBEMAP\n";
+
+//view direction and up of every face, in GL order
+static const Vector3 face_directions[6] = { Vector3(1, 0, 0), Vector3(-1, 0, 0), Vector3(0, 1, 0), Vector3(0, -1, 0), Vector3(0, 0, 1), Vector3(0, 0, -1) };
+static const Vector3 face_ups[6] = { Vector3(0, -1, 0), Vector3(0, -1, 0), Vector3(0, 0, 1), Vector3(0, 0, -1), Vector3(0, -1, 0), Vector3(0, -1, 0) };
+
+//FNV-1a
+static unsigned int hashBytes(unsigned int hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+ReflectionProbe::ReflectionProbe(const Vector3& position, float radius, int size)
+{
+	this->name = "Probe " + std::to_string(probes.size());
+	this->position = position;
+	this->radius = radius;
+	this->size = size;
+	dirty = true;
+	valid = true;
+	last_update = -1;
+	signature = 0;
+
+	//the storage of all the faces and mips, prefiltered after rendering. R11F_G11F_B10F is always color renderable, RGB16F not
+	Uint8* faces[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	cubemap = new Texture();
+	cubemap->createCubemap(size, size, faces, GL_RGB, GL_HALF_FLOAT, true, GL_R11F_G11F_B10F);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap->texture_id);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (int)getMaxLod());
+
+	glGenTextures(1, &depth_id);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, depth_id);
+	for (int i = 0; i < 6; ++i)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	//checked once with the first face, the probe is never rendered nor used if the driver cannot render to it
+	glGenFramebuffers(1, &fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, cubemap->texture_id, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, depth_id, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "[ERROR] ReflectionProbe: " << name << " framebuffer incomplete (0x" << std::hex << status << std::dec << "), disabled" << std::endl;
+		valid = false;
+		dirty = false;
+	}
+	probes.push_back(this);
+}
+
+ReflectionProbe::~ReflectionProbe()
+{
+	delete cubemap;
+	glDeleteTextures(1, &depth_id);
+	glDeleteFramebuffers(1, &fbo_id);
+	probes.erase(std::remove(probes.begin(), probes.end(), this), probes.end());
+}
+
+float ReflectionProbe::getWeight(const Vector3& point)
+{
+	return std::max(0.0f, 1.0f - position.distance(point) / radius);
+}
+
+bool ReflectionProbe::isLayeredSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		supported = getGLVersion() >= 43 && (hasGLExtension("GL_ARB_shader_viewport_layer_array") || hasGLExtension("GL_AMD_vertex_shader_layer")) ? 1 : 0;
+		if (!supported)
+			std::cout << " * ReflectionProbe: gl_Layer cannot be written from the vertex shader, the faces are rendered one by one" << std::endl;
+	}
+	return supported == 1;
+}
+
+Shader* ReflectionProbe::getVariant(Shader* shader)
+{
+	auto it = s_variants.find(shader);
+	if (it != s_variants.end())
+		return it->second;
+
+	//only compiled once, the nodes without it are rendered face by face
+	Shader* variant = shader->getVariant(layered_macros);
+	if (variant && variant->getUniformLocation("u_face_viewprojection") == -1)
+		variant = NULL; //the vertex shader doesnt support USE_LAYERED_CUBEMAP
+	s_variants[shader] = variant;
+	return variant;
+}
+
+//the nodes touching the radius, with what changes how they look from the probe
+unsigned int ReflectionProbe::computeSignature(std::vector<SceneNode*>& nodes)
+{
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		SceneNode* node = nodes[i];
+		if (!node->material || !node->mesh)
+			continue;
+		BoundingBox box = transformBoundingBox(node->model, node->mesh->box);
+		if (box.center.distance(position) > radius + box.halfsize.length())
+			continue;
+		hash = hashBytes(hash, &node, sizeof(node));
+		hash = hashBytes(hash, &node->material, sizeof(node->material));
+		hash = hashBytes(hash, &node->mesh, sizeof(node->mesh));
+		hash = hashBytes(hash, node->model.m, sizeof(node->model.m));
+		hash = hashBytes(hash, &node->material->color, sizeof(node->material->color));
+	}
+	return hash;
+}
+
+void ReflectionProbe::render(std::vector<SceneNode*>& nodes)
+{
+	rendering = this;
+
+	Camera cameras[6];
+	Matrix44 viewprojections[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		cameras[i].setPerspective(90.0f, 1.0f, 0.1f, 1000.0f);
+		cameras[i].lookAt(position, position + face_directions[i], face_ups[i]);
+		viewprojections[i] = cameras[i].viewprojection_matrix;
+	}
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glViewport(0, 0, size, size);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	//the nodes go to the capture and the levels of the cubemap are prefiltered from it
+	Texture* capture = getCapture(size);
+
+	//the environment behind the nodes, a probe without it would darken the reflections of the sky
+	Shader* background = NULL;
+	if (Environment::current && Environment::current->cubemap)
+		background = Shader::Get("data/shaders/basic.vs", "data/shaders/environment.fs");
+
+	//a small node around the probe (ex: the object that holds it) is skipped, it would only show its inside.
+	//The big ones around it (a room, the level) are what it has to reflect
+	std::vector<SceneNode*> face_nodes;
+	std::vector<SceneNode*> layered_nodes;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		SceneNode* node = nodes[i];
+		if (!node->material || !node->mesh || !node->material->shader)
+			continue;
+		BoundingBox box = transformBoundingBox(node->model, node->mesh->box);
+		Vector3 delta = position - box.center;
+		bool around = fabsf(delta.x) < box.halfsize.x && fabsf(delta.y) < box.halfsize.y && fabsf(delta.z) < box.halfsize.z;
+		if (around && box.halfsize.length() < radius * max_enclosing_size)
+			continue;
+		if (isLayeredSupported() && node->batchable && node->material->canBatch() && getVariant(node->material->shader))
+			layered_nodes.push_back(node);
+		else
+			face_nodes.push_back(node);
+	}
+
+	//all the faces at once, every draw has an instance per face that writes its layer
+	bool layered = isLayeredSupported() && (!background || getVariant(background));
+	if (layered)
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, capture->texture_id, 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_id, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		if (background)
+			renderBackground(getVariant(background), &cameras[0], viewprojections);
+		for (size_t i = 0; i < layered_nodes.size(); ++i)
+		{
+			SceneNode* node = layered_nodes[i];
+			Shader* variant = getVariant(node->material->shader);
+			variant->enable();
+			node->material->setUniforms(&cameras[0], node->model, variant);
+			variant->setMatrix44Array("u_face_viewprojection", viewprojections, 6);
+			node->mesh->render(GL_TRIANGLES, 0, 6);
+			variant->disable();
+		}
+	}
+
+	//the rest one face after another
+	if (!layered || face_nodes.size())
+		for (int i = 0; i < 6; ++i)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, capture->texture_id, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, depth_id, 0);
+			if (!layered)
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				if (background)
+					renderBackground(background, &cameras[i], NULL);
+			}
+			for (size_t j = 0; j < face_nodes.size(); ++j)
+				face_nodes[j]->render(&cameras[i]);
+		}
+
+	//the box filtered mips are the source of the wide lobes
+	capture->generateMipmaps();
+	prefilter(capture, cameras, layered ? viewprojections : NULL);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	signature = computeSignature(nodes);
+	dirty = false;
+	rendering = NULL;
+}
+
+void ReflectionProbe::renderBackground(Shader* shader, Camera* camera, Matrix44* viewprojections)
+{
+	shader->enable();
+	shader->setUniform("u_texture", Environment::current->cubemap, 0);
+	renderCube(shader, camera, viewprojections);
+	shader->disable();
+}
+
+void ReflectionProbe::renderCube(Shader* shader, Camera* camera, Matrix44* viewprojections)
+{
+	static Mesh* cube = NULL;
+	if (!cube)
+	{
+		cube = new Mesh();
+		cube->createCube();
+	}
+
+	//a cube around the probe inside the near and far planes, without depth so the nodes cover it
+	Matrix44 model;
+	model.setScale(10.0f, 10.0f, 10.0f);
+	model.m[12] = position.x;
+	model.m[13] = position.y;
+	model.m[14] = position.z;
+
+	GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	shader->setUniform("u_model", model);
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_camera_position", position);
+	if (viewprojections)
+	{
+		shader->setMatrix44Array("u_face_viewprojection", viewprojections, 6);
+		cube->render(GL_TRIANGLES, 0, 6);
+	}
+	else
+		cube->render(GL_TRIANGLES);
+	glEnable(GL_DEPTH_TEST);
+	if (cull_face)
+		glEnable(GL_CULL_FACE);
+}
+
+Texture* ReflectionProbe::getCapture(int size)
+{
+	//one per size, the probes are rendered one after another
+	auto it = s_captures.find(size);
+	if (it != s_captures.end())
+		return it->second;
+	Uint8* faces[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	Texture* capture = new Texture();
+	capture->createCubemap(size, size, faces, GL_RGB, GL_HALF_FLOAT, true, GL_R11F_G11F_B10F);
+	s_captures[size] = capture;
+	return capture;
+}
+
+void ReflectionProbe::prefilter(Texture* capture, Camera* cameras, Matrix44* viewprojections)
+{
+	//the same roughness per level as the environment (level / max lod), so both blur the same when blended
+	Shader* shader = Shader::Get("data/shaders/basic.vs", "data/shaders/prefilter.fs");
+	if (viewprojections)
+		shader = getVariant(shader);
+	if (!shader)
+		return;
+
+	int max_lod = (int)getMaxLod();
+	shader->enable();
+	shader->setUniform("u_texture", capture, 0);
+	shader->setUniform("u_size", (float)size);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0); //the levels are smaller, and no depth is needed
+	for (int level = 0; level <= max_lod; ++level)
+	{
+		glViewport(0, 0, std::max(1, size >> level), std::max(1, size >> level));
+		shader->setUniform("u_roughness", max_lod ? level / (float)max_lod : 0.0f);
+		if (viewprojections)
+		{
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cubemap->texture_id, level);
+			renderCube(shader, &cameras[0], viewprojections);
+		}
+		else
+			for (int i = 0; i < 6; ++i)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemap->texture_id, level);
+				renderCube(shader, &cameras[i], NULL);
+			}
+	}
+	shader->disable();
+}
+
+void ReflectionProbe::update(std::vector<SceneNode*>& nodes)
+{
+	updateProbesSignature();
+	if (probes.empty())
+		return;
+
+	//a few of them compare their nodes every frame, the new ones are dirty already
+	int num_checks = std::min(max_checks_per_frame, (int)probes.size());
+	for (int i = 0; i < num_checks; ++i)
+	{
+		ReflectionProbe* probe = probes[next_check++ % probes.size()];
+		if (probe->valid && !probe->dirty && probe->computeSignature(nodes) != probe->signature)
+			probe->dirty = true;
+	}
+	next_check %= probes.size();
+
+	//the dirty ones that waited more go first
+	long time = getTime();
+	for (int i = 0; i < max_updates_per_frame; ++i)
+	{
+		ReflectionProbe* oldest = NULL;
+		for (size_t j = 0; j < probes.size(); ++j)
+			if (probes[j]->dirty && (!oldest || probes[j]->last_update < oldest->last_update))
+				oldest = probes[j];
+		if (!oldest)
+			break;
+		oldest->render(nodes);
+		oldest->last_update = time;
+	}
+
+	//the ones rendered for the first time are blended now
+	updateProbesSignature();
+}
+
+void ReflectionProbe::updateProbesSignature()
+{
+	//the blends of the nodes are computed again when it changes, never 0 so the new ones are always computed
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		ReflectionProbe* probe = probes[i];
+		bool blended = probe->valid && probe->last_update != -1;
+		hash = hashBytes(hash, &probe, sizeof(probe));
+		hash = hashBytes(hash, &probe->position, sizeof(probe->position));
+		hash = hashBytes(hash, &probe->radius, sizeof(probe->radius));
+		hash = hashBytes(hash, &blended, sizeof(blended));
+	}
+	probes_signature = hash | 1;
+}
+
+int ReflectionProbe::getNearest(const Vector3& point, ReflectionProbe** nearest, float* weights, int max)
+{
+	int count = 0;
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		ReflectionProbe* probe = probes[i];
+		float weight = probe->getWeight(point);
+		if (weight <= 0.0f || probe->last_update == -1 || !probe->valid)
+			continue;
+
+		//sorted insertion, the smallest falls out when they are max already
+		if (count < max)
+			count++;
+		else if (weight <= weights[max - 1])
+			continue;
+		int j = count - 1;
+		for (; j > 0 && weights[j - 1] < weight; --j)
+		{
+			nearest[j] = nearest[j - 1];
+			weights[j] = weights[j - 1];
+		}
+		nearest[j] = probe;
+		weights[j] = weight;
+	}
+
+	//overlapping probes share the point
+	float total = 0.0f;
+	for (int i = 0; i < count; ++i)
+		total += weights[i];
+	if (total > 1.0f)
+		for (int i = 0; i < count; ++i)
+			weights[i] /= total;
+	return count;
+}
+
+bool ReflectionProbe::isCurrent(const sProbeBlend& blend, const Vector3& point)
+{
+	return blend.probes_signature == probes_signature && blend.point.x == point.x && blend.point.y == point.y && blend.point.z == point.z;
+}
+
+const sProbeBlend& ReflectionProbe::getBlend(sProbeBlend& blend, const Vector3& point)
+{
+	if (isCurrent(blend, point))
+		return blend;
+	blend = sProbeBlend();
+	getNearest(point, blend.probes, blend.weights, 2);
+	blend.point = point;
+	blend.probes_signature = probes_signature;
+	return blend;
+}
+
+sProbeBlend ReflectionProbe::getBlend(const Vector3& point)
+{
+	if (node_blend && isCurrent(*node_blend, point))
+		return *node_blend;
+	sProbeBlend blend;
+	return getBlend(blend, point);
+}
+
+float ReflectionProbe::getMaxLod()
+{
+	return std::max(0.0f, log2f((float)size) - 3.0f);
+}
+
+void ReflectionProbe::bind(Shader* shader, const Vector3& point, int first_slot)
+{
+	if (shader->getUniformLocation("u_probe_weights") == -1)
+		return;
+	sProbeBlend blend;
+	if (!rendering)
+		blend = getBlend(point);
+
+	float max_lods[2] = { 0.0f, 0.0f };
+	for (int i = 0; i < 2; ++i)
+		if (blend.probes[i])
+		{
+			shader->setUniform(i == 0 ? "u_probe_0" : "u_probe_1", blend.probes[i]->cubemap, first_slot + i);
+			max_lods[i] = blend.probes[i]->getMaxLod();
+		}
+	shader->setUniform("u_probe_weights", Vector2(blend.weights[0], blend.weights[1]));
+	shader->setUniform("u_probe_max_lods", Vector2(max_lods[0], max_lods[1]));
+}
+
+void ReflectionProbe::renderMenu()
+{
+	ImGui::Text(isLayeredSupported() ? "Six faces per pass" : "One face per pass");
+	ImGui::SliderInt("Updates per frame", &max_updates_per_frame, 0, 8);
+	ImGui::SliderInt("Checks per frame", &max_checks_per_frame, 1, 32);
+	if (ImGui::Button("Add probe"))
+		new ReflectionProbe(Vector3(), 10.0f);
+
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		ReflectionProbe* probe = probes[i];
+		if (!ImGui::TreeNode(probe, "%s", probe->name.c_str()))
+			continue;
+		//moving it changes what it sees
+		if (ImGui::DragFloat3("Position", (float*)&probe->position, 0.1f))
+			probe->dirty = probe->valid;
+		ImGui::DragFloat("Radius", &probe->radius, 0.1f, 0.1f, 1000.0f);
+		ImGui::Text(!probe->valid ? "Disabled" : probe->dirty ? "Dirty" : "Up to date");
+		if (ImGui::Button("Update"))
+			probe->dirty = probe->valid;
+		ImGui::SameLine();
+		bool remove = ImGui::Button("Remove");
+		ImGui::TreePop();
+		if (remove)
+		{
+			delete probe;
+			break;
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/*  Reflection probes: cubemaps of the scene rendered from a point, so the materials around it reflect the nodes and not only the environment.
+	The six faces are rendered in one pass when the vertex shader can write gl_Layer (every draw is instanced once per face), if not one face after another.
+	The updates are time sliced: every frame a few probes compare the nodes inside their radius with the ones they were rendered with,
+	and only max_updates_per_frame of the dirty ones are rendered, so a frame costs the same with any number of probes.
+	The nodes are drawn over the current environment in a capture cubemap, and the levels of the probe are prefiltered from it
+	with the GGX lobe of their roughness like the HDRE levels, so both blend with the same blur.
+	Every node keeps the probes it blends (sProbeBlend), they are only searched again when the node or the probes move.
+*/
+
+#ifndef REFLECTIONPROBE_H
+#define REFLECTIONPROBE_H
+
+#include "includes.h"
+#include "framework.h"
+
+#include <vector>
+#include <map>
+#include <string>
+
+class Texture;
+class Shader;
+class SceneNode;
+class Camera;
+class ReflectionProbe;
+
+//the probes blended at a point, the biggest weight first
+struct sProbeBlend {
+	ReflectionProbe* probes[2]; //NULL if there are less
+	float weights[2]; //the environment gets the rest
+	Vector3 point;
+	unsigned int probes_signature; //of the probes when it was computed, 0 if never
+
+	sProbeBlend() { probes[0] = probes[1] = NULL; weights[0] = weights[1] = 0.0f; probes_signature = 0; }
+};
+
+class ReflectionProbe
+{
+public:
+	static std::vector<ReflectionProbe*> probes;
+	static int max_updates_per_frame; //probes rendered in a frame
+	static int max_checks_per_frame; //probes whose nodes are compared in a frame
+	static float max_enclosing_size; //the nodes around a probe are not rendered in it if their half size is smaller than this fraction of the radius
+	static ReflectionProbe* rendering; //while a probe is rendered the materials only use the environment, it cannot read itself
+	static const sProbeBlend* node_blend; //of the node being rendered, set by SceneNode::render so the materials dont search them
+
+	std::string name;
+	Vector3 position;
+	float radius; //the materials inside blend it, the changes of the nodes inside make it dirty
+	int size;
+	Texture* cubemap; //R11F_G11F_B10F, its mips are prefiltered with GGX like the levels of the environment (up to getMaxLod)
+	bool dirty;
+	bool valid; //false if its framebuffer is not complete, then it is skipped
+	long last_update; //time it was rendered (getTime), -1 if never
+
+	ReflectionProbe(const Vector3& position, float radius, int size = 128);
+	~ReflectionProbe();
+
+	float getWeight(const Vector3& point); //1 in the center to 0 at the radius
+
+	//checks and renders the probes of this frame, before the scene is rendered
+	static void update(std::vector<SceneNode*>& nodes);
+	//up to max probes with weight at point, the biggest first. Returns how many, the environment gets the rest of the weight
+	static int getNearest(const Vector3& point, ReflectionProbe** nearest, float* weights, int max = 2);
+	//the blend of a node, searched again only if the point or the probes changed since it was computed
+	static const sProbeBlend& getBlend(sProbeBlend& blend, const Vector3& point);
+	//the one of node_blend if it is for the point, if not they are searched
+	static sProbeBlend getBlend(const Vector3& point);
+	//u_probe_0 and u_probe_1 (in first_slot and the next), u_probe_weights and u_probe_max_lod for the point.
+	//Nothing for the DrawBatch variants, they read the probes of every draw from the draw data
+	static void bind(Shader* shader, const Vector3& point, int first_slot);
+	float getMaxLod(); //the same mip sizes as the environment, down to 8 pixels
+	static bool isLayeredSupported();
+	static void renderMenu();
+
+private:
+	static int next_check; //round robin of the checks
+	static unsigned int probes_signature; //of the positions, radius and state of all the probes, updated every frame
+	static std::map<Shader*, Shader*> s_variants; //layered version of the material shaders, NULL if not supported
+	static std::map<int, Texture*> s_captures; //the nodes are rendered there (with box filtered mips) before the prefilter, one per size
+
+	GLuint fbo_id;
+	GLuint depth_id; //depth cubemap, so both attachments are layered
+	unsigned int signature; //of the nodes inside the radius when it was rendered
+
+	unsigned int computeSignature(std::vector<SceneNode*>& nodes);
+	static void updateProbesSignature();
+	static bool isCurrent(const sProbeBlend& blend, const Vector3& point);
+	void render(std::vector<SceneNode*>& nodes);
+	void renderBackground(Shader* shader, Camera* camera, Matrix44* viewprojections); //in all the faces if viewprojections (layered)
+	void renderCube(Shader* shader, Camera* camera, Matrix44* viewprojections); //around the probe with the shader enabled
+	void prefilter(Texture* capture, Camera* cameras, Matrix44* viewprojections); //every level of the cubemap with the GGX lobe of its roughness
+	static Texture* getCapture(int size);
+	static Shader* getVariant(Shader* shader);
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "rgbe.h"
+#include "envbaker.h"
+#include "imagekernels.h"
+#include "threadpool.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+const float PI = 3.14159265358979f;
+const int TILE_SIZE = 32; //texels of a face per job
+
+//2^(e - 136): the mantissas are bytes, an exponent of 0 is black
+struct sExponents {
+	float scale[256];
+	sExponents()
+	{
+		scale[0] = 0.0f;
+		for (int e = 1; e < 256; ++e)
+			scale[e] = ldexpf(1.0f, e - 136);
+	}
+};
+
+const sExponents exponents;
+
+inline void decodeRGBE(const unsigned char* p, float* rgb)
+{
+	float scale = exponents.scale[p[3]];
+	rgb[0] = p[0] * scale;
+	rgb[1] = p[1] * scale;
+	rgb[2] = p[2] * scale;
+}
+
+//flat pixels, with the runs of the old RLE (1,1,1,count repeats the previous pixel)
+bool readFlatScanline(FILE* f, unsigned char* dst, unsigned int width, const unsigned char* first)
+{
+	unsigned char pixel[4];
+	memcpy(pixel, first, 4);
+	unsigned int x = 0, shift = 0;
+	while (true)
+	{
+		if (pixel[0] == 1 && pixel[1] == 1 && pixel[2] == 1 && x > 0)
+		{
+			unsigned int count = (unsigned int)pixel[3] << shift;
+			if (x + count > width)
+				return false;
+			for (unsigned int i = 0; i < count; ++i, ++x)
+				memcpy(dst + x * 4, dst + (x - 1) * 4, 4);
+			shift += 8;
+		}
+		else
+		{
+			memcpy(dst + x * 4, pixel, 4);
+			++x;
+			shift = 0;
+		}
+		if (x == width)
+			return true;
+		if (fread(pixel, 1, 4, f) != 4)
+			return false;
+	}
+}
+
+//the new RLE stores the 4 components of a scanline one after another, each with its runs
+bool readScanline(FILE* f, unsigned char* dst, unsigned int width, std::vector<unsigned char>& planes)
+{
+	unsigned char rgbe[4];
+	if (fread(rgbe, 1, 4, f) != 4)
+		return false;
+	if (width < 8 || width > 0x7fff || rgbe[0] != 2 || rgbe[1] != 2 || (rgbe[2] & 0x80))
+		return readFlatScanline(f, dst, width, rgbe);
+	if (((unsigned int)rgbe[2] << 8 | rgbe[3]) != width)
+		return false;
+
+	for (int c = 0; c < 4; ++c)
+	{
+		unsigned char* plane = &planes[c * width];
+		unsigned int x = 0;
+		while (x < width)
+		{
+			int count = getc(f);
+			if (count == EOF || count == 0)
+				return false;
+			if (count > 128)
+			{
+				count -= 128;
+				int value = getc(f);
+				if (value == EOF || x + count > width)
+					return false;
+				memset(plane + x, value, count);
+			}
+			else if (x + count > width || fread(plane + x, 1, count, f) != (size_t)count)
+				return false;
+			x += count;
+		}
+	}
+
+	for (unsigned int x = 0; x < width; ++x)
+		for (int c = 0; c < 4; ++c)
+			dst[x * 4 + c] = planes[c * width + x];
+	return true;
+}
+
+//the same mapping as the environment baker, decoding the RGBE pixels
+void sampleEquirect(const RGBEImage& image, const float* dir, float* rgb)
+{
+	const unsigned char* data = &image.data[0];
+	int width = image.width;
+	::sampleEquirect(image.width, image.height, dir, rgb, [data, width](int x, int y, float* p) {
+		decodeRGBE(data + ((size_t)y * width + x) * 4, p);
+	});
+}
+
+inline void storeRow(const float* src, float* dst, size_t count)
+{
+	memcpy(dst, src, count * sizeof(float));
+}
+
+inline void storeRow(const float* src, unsigned short* dst, size_t count)
+{
+	floatToHalf(src, dst, count);
+}
+
+//one job per tile, the rows of a tile are resampled in a small buffer and stored in the faces already converted
+template<typename T>
+void resampleCubemap(const RGBEImage& image, int size, T** faces)
+{
+	int taps = std::max(1, std::min(4, (int)ceilf(image.width / (4.0f * size))));
+	int tiles = (size + TILE_SIZE - 1) / TILE_SIZE;
+	ThreadPool::getDefault()->parallelFor(tiles * tiles * 6, [&](int job) {
+		int face = job / (tiles * tiles);
+		int tile_x = (job % tiles) * TILE_SIZE;
+		int tile_y = (job / tiles % tiles) * TILE_SIZE;
+		int tile_width = std::min(TILE_SIZE, size - tile_x);
+		int tile_height = std::min(TILE_SIZE, size - tile_y);
+
+		float row[TILE_SIZE * 3];
+		for (int y = tile_y; y < tile_y + tile_height; ++y)
+		{
+			for (int x = 0; x < tile_width; ++x)
+			{
+				float sum[3] = { 0.0f, 0.0f, 0.0f };
+				for (int j = 0; j < taps; ++j)
+					for (int i = 0; i < taps; ++i)
+					{
+						float dir[3], rgb[3];
+						getCubemapDirection(face, tile_x + x + (i + 0.5f) / taps, y + (j + 0.5f) / taps, size, dir);
+						sampleEquirect(image, dir, rgb);
+						sum[0] += rgb[0]; sum[1] += rgb[1]; sum[2] += rgb[2];
+					}
+				for (int c = 0; c < 3; ++c)
+					row[x * 3 + c] = sum[c] / (taps * taps);
+			}
+			storeRow(row, faces[face] + ((size_t)y * size + tile_x) * 3, tile_width * 3);
+		}
+	});
+}
+
+}
+
+RGBEImage::RGBEImage()
+{
+	width = height = 0;
+}
+
+bool RGBEImage::load(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] RGBE: file not found '" << filename << "'" << std::endl;
+		return false;
+	}
+
+	//text header until an empty line, then the resolution
+	char line[256];
+	bool ok = fgets(line, sizeof(line), f) && strncmp(line, "#?", 2) == 0;
+	while (ok)
+	{
+		ok = fgets(line, sizeof(line), f) != NULL;
+		if (!ok || line[0] == '\n' || line[0] == '\r')
+			break;
+		if (strncmp(line, "FORMAT=", 7) == 0 && strncmp(line + 7, "32-bit_rle_rgbe", 15) != 0)
+			ok = false;
+	}
+	int w = 0, h = 0;
+	if (!ok || !fgets(line, sizeof(line), f) || sscanf(line, "-Y %d +X %d", &h, &w) != 2 || w <= 0 || h <= 0)
+	{
+		std::cout << "[ERROR] RGBE: '" << filename << "' is not a radiance RGBE file with -Y +X orientation" << std::endl;
+		fclose(f);
+		return false;
+	}
+
+	width = w;
+	height = h;
+	data.resize((size_t)width * height * 4);
+	std::vector<unsigned char> planes(width * 4);
+	for (unsigned int y = 0; y < height && ok; ++y)
+		ok = readScanline(f, &data[(size_t)y * width * 4], width, planes);
+	fclose(f);
+
+	if (!ok)
+	{
+		std::cout << "[ERROR] RGBE: '" << filename << "' is truncated or corrupted" << std::endl;
+		width = height = 0;
+		data.clear();
+		return false;
+	}
+	return true;
+}
+
+void RGBEImage::getPixel(unsigned int x, unsigned int y, float* rgb) const
+{
+	decodeRGBE(&data[((size_t)y * width + x) * 4], rgb);
+}
+
+void equirectToCubemap(const RGBEImage& image, int size, float** faces)
+{
+	resampleCubemap(image, size, faces);
+}
+
+void equirectToCubemap(const RGBEImage& image, int size, unsigned short** faces)
+{
+	resampleCubemap(image, size, faces);
+}
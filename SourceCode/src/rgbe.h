@@ -0,0 +1,30 @@
+/*  Radiance HDR (.hdr) images: the pixels are kept as RGBE (a shared exponent, 4 bytes per pixel like in the file), a third of
+	the size of the floats, and the file is decoded one scanline at a time (flat or RLE) straight into them.
+	The equirect to cubemap resampler decodes only the texels it reads: the faces are split in tiles between the threads and
+	written as floats or half floats, so the result goes to Texture::createCubemap or an HDRE without a float copy of the image.
+	It doesnt use GL so it can run in any thread.
+*/
+
+#ifndef RGBE_H
+#define RGBE_H
+
+#include <vector>
+
+class RGBEImage
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> data; //RGBE, the first row is up (+Y) in an equirect
+
+	RGBEImage();
+
+	bool load(const char* filename); //only the usual -Y height +X width orientation
+	void getPixel(unsigned int x, unsigned int y, float* rgb) const;
+};
+
+//faces: 6 faces (GL order) of size x size RGB texels. Bilinear, with up to 4x4 samples per texel when the image is bigger than the faces
+void equirectToCubemap(const RGBEImage& image, int size, float** faces);
+void equirectToCubemap(const RGBEImage& image, int size, unsigned short** faces); //GL_HALF_FLOAT
+
+#endif
@@ -23,8 +23,16 @@ SceneNode::~SceneNode()
 
 void SceneNode::render(Camera* camera)
 {
-	if (material)
-		material->render(mesh, model, camera);
+	if (!material)
+		return;
+
+	//the materials read the probes of the node instead of searching them
+	ReflectionProbe::node_blend = &ReflectionProbe::getBlend(probe_blend, model.getTranslation());
+	if (material->linear_output)
+		glEnable(GL_FRAMEBUFFER_SRGB);
+	material->render(mesh, model, camera);
+	glDisable(GL_FRAMEBUFFER_SRGB);
+	ReflectionProbe::node_blend = NULL;
 }
 
 void SceneNode::renderWireframe(Camera* camera)
@@ -59,12 +67,14 @@ void SceneNode::renderInMenu()
 Skybox::Skybox()
 {
 	this->name = std::string("Skybox");
+	batchable = false; //follows the camera without depth test
 
 	mesh = new Mesh();
 	mesh->createCube();
 	
 	material = new StandardMaterial();
 	material->shader = Shader::Get("data/shaders/basic.vs", "data/shaders/cubemap.fs");
+	material->linear_output = true;
 
 	model.scale(100, 100, 100);
 }
@@ -72,12 +82,14 @@ Skybox::Skybox()
 Skybox::Skybox(Texture * tex)
 {
 	this->name = std::string("Skybox");
+	batchable = false; //follows the camera without depth test
 
 	mesh = new Mesh();
 	mesh->createCube();
 
 	material = new StandardMaterial();
 	material->shader = Shader::Get("data/shaders/basic.vs", "data/shaders/cubemap.fs");
+	material->linear_output = true;
 	material->texture = tex;
 
 	model.scale(100, 100, 100);
@@ -95,7 +107,10 @@ void Skybox::render(Camera* camera)
 	if (mesh && material)
 	{
 		glDisable(GL_DEPTH_TEST);
+		if (material->linear_output)
+			glEnable(GL_FRAMEBUFFER_SRGB);
 		material->render(mesh, model, camera);
+		glDisable(GL_FRAMEBUFFER_SRGB);
 		glEnable(GL_DEPTH_TEST);
 	}
 }
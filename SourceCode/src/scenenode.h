@@ -7,6 +7,7 @@
 #include "mesh.h"
 #include "camera.h"
 #include "material.h"
+#include "reflectionprobe.h"
 
 
 class Light;
@@ -26,6 +27,9 @@ public:
 	Mesh* mesh = NULL;
 	Matrix44 model;
 
+	bool batchable = true; //can be submitted by the DrawBatch, false if render is customized
+	sProbeBlend probe_blend; //the reflection probes around it, updated when it or they move
+
 	Light* node_light;
 
 	virtual void render(Camera* camera);
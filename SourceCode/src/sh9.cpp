@@ -0,0 +1,145 @@
+#include "sh9.h"
+#include "envbaker.h"
+#include "threadpool.h"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SH9_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+inline void evalBasis(float x, float y, float z, float* basis)
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * y;
+	basis[2] = 0.488603f * z;
+	basis[3] = 0.488603f * x;
+	basis[4] = 1.092548f * x * y;
+	basis[5] = 1.092548f * y * z;
+	basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+	basis[7] = 1.092548f * x * z;
+	basis[8] = 0.546274f * (x * x - y * y);
+}
+
+//direction (not normalized) of the texel at sc,tc of a face, the same as getCubemapDirection
+inline void faceDirection(int face, float sc, float tc, float& x, float& y, float& z)
+{
+	switch (face)
+	{
+		case 0: x = 1.0f; y = -tc; z = -sc; break;
+		case 1: x = -1.0f; y = -tc; z = sc; break;
+		case 2: x = sc; y = 1.0f; z = tc; break;
+		case 3: x = sc; y = -1.0f; z = -tc; break;
+		case 4: x = sc; y = -tc; z = 1.0f; break;
+		default: x = -sc; y = -tc; z = -1.0f; break;
+	}
+}
+
+}
+
+void projectSH9(const float* const* faces, int size, int channels, float* coeffs)
+{
+	//27 coefficients and the total weight per row, added in double at the end
+	std::vector<float> rows((size_t)size * 6 * 28, 0.0f);
+	ThreadPool::getDefault()->parallelFor(size * 6, [&](int row) {
+		int face = row / size;
+		int y = row % size;
+		float* acc = &rows[(size_t)row * 28];
+		const float* pixels = faces[face] + (size_t)y * size * channels;
+		float tc = 2.0f * (y + 0.5f) / size - 1.0f;
+		float step = 2.0f / size;
+		int x = 0;
+#ifdef SH9_USE_SSE2
+		//4 texels per lane group, the directions only change in sc along a row
+		__m128 sum[28];
+		for (int i = 0; i < 28; ++i)
+			sum[i] = _mm_setzero_ps();
+		__m128 tc4 = _mm_set1_ps(tc), one = _mm_set1_ps(1.0f);
+		for (; x + 4 <= size; x += 4)
+		{
+			float sc0 = (x + 0.5f) * step - 1.0f;
+			__m128 sc = _mm_setr_ps(sc0, sc0 + step, sc0 + step * 2.0f, sc0 + step * 3.0f);
+			__m128 dx, dy, dz;
+			__m128 neg_sc = _mm_sub_ps(_mm_setzero_ps(), sc), neg_tc = _mm_sub_ps(_mm_setzero_ps(), tc4);
+			switch (face)
+			{
+				case 0: dx = one; dy = neg_tc; dz = neg_sc; break;
+				case 1: dx = _mm_set1_ps(-1.0f); dy = neg_tc; dz = sc; break;
+				case 2: dx = sc; dy = one; dz = tc4; break;
+				case 3: dx = sc; dy = _mm_set1_ps(-1.0f); dz = neg_tc; break;
+				case 4: dx = sc; dy = neg_tc; dz = one; break;
+				default: dx = neg_sc; dy = neg_tc; dz = _mm_set1_ps(-1.0f); break;
+			}
+			//1 + sc^2 + tc^2 is the squared length of the direction, the solid angle goes with its power -3/2
+			__m128 len2 = _mm_add_ps(one, _mm_add_ps(_mm_mul_ps(sc, sc), _mm_mul_ps(tc4, tc4)));
+			__m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(len2));
+			__m128 weight = _mm_mul_ps(inv_len, _mm_mul_ps(inv_len, inv_len));
+			dx = _mm_mul_ps(dx, inv_len);
+			dy = _mm_mul_ps(dy, inv_len);
+			dz = _mm_mul_ps(dz, inv_len);
+
+			__m128 basis[9];
+			basis[0] = _mm_set1_ps(0.282095f);
+			basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), dy);
+			basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), dz);
+			basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), dx);
+			basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dy));
+			basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dy, dz));
+			basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one));
+			basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dz));
+			basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+			const float* p = pixels + x * channels;
+			__m128 color[3];
+			for (int c = 0; c < 3; ++c)
+				color[c] = _mm_mul_ps(_mm_setr_ps(p[c], p[channels + c], p[channels * 2 + c], p[channels * 3 + c]), weight);
+			for (int i = 0; i < 9; ++i)
+				for (int c = 0; c < 3; ++c)
+					sum[i * 3 + c] = _mm_add_ps(sum[i * 3 + c], _mm_mul_ps(color[c], basis[i]));
+			sum[27] = _mm_add_ps(sum[27], weight);
+		}
+		for (int i = 0; i < 28; ++i)
+		{
+			float lanes[4];
+			_mm_storeu_ps(lanes, sum[i]);
+			acc[i] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		}
+#endif
+		for (; x < size; ++x)
+		{
+			float sc = (x + 0.5f) * step - 1.0f;
+			float dx, dy, dz;
+			faceDirection(face, sc, tc, dx, dy, dz);
+			float inv_len = 1.0f / sqrtf(1.0f + sc * sc + tc * tc);
+			float weight = inv_len * inv_len * inv_len;
+			float basis[9];
+			evalBasis(dx * inv_len, dy * inv_len, dz * inv_len, basis);
+			const float* p = pixels + x * channels;
+			for (int i = 0; i < 9; ++i)
+				for (int c = 0; c < 3; ++c)
+					acc[i * 3 + c] += p[c] * weight * basis[i];
+			acc[27] += weight;
+		}
+	});
+
+	double sum[28] = { 0.0 };
+	for (int row = 0; row < size * 6; ++row)
+		for (int i = 0; i < 28; ++i)
+			sum[i] += rows[(size_t)row * 28 + i];
+	for (int i = 0; i < 27; ++i)
+		coeffs[i] = (float)(sum[i] * 4.0 * PI / sum[27]);
+}
+
+void getSHDiffuse(const float* coeffs, float* diffuse)
+{
+	//cosine lobe of every band (PI, 2PI/3, PI/4) divided by PI
+	static const float bands[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+	for (int i = 0; i < 27; ++i)
+		diffuse[i] = coeffs[i] * bands[i / 3];
+}
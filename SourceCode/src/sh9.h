@@ -0,0 +1,17 @@
+/*  SH9: radiance projected on the first 9 real spherical harmonics (bands 0 to 2), enough to get the irradiance of a lambertian
+	surface from an environment with a small error (Ramamoorthi and Hanrahan). Same basis, order and scale as irradiance.fs and the
+	HDRE header: 9 RGB coefficients of the radiance. The projection weights every texel by its solid angle, the rows of the faces
+	are split between the threads and 4 texels are projected at once with SSE.
+*/
+
+#ifndef SH9_H
+#define SH9_H
+
+//faces: 6 faces (GL order) of size x size pixels with channels floats each, RGB first. coeffs gets 27 floats
+void projectSH9(const float* const* faces, int size, int channels, float* coeffs);
+
+//the coefficients of the lambertian diffuse (irradiance / PI): the bands scaled by the cosine lobe, so the shader only adds
+//the basis times them
+void getSHDiffuse(const float* coeffs, float* diffuse);
+
+#endif
@@ -56,6 +56,7 @@ std::map<std::string, std::string> Shader::s_shaders_atlas;
 std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+const char* Shader::attrib_names[Shader::NUM_ATTRIBS] = { "a_vertex", "a_normal", "a_uv", "a_color", "a_bones", "a_weights" };
 
 Shader::Shader()
 {
@@ -63,6 +64,9 @@ Shader::Shader()
 		Shader::init();
 	compiled = false;
 	from_atlas = false;
+	attrib_layout = 0;
+	for (int i = 0; i < NUM_ATTRIBS; ++i)
+		attrib_locations[i] = -1;
 }
 
 Shader::~Shader()
@@ -131,6 +135,15 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 	return sh;
 }
 
+Shader* Shader::getVariant(const char* variant_macros)
+{
+	//shaders from memory or from the atlas cannot be reloaded with other macros
+	if (from_atlas || vs_filename.empty() || ps_filename.empty())
+		return NULL;
+	std::string all_macros = std::string(variant_macros) + macros;
+	return Get(vs_filename.c_str(), ps_filename.c_str(), all_macros.c_str());
+}
+
 void Shader::ReloadAll()
 {
 	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
@@ -335,6 +348,7 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
+	cacheAttribLocations();
 	compiled = true;
 
 	return true;
@@ -376,7 +390,15 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
     
     std::string prefix = "#define DESKTOP\n";
 
-    std::string fullcode = prefix + code;
+    //the #version directive (usually coming from the macros of a variant) must stay in the first line
+    std::string fullcode;
+    if (code.compare(0, 8, "#version") == 0)
+    {
+        size_t eol = code.find('\n');
+        fullcode = code.substr(0, eol + 1) + prefix + code.substr(eol + 1);
+    }
+    else
+        fullcode = prefix + code;
 	const char* ptr = fullcode.c_str();
 	glShaderSource(handle, 1, &ptr, NULL);
 	assert( glGetError() == GL_NO_ERROR );
@@ -432,9 +454,26 @@ void Shader::release()
 
 	locations.clear();
 
+	attrib_layout = 0;
+	for (int i = 0; i < NUM_ATTRIBS; ++i)
+		attrib_locations[i] = -1;
+
 	compiled = false;
 }
 
+//queries the location of every mesh attribute once, and packs them in a key (5 bits per attribute)
+void Shader::cacheAttribLocations()
+{
+	attrib_layout = 0;
+	for (int i = 0; i < NUM_ATTRIBS; ++i)
+	{
+		attrib_locations[i] = glGetAttribLocation(program, attrib_names[i]);
+		assert(attrib_locations[i] < 31 && "attribute location too big to be packed in the layout");
+		attrib_layout |= (unsigned int)(attrib_locations[i] + 1) << (i * 5);
+	}
+	assert(glGetError() == GL_NO_ERROR);
+}
+
 
 void Shader::enable()
 {
@@ -538,6 +577,11 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 
 int Shader::getAttribLocation(const char* varname)
 {
+	//mesh attributes are already cached
+	for (int i = 0; i < NUM_ATTRIBS; ++i)
+		if (strcmp(varname, attrib_names[i]) == 0)
+			return attrib_locations[i];
+
 	int loc = glGetAttribLocation(program, varname);
 	if (loc == -1)
 	{
@@ -569,6 +613,7 @@ void Shader::setTexture(const char* varname, Texture* tex, int slot)
 
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(tex->texture_type, tex->texture_id);
+	tex->last_used = getTime(); //for the LRU of the texture manager
 	setUniform1(varname, slot);
 	glActiveTexture(GL_TEXTURE0 + slot);
 }
@@ -847,6 +892,29 @@ Shader* Shader::getDefaultShader(std::string name)
 				gl_FragColor = color;\n\
 			}";
 	}
+	else if (name == "debug") //lines and text of the DebugDraw, already in world or screen space
+	{
+		vs = "attribute vec3 a_vertex; attribute vec4 a_color;\n\
+			uniform mat4 u_viewprojection;\n\
+			varying vec3 v_world_position;\n\
+			varying vec4 v_color;\n\
+			void main()\n\
+			{\n\
+				v_world_position = a_vertex;\n\
+				v_color = a_color;\n\
+				gl_Position = u_viewprojection * vec4(a_vertex, 1.0);\n\
+			}";
+		fs = "uniform vec3 u_camera_position;\n\
+			uniform float u_fade_distance;\n\
+			varying vec3 v_world_position;\n\
+			varying vec4 v_color;\n\
+			void main() {\n\
+				vec4 color = v_color;\n\
+				if(u_fade_distance > 0.0)\n\
+					color.a *= pow( max(0.0, 1.0 - length(v_world_position.xz - u_camera_position.xz) / u_fade_distance), 4.5);\n\
+				gl_FragColor = color;\n\
+			}";
+	}
 	else if (name == "screen") //draws a quad fullscreen
 	{
 		vs = "attribute vec3 a_vertex; \
@@ -862,6 +930,23 @@ Shader* Shader::getDefaultShader(std::string name)
 				gl_FragColor = texture2D( u_texture, v_uv );\n\
 			}";
 	}
+	else if (name == "srgb_encode") //draws a texture fullscreen encoding its linear colors to sRGB
+	{
+		vs = "attribute vec3 a_vertex; \
+			varying vec2 v_uv;\n\
+			void main()\n\
+			{\n\
+				v_uv = a_vertex.xy * 0.5 + vec2(0.5);\n\
+				gl_Position = vec4(a_vertex.xy,0.0,1.0);\n\
+			}";
+		fs = "varying vec2 v_uv;\n\
+			uniform sampler2D u_texture;\n\
+			void main() {\n\
+				vec3 color = texture2D( u_texture, v_uv ).xyz;\n\
+				vec3 encoded = mix( color * 12.92, 1.055 * pow( color, vec3(1.0/2.4) ) - 0.055, step( vec3(0.0031308), color ) );\n\
+				gl_FragColor = vec4( encoded, 1.0 );\n\
+			}";
+	}
 	else if (name == "quad" || name == "textured_quad") //draws a quad
 	{
 		vs = "attribute vec3 a_vertex;\n\
@@ -94,6 +94,13 @@ public:
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
 
+	//mesh attributes, their locations are fetched once after linking so meshes dont query them every draw
+	enum { ATTRIB_VERTEX, ATTRIB_NORMAL, ATTRIB_UV, ATTRIB_COLOR, ATTRIB_BONES, ATTRIB_WEIGHTS, NUM_ATTRIBS };
+	static const char* attrib_names[NUM_ATTRIBS];
+	int attrib_locations[NUM_ATTRIBS];
+	unsigned int attrib_layout; //all the locations packed, programs with the same layout can share the same VAO
+	void cacheAttribLocations();
+
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 	bool compiled;
@@ -101,6 +108,7 @@ public:
 	void setMacros(const char * macros);
 
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
+	Shader* getVariant(const char* variant_macros); //same files with extra macros prepended, NULL if it cannot be compiled
 	static void ReloadAll();
 	static std::map<std::string,Shader*> s_Shaders;
 
@@ -0,0 +1,188 @@
+#include "streambuffer.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+StreamBuffer* StreamBuffer::instance = NULL;
+int StreamBuffer::uniform_alignment = 256;
+int StreamBuffer::storage_alignment = 256;
+
+StreamBuffer* StreamBuffer::getDefault()
+{
+	if (!instance)
+		instance = new StreamBuffer();
+	return instance;
+}
+
+StreamBuffer::StreamBuffer(unsigned int region_size)
+{
+	buffer_id = 0;
+	mapped_data = NULL;
+	for (int i = 0; i < NUM_FRAMES; ++i)
+		fences[i] = NULL;
+	persistent = getGLVersion() >= 44;
+
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+	if (getGLVersion() >= 43)
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+
+	create(region_size);
+	frame = 0;
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	release();
+}
+
+void StreamBuffer::create(unsigned int region_size)
+{
+	this->region_size = region_size;
+	head = 0;
+
+	glGenBuffers(1, &buffer_id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+	if (persistent)
+	{
+		//mapped for the whole life of the buffer, coherent so writes dont need to be flushed
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, region_size * NUM_FRAMES, NULL, flags);
+		mapped_data = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, region_size * NUM_FRAMES, flags);
+		assert(mapped_data && "cannot map the stream buffer");
+	}
+	else
+		glBufferData(GL_COPY_WRITE_BUFFER, region_size, NULL, GL_STREAM_DRAW); //only one region, orphaned every frame
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	checkGLErrors();
+}
+
+void StreamBuffer::release()
+{
+	if (retired.size())
+		glDeleteBuffers((GLsizei)retired.size(), &retired[0]);
+	retired.clear();
+
+	for (int i = 0; i < NUM_FRAMES; ++i)
+	{
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = NULL;
+	}
+	if (mapped_data)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		mapped_data = NULL;
+	}
+	if (buffer_id)
+		glDeleteBuffers(1, &buffer_id); //the driver keeps it alive until the pending draws finish
+	buffer_id = 0;
+}
+
+//the ranges already bound this frame (storage, vertex or indirect buffers) keep pointing to it, deleting it now would unbind them
+void StreamBuffer::retire()
+{
+	for (int i = 0; i < NUM_FRAMES; ++i)
+	{
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = NULL;
+	}
+	retired.push_back(buffer_id); //deleting it unmaps it, the driver keeps it alive until the pending draws finish
+	buffer_id = 0;
+	mapped_data = NULL;
+}
+
+void StreamBuffer::beginFrame()
+{
+	head = 0;
+	if (retired.size())
+	{
+		glDeleteBuffers((GLsizei)retired.size(), &retired[0]);
+		retired.clear();
+	}
+
+	if (!persistent)
+	{
+		//orphaning: the driver gives us new storage while the GPU keeps reading the old one
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+		glBufferData(GL_COPY_WRITE_BUFFER, region_size, NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
+
+	frame = (frame + 1) % NUM_FRAMES;
+	GLsync& fence = fences[frame];
+	if (!fence)
+		return;
+
+	//usually signaled already, we are NUM_FRAMES - 1 frames ahead
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	while (result == GL_TIMEOUT_EXPIRED)
+		result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+	glDeleteSync(fence);
+	fence = NULL;
+}
+
+void StreamBuffer::endFrame()
+{
+	if (!persistent)
+		return;
+	if (fences[frame])
+		glDeleteSync(fences[frame]);
+	fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* StreamBuffer::map(unsigned int size, unsigned int& offset, unsigned int alignment)
+{
+	unsigned int start = (head + alignment - 1) / alignment * alignment;
+	if (start + size > region_size)
+	{
+		//out of space: start a bigger buffer, the old one stays alive and bound for the draws of this frame
+		unsigned int new_size = std::max(region_size * 2, size + alignment);
+		std::cout << " * StreamBuffer: growing to " << (new_size >> 10) << "KBs per frame" << std::endl;
+		retire();
+		create(new_size);
+		start = 0;
+	}
+	head = start + size;
+
+	if (persistent)
+	{
+		offset = frame * region_size + start;
+		return mapped_data + offset;
+	}
+
+	//nobody reads this range yet, so there is no need to synchronize
+	offset = start;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+	return glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+void StreamBuffer::unmap()
+{
+	if (persistent)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+unsigned int StreamBuffer::upload(const void* data, unsigned int size, unsigned int alignment)
+{
+	unsigned int offset;
+	void* dst = map(size, offset, alignment);
+	memcpy(dst, data, size);
+	unmap();
+	return offset;
+}
+
+void StreamBuffer::bindRange(GLenum target, GLuint index, const void* data, unsigned int size)
+{
+	unsigned int alignment = target == GL_UNIFORM_BUFFER ? uniform_alignment : storage_alignment;
+	unsigned int offset = upload(data, size, alignment);
+	glBindBufferRange(target, index, buffer_id, offset, size);
+}
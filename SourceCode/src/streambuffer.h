@@ -0,0 +1,56 @@
+/*  Ring allocator for data that changes every frame (instance matrices, dynamic vertices, uniform blocks, indirect commands).
+	The buffer is split in NUM_FRAMES regions, the CPU writes in one while the GPU reads the others, fences tell when a region is free again.
+	With GL 4.4 the buffer is persistently mapped, otherwise it is orphaned every frame and written with unsynchronized maps.
+*/
+
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include "includes.h"
+
+#include <vector>
+
+class StreamBuffer
+{
+public:
+	static const int NUM_FRAMES = 3;
+
+	static StreamBuffer* instance;
+	static StreamBuffer* getDefault();
+
+	GLuint buffer_id;
+	unsigned int region_size; //bytes available per frame
+	bool persistent; //mapped once with glBufferStorage
+	unsigned char* mapped_data; //whole buffer when persistent
+
+	unsigned int frame; //current region
+	unsigned int head; //next free byte inside the current region
+	GLsync fences[NUM_FRAMES];
+
+	//alignment of the offsets passed to glBindBufferRange
+	static int uniform_alignment;
+	static int storage_alignment;
+
+	StreamBuffer(unsigned int region_size = 4 << 20);
+	~StreamBuffer();
+
+	void beginFrame(); //waits until the GPU is done with the region
+	void endFrame(); //fences the region written this frame
+
+	//reserves size bytes and returns where to write them, offset is the position in the buffer. Call unmap once written
+	void* map(unsigned int size, unsigned int& offset, unsigned int alignment = 16);
+	void unmap();
+	unsigned int upload(const void* data, unsigned int size, unsigned int alignment = 16); //returns the offset
+
+	//upload and bind to an indexed target (GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER)
+	void bindRange(GLenum target, GLuint index, const void* data, unsigned int size);
+
+private:
+	std::vector<GLuint> retired; //outgrown during a frame, deleted in the next beginFrame when nothing is bound to them anymore
+
+	void create(unsigned int region_size);
+	void release();
+	void retire();
+};
+
+#endif
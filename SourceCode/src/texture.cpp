@@ -4,45 +4,46 @@
 
 #include <iostream> //to output
 #include <cmath>
+#include <algorithm>
 
 #include "mesh.h"
 #include "shader.h"
 #include "extra/picopng.h"
+#include "pngdecoder.h"
+#include "threadpool.h"
+#include "ktx.h"
+#include "rgbe.h"
+#include "mipgenerator.h"
+#include "imagekernels.h"
 #include <cassert>
 
 //bilinear interpolation
 Color Image::getPixelInterpolated(float x, float y, bool repeat) {
-	int ix = repeat ? fmod(x,width) : clamp(x,0,width-1);
-	int iy = repeat ? fmod(y,height) : clamp(y, 0, height - 1);
-	if (ix < 0) ix += width;
-	if (iy < 0) iy += height;
-	float fx = (x - (int)x);
-	float fy = (y - (int)y);
-	int ix2 = ix < width - 1 ? ix + 1 : 0;
-	int iy2 = iy < height - 1 ? iy + 1 : 0;
-	Color top = lerp( getPixel(ix, iy), getPixel(ix2, iy), fx );
-	Color bottom = lerp( getPixel(ix, iy2), getPixel(ix2, iy2), fx);
-	return lerp(top, bottom, fy);
+	Vector4 v = getPixelInterpolatedHigh(x, y, repeat);
+	return Color(v.x + 0.5f, v.y + 0.5f, v.z + 0.5f, v.w + 0.5f);
 };
 
 Vector4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
-	int ix = repeat ? fmod(x, width) : clamp(x, 0, width - 1);
-	int iy = repeat ? fmod(y, height) : clamp(y, 0, height - 1);
-	if (ix < 0) ix += width;
-	if (iy < 0) iy += height;
-	float fx = (x - (int)x);
-	float fy = (y - (int)y);
-	int ix2 = ix < width - 1 ? ix + 1 : 0;
-	int iy2 = iy < height - 1 ? iy + 1 : 0;
-	Vector4 top = lerp( getPixel(ix, iy).toVector4(), getPixel(ix2, iy).toVector4(), fx);
-	Vector4 bottom = lerp(getPixel(ix, iy2).toVector4(), getPixel(ix2, iy2).toVector4(), fx);
-	return lerp(top, bottom, fy);
+	Vector2 coord(x, y);
+	Vector4 v;
+	getPixelsInterpolated(&coord, 1, &v, repeat);
+	return v * 255.0f;
 };
 
+void Image::getPixelsInterpolated(const Vector2* coords, int count, Vector4* result, bool repeat)
+{
+	assert(data && "image without data");
+	sampleBilinear(data, width, height, bytes_per_pixel, coords[0].value, count, result[0].v, repeat);
+}
 
 std::map<std::string, Texture*> Texture::sTexturesLoaded;
+std::set<std::string> Texture::sMissingFiles;
+std::set<Texture*> Texture::sAllTextures;
+size_t Texture::memory_budget = 0;
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
+eMipFilter Texture::mip_filter = MIP_FILTER_KAISER;
+bool Texture::cache_default_mips = false;
 FBO* Texture::global_fbo = NULL;
 
 Texture::Texture()
@@ -55,23 +56,28 @@ Texture::Texture()
 	format = 0;
 	type = 0;
 	texture_type = GL_TEXTURE_2D;
+	category = TEXTURE_CATEGORY_OTHER;
+	color_space = COLOR_SPACE_LINEAR;
+	memory_size = 0;
+	ref_count = 0;
+	last_used = 0;
+	sAllTextures.insert(this);
 }
 
-Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
+Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format) : Texture()
 {
-	texture_id = 0;
 	create(width, height, format, type, mipmaps, data, internal_format);
 }
 
-Texture::Texture(Image* img)
+Texture::Texture(Image* img) : Texture()
 {
-	texture_id = 0;
 	create(img->width, img->height, img->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
 }
 
 Texture::~Texture()
 {
 	clear();
+	sAllTextures.erase(this);
 }
 
 void Texture::clear()
@@ -79,6 +85,7 @@ void Texture::clear()
 	glDeleteTextures(1, &texture_id);
 	glBindTexture(this->texture_type, 0);
 	texture_id = 0;
+	memory_size = 0;
 }
 
 void Texture::debugInMenu()
@@ -100,6 +107,7 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	this->format = format;
 	this->internal_format = internal_format;
 	this->type = type;
+	this->color_space = isSRGBFormat(internal_format) ? COLOR_SPACE_SRGB : COLOR_SPACE_LINEAR;
 	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
@@ -134,6 +142,7 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 		clear();
 
 	this->texture_type = GL_TEXTURE_3D;
+	this->category = TEXTURE_CATEGORY_VOLUME;
 
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
@@ -155,6 +164,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 	this->internal_format = internal_format;
 	this->type = type;
 	this->texture_type = GL_TEXTURE_CUBE_MAP;
+	this->category = TEXTURE_CATEGORY_ENVIRONMENT;
 	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
 
 	this->wrapS = GL_CLAMP_TO_EDGE;
@@ -169,60 +179,271 @@ void Texture::createCubemap(unsigned int width, unsigned int height, Uint8** dat
 		uploadCubemap(format, type, mipmaps, data, internal_format);
 }
 
-Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
+Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap, eTextureUsage usage)
 {
 	assert(filename);
 
-	//check if loaded
-	auto it = sTexturesLoaded.find(filename);
-	if (it != sTexturesLoaded.end())
-		return it->second;
+	//check if loaded, compressed ones are registered with the name of their cache
+	eBCFormat format = getCompressedFormat(usage);
+	std::string name = usage != TEXTURE_DEFAULT ? getCacheFilename(filename, usage, format) : filename;
+	Texture* texture = Find(name);
+	if (texture)
+		return Acquire(texture);
+	if (sMissingFiles.find(filename) != sMissingFiles.end())
+		return NULL; //already failed
+
+	if (usage != TEXTURE_DEFAULT)
+	{
+		long time = getTime();
+		std::cout << " + Texture loading: " << name << " ... ";
+		KTX ktx;
+		if (Bake(filename, usage, format, &ktx, wrap))
+		{
+			texture = new Texture();
+			texture->load(&ktx, name.c_str(), mipmaps, wrap);
+			Acquire(texture);
+			std::cout << "[OK] Size: " << texture->width << "x" << texture->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+			EnforceBudget();
+			return texture;
+		}
+		std::cout << "[ERROR]: cannot compress, using it uncompressed" << std::endl;
+
+		texture = Find(filename);
+		if (texture)
+			return Acquire(texture);
+	}
 
 	//load it
-	Texture* texture = new Texture();
+	texture = new Texture();
 	if (!texture->load(filename, mipmaps,wrap))
 	{
 		delete texture;
+		sMissingFiles.insert(filename);
 		return NULL;
 	}
+	Acquire(texture);
+	EnforceBudget();
+	return texture;
+}
+
+Texture* Texture::Find(const std::string& name)
+{
+	auto it = sTexturesLoaded.find(name);
+	if (it == sTexturesLoaded.end())
+		return NULL;
+	return it->second;
+}
 
+Texture* Texture::Acquire(Texture* texture)
+{
+	if (texture)
+		texture->ref_count++;
 	return texture;
 }
 
-bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
+void Texture::Release(Texture* texture)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
-	long time = getTime();
+	if (!texture)
+		return;
+	assert(texture->ref_count > 0 && "texture released more times than taken");
+	texture->ref_count--;
+	EnforceBudget();
+}
 
-	std::cout << " + Texture loading: " << filename << " ... ";
+void Texture::EnforceBudget()
+{
+	if (!memory_budget)
+		return;
+	size_t used = 0;
+	for (auto it = sTexturesLoaded.begin(); it != sTexturesLoaded.end(); ++it)
+		used += it->second->memory_size;
 
-	image = new Image();
-	bool found = false;
+	while (used > memory_budget)
+	{
+		auto oldest = sTexturesLoaded.end();
+		for (auto it = sTexturesLoaded.begin(); it != sTexturesLoaded.end(); ++it)
+			if (it->second->ref_count <= 0 && (oldest == sTexturesLoaded.end() || it->second->last_used < oldest->second->last_used))
+				oldest = it;
+		if (oldest == sTexturesLoaded.end())
+			return; //all of them are used
+
+		Texture* texture = oldest->second;
+		std::cout << " - Texture evicted: " << oldest->first << " (" << (texture->memory_size >> 10) << "KBs)" << std::endl;
+		used -= texture->memory_size;
+		sTexturesLoaded.erase(oldest);
+		delete texture;
+	}
+}
 
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename, true);
-	else
+size_t Texture::getMemoryUsed(int category)
+{
+	size_t total = 0;
+	for (auto it = sAllTextures.begin(); it != sAllTextures.end(); ++it)
+		if (category == -1 || (*it)->category == category)
+			total += (*it)->memory_size;
+	return total;
+}
+
+std::string Texture::getMemoryStats()
+{
+	static const char* names[] = { "other", "materials", "environments", "render targets", "volumes" };
+	char str[256];
+	sprintf(str, "Textures: %.1fMBs (%d)", getMemoryUsed() / (1024.0 * 1024.0), (int)sAllTextures.size());
+	std::string stats = str;
+	for (int i = 0; i < NUM_TEXTURE_CATEGORIES; ++i)
+	{
+		size_t used = getMemoryUsed(i);
+		if (!used)
+			continue;
+		sprintf(str, " %s: %.1f", names[i], used / (1024.0 * 1024.0));
+		stats += str;
+	}
+	if (memory_budget)
+	{
+		sprintf(str, " budget: %.1fMBs", memory_budget / (1024.0 * 1024.0));
+		stats += str;
+	}
+	return stats;
+}
+
+//bytes of one pixel of an uncompressed format, from the sized internal format or from format and type
+static unsigned int getBytesPerPixel(unsigned int internal_format, unsigned int format, unsigned int type)
+{
+	switch (internal_format)
 	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
-		return false; //unsupported file type
+		case GL_R8: return 1;
+		case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+		case GL_RGB8: case GL_SRGB8: return 3;
+		case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_RG16F: case GL_R32F: case GL_R11F_G11F_B10F: case GL_RGB10_A2:
+		case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8: return 4;
+		case GL_RGB16F: return 6;
+		case GL_RGBA16F: case GL_RG32F: return 8;
+		case GL_RGB32F: return 12;
+		case GL_RGBA32F: return 16;
 	}
 
-	if (!found) //file not found
+	unsigned int components = 4;
+	switch (format)
 	{
-		std::cout << " [ERROR]: Texture not found " << std::endl;
-		return false;
+		case GL_RED: case GL_ALPHA: case GL_LUMINANCE: case GL_DEPTH_COMPONENT: components = 1; break;
+		case GL_RG: case GL_LUMINANCE_ALPHA: components = 2; break;
+		case GL_RGB: case GL_BGR: components = 3; break;
 	}
+	unsigned int size = 1;
+	switch (type)
+	{
+		case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: size = 2; break;
+		case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: size = 4; break;
+	}
+	return components * size;
+}
 
-	this->filename = filename;
+//bytes of a 4x4 block, 0 if the format is not block compressed
+static unsigned int getCompressedBlockSize(unsigned int internal_format)
+{
+	switch (internal_format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RED_RGTC1:
+		case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT: return 8;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RG_RGTC2:
+		case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return 16;
+	}
+	return 0;
+}
+
+unsigned int Texture::getSRGBFormat(unsigned int internal_format)
+{
+	switch (internal_format)
+	{
+		case GL_RGB: case GL_RGB8: return GL_SRGB8;
+		case GL_RGBA: case GL_RGBA8: return GL_SRGB8_ALPHA8;
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	}
+	return internal_format;
+}
+
+bool Texture::isSRGBFormat(unsigned int internal_format)
+{
+	switch (internal_format)
+	{
+		case GL_SRGB8: case GL_SRGB8_ALPHA8: case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return true;
+	}
+	return false;
+}
+
+size_t Texture::computeMemorySize(unsigned int width, unsigned int height, unsigned int depth, unsigned int internal_format, unsigned int format, unsigned int type, int num_levels, int num_faces)
+{
+	unsigned int block_size = getCompressedBlockSize(internal_format);
+	unsigned int pixel_size = block_size ? 0 : getBytesPerPixel(internal_format, format, type);
+	size_t total = 0;
+	for (int i = 0; i < num_levels; ++i)
+	{
+		unsigned int w = std::max(1u, width >> i);
+		unsigned int h = std::max(1u, height >> i);
+		unsigned int d = std::max(1u, depth >> i);
+		size_t size = block_size ? (size_t)((w + 3) / 4) * ((h + 3) / 4) * block_size : (size_t)w * h * pixel_size;
+		total += size * d;
+	}
+	return total * num_faces;
+}
 
-	unsigned int internal_format = 0;
+void Texture::updateMemorySize(int num_levels)
+{
+	//arrays keep the layers in every level, 3D textures halve the depth too
+	unsigned int w = (unsigned int)width, h = (unsigned int)height, d = std::max(1u, (unsigned int)depth);
+	int faces = texture_type == GL_TEXTURE_CUBE_MAP ? 6 : (texture_type == GL_TEXTURE_2D_ARRAY ? d : 1);
+	if (texture_type != GL_TEXTURE_3D)
+		d = 1;
+	if (num_levels < 0)
+	{
+		unsigned int size = std::max(w, std::max(h, d));
+		num_levels = 1;
+		while (size >>= 1)
+			num_levels++;
+	}
+	memory_size = computeMemorySize(w, h, d, internal_format ? internal_format : format, format, type, num_levels, faces);
+}
 
-	if (type == GL_FLOAT)
-		internal_format = (image->bytes_per_pixel == 3 ? GL_RGB32F : GL_RGBA32F);
+bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
+{
+	long time = getTime();
+	std::cout << " + Texture loading: " << filename << " ... ";
+
+	//the mips are baked on CPU and cached with the texture when asked, loading is just a copy
+	if (mipmaps && type == GL_UNSIGNED_BYTE && cache_default_mips)
+	{
+		KTX ktx;
+		if (!Bake(filename, TEXTURE_DEFAULT, getCompressedFormat(TEXTURE_DEFAULT), &ktx, wrap))
+		{
+			std::cout << " [ERROR]: Texture not found " << std::endl;
+			return false;
+		}
+		load(&ktx, filename, mipmaps, wrap);
+	}
+	else
+	{
+		Image image;
+		if (!image.load(filename))
+		{
+			std::cout << " [ERROR]: Texture not found " << std::endl;
+			return false;
+		}
+		if (!load(&image, filename, mipmaps, wrap, type))
+			return false;
+	}
+
+	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+bool Texture::load(Image* image, const char* filename, bool mipmaps, bool wrap, unsigned int type)
+{
+	assert(image && image->data);
+	this->filename = filename;
 
 	//upload to VRAM
 	create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0 );
@@ -233,11 +454,336 @@ bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int t
 		generateMipmaps();
 
 	this->image.clear();
-	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	setName(filename);
 	return true;
 }
 
+void Texture::Preload(const std::vector<std::string>& filenames, bool mipmaps, bool wrap, const std::vector<eTextureUsage>& usages)
+{
+	struct sJob {
+		std::string filename;
+		std::string name; //in the manager
+		eTextureUsage usage;
+		eBCFormat format;
+		bool baked; //compressed or with mips, if not it is just decoded
+		Image image;
+		KTX ktx;
+		bool ok;
+	};
+
+	//the format is chosen here because it asks GL
+	std::vector<sJob> jobs(filenames.size());
+	int num_jobs = 0;
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		sJob& job = jobs[num_jobs];
+		job.filename = filenames[i];
+		job.usage = i < usages.size() ? usages[i] : TEXTURE_DEFAULT;
+		job.format = getCompressedFormat(job.usage);
+		job.baked = (mipmaps && cache_default_mips) || job.usage != TEXTURE_DEFAULT;
+		job.name = job.usage != TEXTURE_DEFAULT ? getCacheFilename(filenames[i].c_str(), job.usage, job.format) : filenames[i];
+		job.ok = false;
+		if (sTexturesLoaded.find(job.name) == sTexturesLoaded.end())
+			num_jobs++;
+	}
+	if (!num_jobs)
+		return;
+
+	long time = getTime();
+	std::cout << " + Texture preloading: " << num_jobs << " files ... ";
+
+	//decoding and compressing is CPU only, the GL calls stay in this thread
+	ThreadPool::getDefault()->parallelFor(num_jobs, [&](int i) {
+		sJob& job = jobs[i];
+		job.ok = job.baked ? Bake(job.filename.c_str(), job.usage, job.format, &job.ktx, wrap) : job.image.load(job.filename.c_str());
+	});
+
+	int loaded = 0;
+	for (int i = 0; i < num_jobs; ++i)
+	{
+		sJob& job = jobs[i];
+		if (!job.ok)
+		{
+			std::cout << std::endl << " [ERROR]: Texture not found " << job.filename;
+			continue;
+		}
+		Texture* texture = new Texture();
+		if (job.baked)
+			texture->load(&job.ktx, job.name.c_str(), mipmaps, wrap);
+		else
+			texture->load(&job.image, job.name.c_str(), mipmaps, wrap);
+		loaded++;
+	}
+	std::cout << " [OK] " << loaded << " textures Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+}
+
+bool Texture::load(KTX* ktx, const char* name, bool mipmaps, bool wrap, bool upload_data, int base_level)
+{
+	assert(ktx && ktx->levels.size() && ktx->num_faces == 1 && "only 2D textures");
+	int num_levels = mipmaps ? (int)ktx->levels.size() : 1;
+
+	if (this->texture_id != 0)
+		clear();
+	this->filename = name;
+	this->width = (float)ktx->width;
+	this->height = (float)ktx->height;
+	this->depth = 0;
+	this->format = ktx->isCompressed() ? ktx->gl_base_internal_format : ktx->gl_format;
+	this->internal_format = ktx->gl_internal_format;
+	this->type = ktx->gl_type;
+	this->color_space = isSRGBFormat(internal_format) ? COLOR_SPACE_SRGB : COLOR_SPACE_LINEAR;
+	this->texture_type = GL_TEXTURE_2D;
+	this->mipmaps = num_levels > 1;
+
+	glGenTextures(1, &texture_id);
+	glBindTexture(this->texture_type, texture_id);
+
+	//every level is stored, nothing to generate (RGB rows are not aligned)
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = base_level; i < num_levels; ++i)
+	{
+		KTX::sLevel& level = ktx->levels[i];
+		const void* data = upload_data ? &level.data[0] : NULL;
+		if (ktx->isCompressed())
+			glCompressedTexImage2D(this->texture_type, i, internal_format, level.width, level.height, 0, (GLsizei)level.data.size(), data);
+		else
+			glTexImage2D(this->texture_type, i, internal_format, level.width, level.height, 0, format, type, data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, base_level);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	memory_size = 0;
+	for (int i = base_level; i < num_levels; ++i)
+		memory_size += ktx->levels[i].data.size();
+
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps && wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+
+	//single channel maps read the same value from .r, .g or .b like the uncompressed ones
+	if (format == GL_RED)
+	{
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(this->texture_type, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error uploading compressed texture");
+	setName(name);
+	return true;
+}
+
+bool Texture::loadCubemap(const RGBEImage& image, int size, bool mipmaps)
+{
+	if (image.data.empty())
+		return false;
+
+	//the half floats are written by the resampler, there is no float copy of the faces
+	std::vector<unsigned short> data((size_t)size * size * 3 * 6);
+	unsigned short* faces[6];
+	for (int i = 0; i < 6; ++i)
+		faces[i] = &data[(size_t)size * size * 3 * i];
+	equirectToCubemap(image, size, faces);
+	createCubemap(size, size, (Uint8**)faces, GL_RGB, GL_HALF_FLOAT, mipmaps, GL_RGB16F);
+	return true;
+}
+
+eBCFormat Texture::getCompressedFormat(eTextureUsage usage)
+{
+	static int gl_version = getGLVersion();
+	switch (usage)
+	{
+		case TEXTURE_NORMAL: return BC5;
+		case TEXTURE_MASK: return BC4;
+		default: return gl_version >= 42 ? BC7 : BC1; //BPTC is core since 4.2
+	}
+}
+
+std::string Texture::getCacheFilename(const char* filename, eTextureUsage usage, eBCFormat format)
+{
+	static const char* extensions[] = { ".bc1.ktx", ".bc3.ktx", ".bc4.ktx", ".bc5.ktx", ".bc7.ktx" };
+	return std::string(filename) + (usage == TEXTURE_DEFAULT ? ".rgba8.ktx" : extensions[format]);
+}
+
+static void bakePixels(std::vector<Uint8>& pixels, unsigned int width, unsigned int height, eTextureUsage usage, eBCFormat format, bool wrap, KTX* ktx);
+static const char* getMipWrapName(bool wrap) { return wrap ? "repeat" : "clamp"; }
+
+bool Texture::Bake(const char* filename, eTextureUsage usage, eBCFormat format, KTX* ktx, bool wrap)
+{
+	const char* filter_name = getMipFilterName(mip_filter);
+
+	//the cache is rebaked if the source changed, the mips were made with another filter or borders or it has another color space
+	std::string cache_filename = getCacheFilename(filename, usage, format);
+	bool cached = usage != TEXTURE_DEFAULT || cache_default_mips;
+	if (cached && isCacheValid(filename, cache_filename.c_str()) && ktx->load(cache_filename.c_str()) && ktx->metadata["mip_filter"] == filter_name &&
+		ktx->metadata["mip_wrap"] == getMipWrapName(wrap) && isSRGBFormat(ktx->gl_internal_format) == (usage == TEXTURE_COLOR))
+		return true;
+
+	Image image;
+	if (!image.load(filename))
+		return false;
+
+	//the encoder and the mips work with RGBA
+	std::vector<Uint8> pixels(image.width * image.height * 4);
+	if (image.bytes_per_pixel == 3)
+		convertRGBToRGBA(image.data, &pixels[0], image.width * image.height);
+	else
+		memcpy(&pixels[0], image.data, pixels.size());
+
+	bakePixels(pixels, image.width, image.height, usage, format, wrap, ktx);
+
+	//uncompressed ones keep the format of the source
+	if (usage == TEXTURE_DEFAULT && image.bytes_per_pixel == 3)
+	{
+		ktx->gl_format = ktx->gl_base_internal_format = GL_RGB;
+		ktx->gl_internal_format = GL_RGB8;
+		for (size_t i = 0; i < ktx->levels.size(); ++i)
+		{
+			std::vector<Uint8>& data = ktx->levels[i].data;
+			size_t num_pixels = data.size() / 4;
+			convertRGBAToRGB(&data[0], &data[0], num_pixels);
+			data.resize(num_pixels * 3);
+		}
+	}
+
+	if (cached && !ktx->save(cache_filename.c_str()))
+		std::cout << "[WARN] cannot write " << cache_filename << std::endl;
+	return true;
+}
+
+//mips and encoding of RGBA pixels, the ones of the first level are used to check the alpha
+static void bakePixels(std::vector<Uint8>& pixels, unsigned int width, unsigned int height, eTextureUsage usage, eBCFormat format, bool wrap, KTX* ktx)
+{
+	static const unsigned int gl_formats[] = { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RGBA_BPTC_UNORM };
+	static const unsigned int gl_base_formats[] = { GL_RGB, GL_RGBA, GL_RED, GL_RG, GL_RGBA };
+
+	//whole mip chain, colors are filtered in linear space and normals renormalized
+	sMipOptions options;
+	options.filter = Texture::mip_filter;
+	options.srgb = usage == TEXTURE_COLOR;
+	options.normal_map = usage == TEXTURE_NORMAL;
+	options.wrap = wrap;
+	std::vector< std::vector<Uint8> > mips;
+	generateMips(&pixels[0], width, height, 1, options, mips);
+
+	ktx->width = width;
+	ktx->height = height;
+	ktx->num_faces = 1;
+	ktx->levels.resize(mips.size());
+	ktx->metadata.clear();
+	ktx->metadata["mip_filter"] = getMipFilterName(Texture::mip_filter);
+	ktx->metadata["mip_wrap"] = getMipWrapName(wrap);
+	for (size_t i = 0; i < mips.size(); ++i)
+	{
+		ktx->levels[i].width = std::max(1u, width >> i);
+		ktx->levels[i].height = std::max(1u, height >> i);
+	}
+
+	if (usage == TEXTURE_DEFAULT)
+	{
+		ktx->gl_type = GL_UNSIGNED_BYTE;
+		ktx->gl_format = GL_RGBA;
+		ktx->gl_internal_format = GL_RGBA8;
+		ktx->gl_base_internal_format = GL_RGBA;
+		for (size_t i = 0; i < mips.size(); ++i)
+			ktx->levels[i].data.swap(mips[i]);
+	}
+	else
+	{
+		//BC1 has no real alpha
+		if (format == BC1)
+			for (size_t i = 3; i < pixels.size(); i += 4)
+				if (pixels[i] != 255)
+				{
+					format = BC3;
+					break;
+				}
+
+		ktx->gl_type = 0;
+		ktx->gl_format = 0;
+		ktx->gl_internal_format = gl_formats[format];
+		ktx->gl_base_internal_format = gl_base_formats[format];
+		for (size_t i = 0; i < mips.size(); ++i)
+			encodeBC(format, &mips[i][0], ktx->levels[i].width, ktx->levels[i].height, ktx->levels[i].data);
+	}
+
+	//the shaders get colors in linear space without converting them
+	if (usage == TEXTURE_COLOR)
+		ktx->gl_internal_format = Texture::getSRGBFormat(ktx->gl_internal_format);
+}
+
+Texture* Texture::GetPacked(const std::vector<sTextureChannel>& channels, bool mipmaps, bool wrap)
+{
+	assert(channels.size() && channels.size() <= 4);
+
+	//the name depends on all the sources (fnv-1a), next to the first one
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < channels.size(); ++i)
+	{
+		std::string key = channels[i].filename + ":" + (char)('0' + channels[i].source_channel) + ";";
+		for (size_t j = 0; j < key.size(); ++j)
+			hash = (hash ^ (unsigned char)key[j]) * 16777619u;
+	}
+	const std::string& first = channels[0].filename;
+	char packed_name[32];
+	sprintf(packed_name, "packed_%08x", hash);
+	std::string filename = first.substr(0, first.find_last_of("/\\") + 1) + packed_name;
+
+	eBCFormat format = getCompressedFormat(TEXTURE_PACKED);
+	std::string name = getCacheFilename(filename.c_str(), TEXTURE_PACKED, format);
+	Texture* texture = Find(name);
+	if (texture)
+		return Acquire(texture);
+	if (sMissingFiles.find(name) != sMissingFiles.end())
+		return NULL;
+
+	long time = getTime();
+	std::cout << " + Texture packing: " << name << " ... ";
+
+	//valid if it is newer than all the sources
+	KTX ktx;
+	bool valid = true;
+	for (size_t i = 0; i < channels.size(); ++i)
+		valid = valid && isCacheValid(channels[i].filename.c_str(), name.c_str());
+	if (!valid || !ktx.load(name.c_str()) || ktx.metadata["mip_filter"] != getMipFilterName(mip_filter) || ktx.metadata["mip_wrap"] != getMipWrapName(wrap))
+	{
+		std::vector<Image> images(channels.size());
+		ThreadPool::getDefault()->parallelFor((int)channels.size(), [&](int i) {
+			images[i].load(channels[i].filename.c_str());
+		});
+		for (size_t i = 0; i < images.size(); ++i)
+			if (!images[i].data || images[i].width != images[0].width || images[i].height != images[0].height)
+			{
+				std::cout << "[ERROR]: cannot pack " << channels[i].filename << std::endl;
+				sMissingFiles.insert(name);
+				return NULL;
+			}
+
+		//unused channels are white
+		unsigned int width = images[0].width, height = images[0].height;
+		std::vector<Uint8> pixels(width * height * 4, 255);
+		for (size_t c = 0; c < images.size(); ++c)
+		{
+			const Image& image = images[c];
+			int source = std::min(channels[c].source_channel, (int)image.bytes_per_pixel - 1);
+			for (unsigned int i = 0; i < width * height; ++i)
+				pixels[i * 4 + c] = image.data[i * image.bytes_per_pixel + source];
+		}
+
+		bakePixels(pixels, width, height, TEXTURE_PACKED, format, wrap, &ktx);
+		if (!ktx.save(name.c_str()))
+			std::cout << "[WARN] cannot write " << name << std::endl;
+	}
+
+	texture = new Texture();
+	texture->load(&ktx, name.c_str(), mipmaps, wrap);
+	Acquire(texture);
+	std::cout << "[OK] Size: " << texture->width << "x" << texture->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	EnforceBudget();
+	return texture;
+}
+
 void Texture::upload(Image* img)
 {
 	create(img->width, img->height, img->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -252,6 +798,7 @@ void Texture::upload( unsigned int format, unsigned int type, bool mipmaps, Uint
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
+	updateMemorySize();
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -273,6 +820,7 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, Uin
 	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
+	updateMemorySize();
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -300,6 +848,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	{
 		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data[i]);
 	}
+	updateMemorySize();
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -313,6 +862,26 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	assert(glGetError() == GL_NO_ERROR && "Error creating texture");
 }
 
+void Texture::uploadCubemapLevel(unsigned int level, Uint8** data)
+{
+	assert(texture_id && texture_type == GL_TEXTURE_CUBE_MAP && data);
+	unsigned int w = std::max(1u, (unsigned int)width >> level);
+	unsigned int h = std::max(1u, (unsigned int)height >> level);
+
+	glBindTexture(this->texture_type, texture_id);
+	for (int i = 0; i < 6; i++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, internal_format == 0 ? format : internal_format, w, h, 0, format, type, data[i]);
+
+	//the chain ends at this level so the texture is complete
+	this->mipmaps = true;
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, level);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	updateMemorySize(level + 1);
+
+	glBindTexture(this->texture_type, 0);
+	assert(glGetError() == GL_NO_ERROR && "Error uploading cubemap level");
+}
+
 //special function to upload texture arrays, a special type of texture that has layers
 void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 {
@@ -332,14 +901,9 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 		return;
 	}
 
-	texture_type = GL_TEXTURE_2D_ARRAY;
-	type = GL_UNSIGNED_BYTE;
 	int dataFormat = (image.bytes_per_pixel == 3 ? GL_RGB : GL_RGBA);
-	format = (image.bytes_per_pixel == 3 ? GL_RGB8 : GL_RGBA8);
-	this->width = (float)width;
-	this->height = (float)height;
 	int bytes_per_pixel = image.bytes_per_pixel;
-	this->mipmaps = mipmaps && isPowerOfTwo((int)width) && isPowerOfTwo((int)height);
+	mipmaps = mipmaps && isPowerOfTwo((int)width) && isPowerOfTwo((int)height);
 	uint8* data = NULL;
 
 	//if texture is a grid, linearize the data so it can be uploaded in a single call
@@ -363,29 +927,97 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 		data = image.data;
 
 	//How to store a texture in VRAM
+	createArray(width, height, num_textures, image.bytes_per_pixel == 3 ? GL_RGB8 : GL_RGBA8, dataFormat, GL_UNSIGNED_BYTE, 1, mipmaps);
+	glBindTexture(this->texture_type, texture_id);
+	glTexSubImage3D(this->texture_type, 0, 0, 0, 0, width, height, num_textures, dataFormat, type, data);
 	assert(glGetError() == GL_NO_ERROR);
-	if (texture_id == 0)
-		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-	glBindTexture( this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
-	glTexImage3D( this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
-	assert(glGetError() == GL_NO_ERROR);
-
-	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
-	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR); //set the mag filter
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-	glTexParameterf(this->texture_type, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
-	assert(glGetError() == GL_NO_ERROR);
+	this->mipmaps = mipmaps;
 	if (mipmaps)
+	{
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, 1000); //the chain is generated from the first level
 		generateMipmaps();
+	}
 	assert(glGetError() == GL_NO_ERROR);
 
 	if (num_columns > 1)
 		delete[] data;
 }
 
+void Texture::createArray(unsigned int width, unsigned int height, unsigned int layers, unsigned int internal_format, unsigned int format, unsigned int type, int num_levels, bool wrap, int base_level)
+{
+	if (this->texture_id != 0)
+		clear();
+	this->width = (float)width;
+	this->height = (float)height;
+	this->depth = (float)layers;
+	this->format = format;
+	this->type = type;
+	this->internal_format = internal_format;
+	this->texture_type = GL_TEXTURE_2D_ARRAY;
+	this->color_space = isSRGBFormat(internal_format) ? COLOR_SPACE_SRGB : COLOR_SPACE_LINEAR;
+	this->mipmaps = num_levels > 1;
+
+	//storage of all the levels, the layers are filled later
+	glGenTextures(1, &texture_id);
+	glBindTexture(this->texture_type, texture_id);
+	bool compressed = getCompressedBlockSize(internal_format) != 0;
+	for (int i = base_level; i < num_levels; ++i)
+	{
+		unsigned int w = std::max(1u, width >> i), h = std::max(1u, height >> i);
+		if (compressed)
+			glCompressedTexImage3D(this->texture_type, i, internal_format, w, h, layers, 0, (GLsizei)computeMemorySize(w, h, 1, internal_format, format, type, 1, layers), NULL);
+		else
+			glTexImage3D(this->texture_type, i, internal_format, w, h, layers, 0, format, type, NULL);
+	}
+	glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, base_level);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameterf(this->texture_type, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //better quality but takes more resources
+	if (format == GL_RED)
+	{
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(this->texture_type, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+	glBindTexture(this->texture_type, 0);
+	assert(glGetError() == GL_NO_ERROR);
+	memory_size = computeMemorySize(std::max(1u, width >> base_level), std::max(1u, height >> base_level), 1, internal_format, format, type, num_levels - base_level, layers);
+}
+
+bool Texture::uploadLayer(unsigned int layer, KTX* ktx)
+{
+	assert(texture_type == GL_TEXTURE_2D_ARRAY && layer < depth && "not an array or out of layers");
+	GLint num_levels = 1, base_level = 0;
+	glBindTexture(this->texture_type, texture_id);
+	glGetTexParameteriv(this->texture_type, GL_TEXTURE_MAX_LEVEL, &num_levels);
+	glGetTexParameteriv(this->texture_type, GL_TEXTURE_BASE_LEVEL, &base_level);
+	num_levels++;
+
+	//same size and format, the levels that dont exist in the array (or are under the base level) are skipped
+	if (ktx->num_faces != 1 || ktx->width != width || ktx->height != height || ktx->gl_internal_format != internal_format || (int)ktx->levels.size() < num_levels)
+	{
+		glBindTexture(this->texture_type, 0);
+		return false;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = base_level; i < num_levels; ++i)
+	{
+		KTX::sLevel& level = ktx->levels[i];
+		if (ktx->isCompressed())
+			glCompressedTexSubImage3D(this->texture_type, i, 0, 0, layer, level.width, level.height, 1, internal_format, (GLsizei)level.data.size(), &level.data[0]);
+		else
+			glTexSubImage3D(this->texture_type, i, 0, 0, layer, level.width, level.height, 1, format, type, &level.data[0]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(this->texture_type, 0);
+	return checkGLErrors();
+}
+
 void Texture::bind()
 {
+	last_used = getTime();
 	//glEnable(this->texture_type); //enable the textures 
 	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
 }
@@ -414,6 +1046,7 @@ void Texture::generateMipmaps()
 	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter ); //set the mag filter
 	glGenerateMipmapEXT(this->texture_type);
+	updateMemorySize(-1);
 }
 
 
@@ -565,6 +1198,19 @@ bool Image::loadTGA(const char* filename)
 #include <iostream>
 #include <fstream>
 
+bool Image::load(const char* filename)
+{
+	std::string str = filename;
+	std::string ext = str.size() > 4 ? str.substr(str.size() - 4, 4) : "";
+
+	if (ext == ".tga" || ext == ".TGA")
+		return loadTGA(filename);
+	if (ext == ".png" || ext == ".PNG")
+		return loadPNG(filename, true);
+	std::cout << "[ERROR]: unsupported format " << filename << std::endl;
+	return false;
+}
+
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
 	std::ifstream file( filename, std::ios::in | std::ios::binary | std::ios::ate);
@@ -574,25 +1220,27 @@ bool Image::loadPNG(const char* filename, bool flip_y)
 	if (file.seekg(0, std::ios::end).good()) size = file.tellg();
 	if (file.seekg(0, std::ios::beg).good()) size -= file.tellg();
 
-	if (!size)
+	if (size <= 0)
 		return false;
 
+	//read contents of the file into the vector
 	std::vector<unsigned char> buffer;
+	buffer.resize((size_t)size);
+	file.read((char*)(&buffer[0]), size);
 
-	//read contents of the file into the vector
-	if (size > 0)
-	{
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
-	}
-	else 
-		buffer.clear();
+	//the fast path writes the pixels already flipped in their final buffer
+	if (decodePNGFast(this, &buffer[0], buffer.size(), flip_y))
+		return true;
 
+	//other bit depths or interlaced images
 	std::vector<unsigned char> out_image;
-
-	if (decodePNG( out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
+	unsigned int w = 0, h = 0;
+	if (decodePNG( out_image, w, h, &buffer[0], (unsigned long)buffer.size(), true) != 0)
 		return false;
 
+	clear();
+	width = w;
+	height = h;
 	data = new Uint8[ out_image.size() ];
 	memcpy( data, &out_image[0], out_image.size() );
 	bytes_per_pixel = 4;
@@ -649,18 +1297,7 @@ bool Image::saveTGA(const char* filename, bool flip_y)
 void Image::flipY()
 {
 	assert(data);
-	int row_size = 4 * width;
-	uint8* temp_row = new uint8[row_size];
-#pragma omp simd
-	for (int y = 0; y < height*0.5; y += 1)
-	{
-		uint8* pos = data + y*row_size;
-		memcpy(temp_row, pos, row_size);
-		uint8* pos2 = data + (height - y - 1)*row_size;
-		memcpy(pos, pos2, row_size);
-		memcpy(pos2, temp_row, row_size);
-	}
-	delete[] temp_row;
+	flipRows(data, width * bytes_per_pixel, height);
 }
 
 bool isPowerOfTwo( int n )
@@ -6,13 +6,50 @@
 
 #include "includes.h"
 #include "framework.h"
+#include "bcencoder.h"
+#include "mipgenerator.h"
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 #include <cassert>
 
 class Shader;
 class FBO;
 class Texture;
+class KTX;
+class RGBEImage;
+
+//what a texture is used for, decides the block compressed format it is baked to
+enum eTextureUsage {
+	TEXTURE_DEFAULT, //uncompressed, in the format of the source
+	TEXTURE_COLOR, //BC7 (BC1 or BC3 if the GPU doesnt support it), sRGB
+	TEXTURE_NORMAL, //BC5, only xy, the shader rebuilds z
+	TEXTURE_MASK, //BC4, the channel is replicated to rgb when sampling
+	TEXTURE_PACKED //several masks in rgb, same format than color but filtered as data
+};
+
+//what the VRAM is used for, in the memory stats
+enum eTextureCategory {
+	TEXTURE_CATEGORY_OTHER,
+	TEXTURE_CATEGORY_MATERIAL, //loaded from files
+	TEXTURE_CATEGORY_ENVIRONMENT, //cubemaps
+	TEXTURE_CATEGORY_RENDER_TARGET, //FBOs
+	TEXTURE_CATEGORY_VOLUME, //3D
+	NUM_TEXTURE_CATEGORIES
+};
+
+//how the values of the texture are stored, sRGB ones are decoded to linear by the hardware when sampled (before filtering)
+enum eColorSpace {
+	COLOR_SPACE_LINEAR, //data: normals, masks, HDR
+	COLOR_SPACE_SRGB //colors authored on screen: albedo
+};
+
+//a channel of a packed texture, taken from one channel of a file
+struct sTextureChannel {
+	std::string filename;
+	int source_channel;
+};
 
 //Simple class to handle images (stores RGBA always)
 class Image
@@ -35,7 +72,7 @@ public:
 	Color getPixel(int x, int y) {
 		assert(x >= 0 && x < (int)width && y >= 0 && y < (int)height && "reading of memory");
 		int pos = y*width*bytes_per_pixel + x*bytes_per_pixel;
-		return Color(data[pos], data[pos + 1], data[pos + 2], bytes_per_pixel == 4 ? 255 : data[pos + 3]);
+		return Color(data[pos], data[pos + 1], data[pos + 2], bytes_per_pixel == 4 ? data[pos + 3] : 255);
 	};
 	void setPixel(int x, int y, Color v) {
 		assert(x >= 0 && x < (int)width && y >= 0 && y < (int)height && "writing of memory");
@@ -45,10 +82,12 @@ public:
 
 	Color getPixelInterpolated(float x, float y, bool repeat = false);
 	Vector4 getPixelInterpolatedHigh(float x, float y, bool repeat = false); //returns a Vector4 (floats)
+	void getPixelsInterpolated(const Vector2* coords, int count, Vector4* result, bool repeat = false); //many at once, result in [0,1]
 
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	bool load(const char* filename); //by extension, doesnt use GL so it can be called from any thread
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool saveTGA(const char* filename, bool flip_y = true);
@@ -61,12 +100,17 @@ class Texture
 public:
 	static int default_mag_filter;
 	static int default_min_filter;
+	static eMipFilter mip_filter; //used to bake the mips, changing it rebakes the cached textures
+	static bool cache_default_mips; //TEXTURE_DEFAULT ones are only baked and cached when set, if not they keep their format and GL makes the mips
 	static FBO* global_fbo;
 
 	//a general struct to store all the information about a TGA file
 
 	//textures manager
 	static std::map<std::string, Texture*> sTexturesLoaded;
+	static std::set<std::string> sMissingFiles; //failed to load, they are not read again until ClearMissing
+	static std::set<Texture*> sAllTextures; //alive, for the memory stats
+	static size_t memory_budget; //bytes for the textures in the manager, 0 for no limit
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -79,10 +123,17 @@ public:
 	unsigned int internal_format;
 	unsigned int texture_type; //GL_TEXTURE_2D, GL_TEXTURE_CUBE, GL_TEXTURE_2D_ARRAY
 	bool mipmaps;
+	eColorSpace color_space; //from the internal format
 
 	unsigned int wrapS;
 	unsigned int wrapT;
 
+	//memory accounting and cache
+	eTextureCategory category;
+	size_t memory_size; //bytes in VRAM with all its levels, faces and layers
+	int ref_count; //users of the texture taken from the manager, only the ones without users can be evicted
+	long last_used; //time it was bound, to evict the least recently used
+
 	//original data info
 	Image image;
 
@@ -101,7 +152,10 @@ public:
 	void upload(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	void upload3D(unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	void uploadCubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8** data = NULL, unsigned int internal_format = 0);
+	void uploadCubemapLevel(unsigned int level, Uint8** data); //faces of a smaller level (ex: prefiltered), sampled up to the last one uploaded
 	void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
+	void createArray(unsigned int width, unsigned int height, unsigned int layers, unsigned int internal_format, unsigned int format, unsigned int type, int num_levels, bool wrap = true, int base_level = 0); //empty layers, the levels under base_level are not allocated
+	bool uploadLayer(unsigned int layer, KTX* ktx); //the levels of a 2D texture of the same size and format as the array, from its base level
 
 	void bind();
 	void unbind();
@@ -114,10 +168,37 @@ public:
 
 	//load without using the manager
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
-
-	//load using the manager (caching loaded ones to avoid reloading them)
-	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
-	void setName(const char* name) { sTexturesLoaded[name] = this; }
+	bool load(Image* image, const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE); //from an already decoded image
+	bool load(KTX* ktx, const char* name, bool mipmaps = true, bool wrap = true, bool upload_data = true, int base_level = 0); //uploads the levels stored (or only allocates them), the ones under base_level are left empty
+	bool loadCubemap(const RGBEImage& image, int size, bool mipmaps = true); //RGB16F faces resampled from an equirect .hdr, ex: a sky
+
+	//mips and block compression are baked on CPU and cached next to the source file (ex: albedo.png.bc7.ktx) so it is only done once
+	static eBCFormat getCompressedFormat(eTextureUsage usage);
+	static std::string getCacheFilename(const char* filename, eTextureUsage usage, eBCFormat format);
+	static bool Bake(const char* filename, eTextureUsage usage, eBCFormat format, KTX* ktx, bool wrap = true); //format is ignored for TEXTURE_DEFAULT. Doesnt use GL, can be called from any thread
+
+	//load using the manager (caching loaded ones to avoid reloading them), the caller gets a reference that it must Release
+	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true, eTextureUsage usage = TEXTURE_DEFAULT);
+	//packs up to 4 single channel maps in one texture (ex: occlusion, roughness, metalness), cached with a name made from the sources
+	static Texture* GetPacked(const std::vector<sTextureChannel>& channels, bool mipmaps = true, bool wrap = true);
+	//decodes several files in parallel and registers them, so the Get calls after it find them loaded (usages per file, default if empty)
+	static void Preload(const std::vector<std::string>& filenames, bool mipmaps = true, bool wrap = true, const std::vector<eTextureUsage>& usages = std::vector<eTextureUsage>());
+	void setName(const char* name) { sTexturesLoaded[name] = this; if (category == TEXTURE_CATEGORY_OTHER) category = TEXTURE_CATEGORY_MATERIAL; }
+
+	//the texture registered with this name (NULL if not loaded), only Acquire adds a reference and Release removes it when not used anymore
+	static Texture* Find(const std::string& name);
+	static Texture* Acquire(Texture* texture); //returns the same texture (NULL is ignored)
+	static void Release(Texture* texture);
+	static void ClearMissing() { sMissingFiles.clear(); }
+
+	//evicts textures without references, the least recently used first, until the manager fits in the budget
+	static void EnforceBudget();
+	static size_t getMemoryUsed(int category = -1); //-1 for all
+	static std::string getMemoryStats();
+	static unsigned int getSRGBFormat(unsigned int internal_format); //the sRGB version of a color format, the same if it has none
+	static bool isSRGBFormat(unsigned int internal_format);
+	static size_t computeMemorySize(unsigned int width, unsigned int height, unsigned int depth, unsigned int internal_format, unsigned int format, unsigned int type, int num_levels, int num_faces);
+	void updateMemorySize(int num_levels = 1); //after changing the storage, -1 for the whole mip chain
 
 	void generateMipmaps();
 
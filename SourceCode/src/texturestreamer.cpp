@@ -0,0 +1,245 @@
+#include "texturestreamer.h"
+#include "mesh.h"
+#include "camera.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+TextureStreamer* TextureStreamer::instance = NULL;
+
+TextureStreamer* TextureStreamer::getDefault()
+{
+	if (!instance)
+		instance = new TextureStreamer();
+	return instance;
+}
+
+TextureStreamer::TextureStreamer(size_t vram_budget, unsigned int frame_budget)
+{
+	this->vram_budget = vram_budget;
+	this->frame_budget = frame_budget;
+	vram_used = 0;
+	tail_size = 64;
+	keep_frames = 60;
+	lod_bias = 0.0f;
+	frame = 0;
+	viewport_height = 0;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	//the textures stay in the manager with the levels they have
+	for (auto it = textures.begin(); it != textures.end(); ++it)
+		delete it->second;
+}
+
+Texture* TextureStreamer::load(const char* filename, bool wrap, eTextureUsage usage)
+{
+	eBCFormat format = Texture::getCompressedFormat(usage);
+	std::string name = Texture::getCacheFilename(filename, usage, format);
+	Texture* texture = Texture::Find(name);
+	if (texture || Texture::sMissingFiles.find(filename) != Texture::sMissingFiles.end())
+		return Texture::Acquire(texture);
+
+	long time = getTime();
+	std::cout << " + Texture streaming: " << name << " ... ";
+	sStreamed* streamed = new sStreamed();
+	if (!Texture::Bake(filename, usage, format, &streamed->ktx, wrap))
+	{
+		std::cout << "[ERROR]: Texture not found " << std::endl;
+		Texture::sMissingFiles.insert(filename);
+		delete streamed;
+		return NULL;
+	}
+
+	//first level small enough to be always there
+	KTX& ktx = streamed->ktx;
+	int tail = 0;
+	while (tail < (int)ktx.levels.size() - 1 && std::max(ktx.levels[tail].width, ktx.levels[tail].height) > tail_size)
+		tail++;
+
+	texture = new Texture();
+	texture->load(&ktx, name.c_str(), true, wrap, true, tail);
+	Texture::Acquire(texture); //the caller
+	Texture::Acquire(texture); //the streamer keeps it alive, the levels are accounted in its own budget
+	streamed->texture = texture;
+	streamed->tail_level = streamed->resident_level = tail;
+	streamed->level_used.assign(ktx.levels.size(), -keep_frames - 1);
+	streamed->last_used = -keep_frames - 1;
+	streamed->resident_bytes = 0;
+	for (int i = tail; i < (int)ktx.levels.size(); ++i)
+		streamed->resident_bytes += ktx.levels[i].data.size();
+	vram_used += streamed->resident_bytes;
+	textures[texture] = streamed;
+
+	std::cout << "[OK] Size: " << ktx.width << "x" << ktx.height << " resident from level " << tail << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return texture;
+}
+
+void TextureStreamer::request(Texture* texture, Mesh* mesh, const Matrix44& model, Camera* camera, float uv_scale)
+{
+	if (!texture || !mesh || !isStreamed(texture))
+		return;
+	request(texture, getLevel((unsigned int)texture->width, mesh, model, camera, uv_scale));
+}
+
+int TextureStreamer::getLevel(unsigned int texture_size, Mesh* mesh, const Matrix44& model, Camera* camera, float uv_scale)
+{
+	//the closest point of the bounding sphere decides, inside it the finest level is needed
+	Matrix44 m = model;
+	float scale = std::max(m.rightVector().length(), std::max(m.topVector().length(), m.frontVector().length()));
+	Vector3 center = m * mesh->box.center;
+	float radius = mesh->radius * scale;
+	Vector3 to_camera = camera->eye - center;
+	float dist = to_camera.length();
+	if (dist - radius <= camera->near_plane)
+		return 0;
+	Vector3 nearest = center + to_camera * (radius / dist);
+
+	//m[5] of the projection is 1 / the half height seen at distance 1, so at dist a unit covers m[5] * height / 2 / dist pixels (no dist if orthographic)
+	int height = viewport_height;
+	if (!height)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		height = viewport[3];
+	}
+	float pixels_per_unit = camera->projection_matrix.m[5] * 0.5f * height;
+	if (camera->type == Camera::PERSPECTIVE)
+		pixels_per_unit /= camera->eye.distance(nearest);
+	float uv_density = mesh->getUVDensity() * scale / uv_scale; //world units per uv unit
+	if (pixels_per_unit <= 0.0f || uv_density <= 0.0f)
+		return 0;
+	float texels_per_pixel = texture_size / (uv_density * pixels_per_unit);
+	return std::max(0, (int)floorf(log2f(std::max(texels_per_pixel, 1.0f)) + lod_bias));
+}
+
+void TextureStreamer::request(Texture* texture, int level)
+{
+	auto it = textures.find(texture);
+	if (it == textures.end())
+		return;
+	sStreamed* streamed = it->second;
+	level = std::min(std::max(level, 0), streamed->tail_level);
+	for (int i = level; i <= streamed->tail_level; ++i)
+		streamed->level_used[i] = frame;
+	streamed->last_used = frame;
+}
+
+int TextureStreamer::getTargetLevel(sStreamed* streamed)
+{
+	//a level is kept some frames after it was needed, so it doesnt go and come back when moving
+	int level = streamed->tail_level;
+	while (level > 0 && frame - streamed->level_used[level - 1] <= keep_frames)
+		level--;
+	return level;
+}
+
+void TextureStreamer::setResidentLevel(sStreamed* streamed, int level)
+{
+	KTX& ktx = streamed->ktx;
+	Texture* texture = streamed->texture;
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+
+	//finer levels are uploaded, the dropped ones are respecified empty so the driver can free them
+	for (int i = level; i < streamed->resident_level; ++i)
+	{
+		KTX::sLevel& l = ktx.levels[i];
+		if (ktx.isCompressed())
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, texture->internal_format, l.width, l.height, 0, (GLsizei)l.data.size(), &l.data[0]);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, texture->internal_format, l.width, l.height, 0, texture->format, texture->type, &l.data[0]);
+		streamed->resident_bytes += l.data.size();
+		vram_used += l.data.size();
+	}
+	for (int i = streamed->resident_level; i < level; ++i)
+	{
+		if (ktx.isCompressed())
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, texture->internal_format, 0, 0, 0, 0, NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, texture->internal_format, 0, 0, 0, texture->format, texture->type, NULL);
+		streamed->resident_bytes -= ktx.levels[i].data.size();
+		vram_used -= ktx.levels[i].data.size();
+	}
+
+	streamed->resident_level = level;
+	texture->memory_size = streamed->resident_bytes;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool TextureStreamer::makeRoom(size_t bytes, sStreamed* keep)
+{
+	//drops the finest level of the least recently used textures not visible in this frame
+	while (vram_used + bytes > vram_budget)
+	{
+		sStreamed* oldest = NULL;
+		for (auto it = textures.begin(); it != textures.end(); ++it)
+		{
+			sStreamed* streamed = it->second;
+			if (streamed == keep || streamed->last_used == frame || streamed->resident_level >= streamed->tail_level)
+				continue;
+			if (!oldest || streamed->last_used < oldest->last_used)
+				oldest = streamed;
+		}
+		if (!oldest)
+			return false;
+		setResidentLevel(oldest, oldest->resident_level + 1);
+	}
+	return true;
+}
+
+void TextureStreamer::update()
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	viewport_height = viewport[3];
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	//drop what is not needed anymore, and sort the rest by how blurry they are
+	std::vector<sStreamed*> pending;
+	for (auto it = textures.begin(); it != textures.end(); ++it)
+	{
+		sStreamed* streamed = it->second;
+		int target = getTargetLevel(streamed);
+		if (target > streamed->resident_level)
+			setResidentLevel(streamed, target);
+		else if (target < streamed->resident_level && streamed->last_used == frame)
+			pending.push_back(streamed); //only the ones visible now get more levels
+	}
+	std::sort(pending.begin(), pending.end(), [this](sStreamed* a, sStreamed* b) {
+		return a->resident_level - getTargetLevel(a) > b->resident_level - getTargetLevel(b);
+	});
+
+	//one level at a time, from coarse to fine
+	unsigned int sent = 0;
+	for (size_t i = 0; i < pending.size() && sent < frame_budget; ++i)
+	{
+		sStreamed* streamed = pending[i];
+		int target = getTargetLevel(streamed);
+		while (streamed->resident_level > target && sent < frame_budget)
+		{
+			size_t bytes = streamed->ktx.levels[streamed->resident_level - 1].data.size();
+			if (!makeRoom(bytes, streamed))
+				break;
+			setResidentLevel(streamed, streamed->resident_level - 1);
+			sent += (unsigned int)bytes;
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	frame++;
+}
+
+void TextureStreamer::renderInMenu()
+{
+	ImGui::Text("Streamed VRAM: %.1f / %.1f MBs", vram_used / (1024.0f * 1024.0f), vram_budget / (1024.0f * 1024.0f));
+	ImGui::SliderFloat("Mip bias", &lod_bias, -2.0f, 4.0f);
+	for (auto it = textures.begin(); it != textures.end(); ++it)
+	{
+		sStreamed* streamed = it->second;
+		ImGui::Text("%s: level %d (wanted %d)", streamed->texture->filename.c_str(), streamed->resident_level, getTargetLevel(streamed));
+	}
+}
@@ -0,0 +1,67 @@
+/*  Mip streaming: a streamed texture starts with only its small tail levels, the finer ones are uploaded when something
+	using it is drawn big enough on screen and dropped again when they are not needed, keeping all of them under a VRAM budget.
+	The levels available are limited with GL_TEXTURE_BASE_LEVEL, the baked KTX stays in memory to upload them again.
+*/
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include "includes.h"
+#include "texture.h"
+#include "ktx.h"
+
+#include <map>
+
+class Mesh;
+class Camera;
+
+class TextureStreamer
+{
+public:
+	static TextureStreamer* instance;
+	static TextureStreamer* getDefault();
+
+	size_t vram_budget; //bytes for all the streamed textures
+	size_t vram_used;
+	unsigned int frame_budget; //bytes uploaded per frame
+	unsigned int tail_size; //levels of this size or smaller are always resident
+	int keep_frames; //frames without being requested before the fine levels are dropped
+	float lod_bias; //positive to use blurrier levels
+
+	TextureStreamer(size_t vram_budget = 256 << 20, unsigned int frame_budget = 4 << 20);
+	~TextureStreamer();
+
+	//bakes the texture (or reads its cache) and uploads only the tail, registered in the manager like Texture::Get does
+	Texture* load(const char* filename, bool wrap = true, eTextureUsage usage = TEXTURE_DEFAULT);
+	bool isStreamed(Texture* texture) { return textures.find(texture) != textures.end(); }
+
+	//the level needed to draw the mesh with this texture (uv_scale is the tiling applied in the shader)
+	void request(Texture* texture, Mesh* mesh, const Matrix44& model, Camera* camera, float uv_scale = 1.0f);
+	void request(Texture* texture, int level); //directly
+	//the level of a texture of this size needed to draw the mesh, without requesting it (ex: the arrays of a MaterialAtlas)
+	int getLevel(unsigned int texture_size, Mesh* mesh, const Matrix44& model, Camera* camera, float uv_scale = 1.0f);
+
+	void update(); //once per frame after the requests: drops and uploads levels
+	void renderInMenu();
+
+private:
+	struct sStreamed {
+		Texture* texture;
+		KTX ktx;
+		int tail_level; //first level always resident
+		int resident_level; //finest level uploaded
+		std::vector<long> level_used; //last frame every level was needed
+		long last_used; //frame
+		size_t resident_bytes;
+	};
+
+	std::map<Texture*, sStreamed*> textures;
+	long frame;
+	int viewport_height;
+
+	int getTargetLevel(sStreamed* streamed);
+	void setResidentLevel(sStreamed* streamed, int level);
+	bool makeRoom(size_t bytes, sStreamed* keep);
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include "textureuploader.h"
+#include "threadpool.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+TextureUploader* TextureUploader::instance = NULL;
+
+TextureUploader* TextureUploader::getDefault()
+{
+	if (!instance)
+		instance = new TextureUploader();
+	return instance;
+}
+
+TextureUploader::TextureUploader(unsigned int block_size, int num_blocks, unsigned int frame_budget)
+{
+	this->block_size = block_size;
+	this->num_blocks = num_blocks;
+	this->frame_budget = frame_budget;
+	buffer_id = 0;
+	mapped_data = NULL;
+	persistent = getGLVersion() >= 44;
+	if (persistent)
+		create();
+}
+
+TextureUploader::~TextureUploader()
+{
+	//the tasks write in the jobs and the mapped buffer
+	ThreadPool::getDefault()->wait();
+	for (auto it = jobs.begin(); it != jobs.end(); ++it)
+	{
+		sJob* job = *it;
+		if (job->storage_id && job->storage_id != job->texture->texture_id)
+			glDeleteTextures(1, &job->storage_id);
+		delete job;
+	}
+	jobs.clear();
+	for (size_t i = 0; i < fences.size(); ++i)
+		glDeleteSync(fences[i].fence);
+	fences.clear();
+
+	if (mapped_data)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_id);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	if (buffer_id)
+		glDeleteBuffers(1, &buffer_id);
+}
+
+void TextureUploader::create()
+{
+	glGenBuffers(1, &buffer_id);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_id);
+	//coherent so the workers writes are visible without flushing
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)block_size * num_blocks, NULL, flags);
+	mapped_data = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)block_size * num_blocks, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	assert(mapped_data && "cannot map the staging buffer");
+	checkGLErrors();
+
+	for (int i = num_blocks - 1; i >= 0; --i)
+		free_blocks.push_back(i);
+}
+
+//single level KTX with the decoded pixels, for textures that are not baked
+static void imageToKTX(Image& image, KTX* ktx)
+{
+	bool alpha = image.bytes_per_pixel == 4;
+	ktx->gl_type = GL_UNSIGNED_BYTE;
+	ktx->gl_format = ktx->gl_base_internal_format = alpha ? GL_RGBA : GL_RGB;
+	ktx->gl_internal_format = alpha ? GL_RGBA8 : GL_RGB8;
+	ktx->width = image.width;
+	ktx->height = image.height;
+	ktx->num_faces = 1;
+	ktx->levels.resize(1);
+	ktx->levels[0].width = image.width;
+	ktx->levels[0].height = image.height;
+	ktx->levels[0].data.assign(image.data, image.data + image.width * image.height * image.bytes_per_pixel);
+}
+
+Texture* TextureUploader::load(const char* filename, bool mipmaps, bool wrap, eTextureUsage usage)
+{
+	eBCFormat format = Texture::getCompressedFormat(usage);
+	std::string name = usage != TEXTURE_DEFAULT ? Texture::getCacheFilename(filename, usage, format) : filename;
+	Texture* texture = Texture::Find(name);
+	if (texture || Texture::sMissingFiles.find(filename) != Texture::sMissingFiles.end())
+		return Texture::Acquire(texture);
+
+	//neutral value until the data arrives (a flat normal for normal maps)
+	Uint8 placeholder[4] = { 255, 255, 255, 255 };
+	if (usage == TEXTURE_NORMAL)
+		placeholder[0] = placeholder[1] = 128;
+	texture = new Texture();
+	texture->create(1, 1, GL_RGBA, GL_UNSIGNED_BYTE, false, placeholder);
+	texture->filename = name;
+	texture->setName(name.c_str());
+	Texture::Acquire(texture); //the caller
+	Texture::Acquire(texture); //the job, released when done
+
+	sJob* job = new sJob();
+	job->filename = filename;
+	job->name = name;
+	job->usage = usage;
+	job->format = format;
+	job->mipmaps = mipmaps;
+	job->wrap = wrap;
+	job->texture = texture;
+	job->storage_id = 0;
+	job->state = JOB_DECODING;
+	job->num_staged = job->num_submitted = 0;
+	jobs.push_back(job);
+
+	ThreadPool::getDefault()->addTask([this, job]() {
+		bool ok;
+		if (job->mipmaps || job->usage != TEXTURE_DEFAULT)
+			ok = Texture::Bake(job->filename.c_str(), job->usage, job->format, &job->ktx, job->wrap);
+		else
+		{
+			Image image;
+			ok = image.load(job->filename.c_str());
+			if (ok)
+				imageToKTX(image, &job->ktx);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		job->state = ok ? JOB_DECODED : JOB_FAILED;
+	});
+	return texture;
+}
+
+void TextureUploader::recycleBlocks(bool wait)
+{
+	while (fences.size())
+	{
+		sPendingFence& pending = fences.front();
+		GLenum result = glClientWaitSync(pending.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000 : 0); //1ms
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			if (!wait)
+				break;
+			continue;
+		}
+		glDeleteSync(pending.fence);
+		free_blocks.insert(free_blocks.end(), pending.blocks.begin(), pending.blocks.end());
+		fences.pop_front();
+	}
+}
+
+void TextureUploader::prepareJob(sJob* job)
+{
+	//the storage of all the levels is allocated now in another texture, the data goes later in chunks and the placeholder is used meanwhile
+	KTX& ktx = job->ktx;
+	Texture* texture = job->texture;
+	GLuint placeholder_id = texture->texture_id;
+	texture->texture_id = 0;
+	texture->load(&ktx, job->name.c_str(), job->mipmaps, job->wrap, false);
+	job->storage_id = texture->texture_id;
+	texture->texture_id = placeholder_id;
+
+	//from the coarsest level, so the texture can be used before the finest ones arrive
+	int num_levels = job->mipmaps ? (int)ktx.levels.size() : 1;
+	for (int i = num_levels - 1; i >= 0; --i)
+	{
+		KTX::sLevel& level = ktx.levels[i];
+		int unit_rows = ktx.isCompressed() ? 4 : 1;
+		int num_units = (level.height + unit_rows - 1) / unit_rows;
+		unsigned int unit_size = (unsigned int)level.data.size() / num_units;
+		int units_per_chunk = std::max(1, (int)(block_size / unit_size));
+		for (int u = 0; u < num_units; u += units_per_chunk)
+		{
+			sChunk chunk;
+			chunk.level = i;
+			chunk.y = u * unit_rows;
+			chunk.rows = std::min(units_per_chunk * unit_rows, (int)level.height - chunk.y);
+			chunk.offset = u * unit_size;
+			chunk.size = std::min(units_per_chunk, num_units - u) * unit_size;
+			chunk.block = -1;
+			chunk.ready = !persistent || chunk.size > block_size; //uploaded from the level data
+			job->chunks.push_back(chunk);
+		}
+	}
+	job->state = JOB_UPLOADING;
+}
+
+void TextureUploader::stageChunks(sJob* job)
+{
+	//a worker copies every chunk to its block, the chunks vector doesnt change anymore so they can point to it
+	ThreadPool* pool = ThreadPool::getDefault();
+	while (job->num_staged < (int)job->chunks.size())
+	{
+		sChunk* chunk = &job->chunks[job->num_staged];
+		if (!chunk->ready)
+		{
+			if (free_blocks.empty())
+				break;
+			chunk->block = free_blocks.back();
+			free_blocks.pop_back();
+			unsigned char* dst = mapped_data + (size_t)chunk->block * block_size;
+			const unsigned char* src = &job->ktx.levels[chunk->level].data[chunk->offset];
+			pool->addTask([this, chunk, dst, src]() {
+				memcpy(dst, src, chunk->size);
+				std::lock_guard<std::mutex> lock(mutex);
+				chunk->ready = true;
+			});
+		}
+		job->num_staged++;
+	}
+}
+
+bool TextureUploader::submitChunk(sJob* job, sChunk& chunk)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!chunk.ready)
+			return false;
+	}
+
+	KTX& ktx = job->ktx;
+	KTX::sLevel& level = ktx.levels[chunk.level];
+	Texture* texture = job->texture;
+
+	//from the staging block or straight from memory
+	const void* data = &level.data[chunk.offset];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, chunk.block >= 0 ? buffer_id : 0);
+	if (chunk.block >= 0)
+		data = (const void*)((size_t)chunk.block * block_size);
+
+	glBindTexture(GL_TEXTURE_2D, job->storage_id);
+	if (ktx.isCompressed())
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, chunk.level, 0, chunk.y, level.width, chunk.rows, texture->internal_format, chunk.size, data);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, chunk.level, 0, chunk.y, level.width, chunk.rows, texture->format, texture->type, data);
+	return true;
+}
+
+void TextureUploader::completeLevel(sJob* job, int level)
+{
+	Texture* texture = job->texture;
+	glBindTexture(GL_TEXTURE_2D, job->storage_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level); //only the complete levels are sampled
+	if (texture->texture_id != job->storage_id)
+	{
+		glDeleteTextures(1, &texture->texture_id);
+		texture->texture_id = job->storage_id;
+	}
+}
+
+void TextureUploader::update()
+{
+	if (jobs.empty())
+		return;
+	recycleBlocks(false);
+
+	sPendingFence pending;
+	unsigned int sent = 0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (auto it = jobs.begin(); it != jobs.end() && sent < frame_budget;)
+	{
+		sJob* job = *it;
+		eJobState state;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			state = job->state;
+		}
+		if (state == JOB_DECODING)
+		{
+			++it;
+			continue;
+		}
+		if (state == JOB_FAILED)
+		{
+			std::cout << " [ERROR]: Texture not found " << job->filename << std::endl; //it keeps the placeholder
+			Texture::sMissingFiles.insert(job->filename);
+			Texture::Release(job->texture);
+			delete job;
+			it = jobs.erase(it);
+			continue;
+		}
+		if (state == JOB_DECODED)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			prepareJob(job);
+		}
+
+		stageChunks(job);
+
+		//in order, a level is complete before the next one starts
+		while (job->num_submitted < job->num_staged && sent < frame_budget)
+		{
+			sChunk& chunk = job->chunks[job->num_submitted];
+			if (!submitChunk(job, chunk))
+				break;
+			if (chunk.block >= 0)
+				pending.blocks.push_back(chunk.block);
+			sent += chunk.size;
+			job->num_submitted++;
+			if (job->num_submitted == (int)job->chunks.size() || job->chunks[job->num_submitted].level != chunk.level)
+				completeLevel(job, chunk.level);
+		}
+
+		if (job->num_submitted == (int)job->chunks.size())
+		{
+			Texture::Release(job->texture);
+			delete job;
+			it = jobs.erase(it);
+		}
+		else
+			++it;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	//the blocks are free again once the GPU has read them
+	if (pending.blocks.size())
+	{
+		pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		fences.push_back(pending);
+	}
+}
+
+void TextureUploader::finish()
+{
+	unsigned int budget = frame_budget;
+	frame_budget = 0xFFFFFFFF;
+	while (jobs.size())
+	{
+		ThreadPool::getDefault()->wait();
+		update();
+		recycleBlocks(true);
+	}
+	frame_budget = budget;
+}
+
+int TextureUploader::getNumPending()
+{
+	return (int)jobs.size();
+}
@@ -0,0 +1,91 @@
+/*  Streams textures in without stalling the frame: the thread pool decodes (and bakes) the files and copies the levels to
+	a persistently mapped pixel unpack buffer, the render thread only issues glTexSubImage2D from it, up to a budget of bytes per frame.
+	The staging buffer is split in blocks, a fence tells when the GPU has finished reading a block so it can be reused.
+	Without GL 4.4 the chunks are uploaded from CPU memory, still spread over several frames.
+*/
+
+#ifndef TEXTUREUPLOADER_H
+#define TEXTUREUPLOADER_H
+
+#include "includes.h"
+#include "texture.h"
+#include "ktx.h"
+
+#include <list>
+#include <deque>
+#include <mutex>
+
+class TextureUploader
+{
+public:
+	static TextureUploader* instance;
+	static TextureUploader* getDefault();
+
+	GLuint buffer_id;
+	unsigned int block_size; //biggest chunk staged at once
+	int num_blocks;
+	bool persistent; //staging in a mapped PBO
+	unsigned char* mapped_data;
+	unsigned int frame_budget; //bytes sent to textures per frame
+
+	TextureUploader(unsigned int block_size = 4 << 20, int num_blocks = 16, unsigned int frame_budget = 8 << 20);
+	~TextureUploader();
+
+	//returns the texture right away with a 1x1 placeholder, registered with the name Texture::Get would use. The data arrives some frames later,
+	//from the coarsest level to the finest: the placeholder stays until the coarsest one is complete, then the finer ones appear as they are done
+	Texture* load(const char* filename, bool mipmaps = true, bool wrap = true, eTextureUsage usage = TEXTURE_DEFAULT);
+
+	void update(); //once per frame in the render thread: recycles blocks, allocates the decoded textures and uploads chunks within the budget
+	void finish(); //uploads everything pending, blocking
+	int getNumPending();
+
+private:
+	enum eJobState { JOB_DECODING, JOB_DECODED, JOB_FAILED, JOB_UPLOADING };
+
+	//a range of rows of a level (of blocks of 4 rows if compressed)
+	struct sChunk {
+		int level;
+		int y;
+		int rows;
+		unsigned int offset; //in the level data
+		unsigned int size;
+		int block; //-1 if it is uploaded from the level data
+		bool ready; //copied to the block
+	};
+
+	struct sJob {
+		std::string filename;
+		std::string name;
+		eTextureUsage usage;
+		eBCFormat format;
+		bool mipmaps;
+		bool wrap;
+		Texture* texture;
+		GLuint storage_id; //filled by the chunks, it replaces the placeholder of the texture when its first level is complete
+		KTX ktx;
+		eJobState state;
+		std::vector<sChunk> chunks;
+		int num_staged; //chunks with a block assigned
+		int num_submitted;
+	};
+
+	//blocks read by the uploads of one frame
+	struct sPendingFence {
+		GLsync fence;
+		std::vector<int> blocks;
+	};
+
+	std::list<sJob*> jobs;
+	std::vector<int> free_blocks;
+	std::deque<sPendingFence> fences;
+	std::mutex mutex; //job states and chunk flags, written by the workers
+
+	void create();
+	void recycleBlocks(bool wait);
+	void prepareJob(sJob* job);
+	void stageChunks(sJob* job);
+	bool submitChunk(sJob* job, sChunk& chunk);
+	void completeLevel(sJob* job, int level);
+};
+
+#endif
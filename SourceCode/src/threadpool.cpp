@@ -0,0 +1,125 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+ThreadPool* ThreadPool::getDefault()
+{
+	static ThreadPool* pool = NULL;
+	if (!pool)
+		pool = new ThreadPool();
+	return pool;
+}
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	pending = 0;
+	stop = false;
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	for (int i = 0; i < num_threads; ++i)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stop = true;
+	}
+	task_available.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void ThreadPool::addTask(const std::function<void()>& task)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		tasks.push_back(task);
+		pending++;
+	}
+	task_available.notify_one();
+}
+
+bool ThreadPool::runTask()
+{
+	std::function<void()> task;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (tasks.empty())
+			return false;
+		task = tasks.front();
+		tasks.pop_front();
+	}
+	task();
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		pending--;
+	}
+	task_finished.notify_all();
+	return true;
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_available.wait(lock, [this] { return stop || !tasks.empty(); });
+			if (stop && tasks.empty())
+				return;
+		}
+		runTask();
+	}
+}
+
+void ThreadPool::wait()
+{
+	//help instead of sleeping
+	while (runTask());
+	std::unique_lock<std::mutex> lock(mutex);
+	task_finished.wait(lock, [this] { return pending == 0; });
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& func)
+{
+	if (count <= 0)
+		return;
+	if (count == 1)
+	{
+		func(0);
+		return;
+	}
+
+	//every thread takes the next index until there are no more, so slow items dont stall the rest
+	struct sState {
+		std::atomic<int> next;
+		std::atomic<int> running;
+	};
+	std::shared_ptr<sState> state = std::make_shared<sState>();
+	state->next = 0;
+	int num_helpers = std::min(count - 1, (int)workers.size());
+	state->running = num_helpers;
+
+	auto work = [state, count, &func]() {
+		for (int i = state->next++; i < count; i = state->next++)
+			func(i);
+	};
+	for (int i = 0; i < num_helpers; ++i)
+		addTask([state, work]() { work(); state->running--; });
+
+	work();
+
+	//helpers still busy with their last item (or not started yet), run queued tasks meanwhile
+	while (state->running > 0)
+	{
+		if (!runTask())
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_finished.wait(lock, [&state, this] { return state->running == 0 || !tasks.empty(); });
+		}
+	}
+}
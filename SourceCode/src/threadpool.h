@@ -0,0 +1,44 @@
+/*  Small pool of worker threads to run CPU work (image decoding, baking) in parallel.
+	The thread that waits also runs tasks, so it is safe to call parallelFor from inside a task.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	static ThreadPool* getDefault(); //one worker per core minus the main thread
+
+	ThreadPool(int num_threads = 0); //0 to use all the cores but one
+	~ThreadPool();
+
+	void addTask(const std::function<void()>& task);
+	void wait(); //until all the tasks added are finished
+
+	//calls func(i) for i in [0,count) using all the threads, returns when all are done
+	void parallelFor(int count, const std::function<void(int)>& func);
+
+	int getNumThreads() { return (int)workers.size(); }
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable task_available;
+	std::condition_variable task_finished;
+	int pending; //added but not finished
+	bool stop;
+
+	bool runTask(); //runs one queued task in this thread, false if there was none
+	void workerLoop();
+};
+
+#endif
@@ -5,6 +5,7 @@
 #else
 	#include <sys/time.h>
 #endif
+#include <sys/stat.h>
 
 #include "includes.h"
 
@@ -12,8 +13,9 @@
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
-
-#include "extra/stb_easy_font.h"
+#include "gpuarena.h"
+#include "debugdraw.h"
+#include "texture.h"
 
 long getTime()
 {
@@ -155,6 +157,14 @@ bool readFile(const std::string& filename, std::string& content)
 	return true;
 }
 
+bool isCacheValid(const char* filename, const char* cache_filename)
+{
+	struct stat source_info, cache_info;
+	if (stat(cache_filename, &cache_info) != 0)
+		return false;
+	return stat(filename, &source_info) != 0 || cache_info.st_mtime >= source_info.st_mtime;
+}
+
 bool checkGLErrors()
 {
 	#ifdef _DEBUG
@@ -171,6 +181,39 @@ bool checkGLErrors()
 	return true;
 }
 
+int getGLVersion()
+{
+	static int version = 0;
+	if (!version)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (glGetError() != GL_NO_ERROR) //GL 2.x doesnt know these enums
+		{
+			const char* str = (const char*)glGetString(GL_VERSION);
+			major = str ? str[0] - '0' : 2;
+			minor = str ? str[2] - '0' : 0;
+		}
+		version = major * 10 + minor;
+	}
+	return version;
+}
+
+bool hasGLExtension(const char* name)
+{
+	//the list of GL 3.0, the old string is not there in core profiles
+	GLint num_extensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+	for (GLint i = 0; i < num_extensions; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
 std::vector<std::string>& split(const std::string &s, char delim, std::vector<std::string> &elems) {
     std::stringstream ss(s);
     std::string item;
@@ -198,46 +241,8 @@ Vector2 getDesktopSize( int display_index )
 
 bool drawText(float x, float y, std::string text, Vector3 c, float scale )
 {
-	static char buffer[99999]; // ~500 chars
-	int num_quads;
-
-	if (scale == 0)
-		return true;
-
-	x /= scale;
-	y /= scale;
-
-	if (Shader::current)
-		Shader::current->disable();
-
-	num_quads = stb_easy_font_print(x, y, (char*)(text.c_str()), NULL, buffer, sizeof(buffer));
-
-	Matrix44 projection_matrix;
-	projection_matrix.ortho(0, Application::instance->window_width / scale, Application::instance->window_height / scale, 0, -1, 1);
-
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadMatrixf(Matrix44().m);
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadMatrixf(projection_matrix.m);
-
-	glColor3f(c.x, c.y, c.z);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 16, buffer);
-	glDrawArrays(GL_QUADS, 0, num_quads * 4);
-	glDisableClientState(GL_VERTEX_ARRAY);
-
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-	glPopMatrix();
-
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-
+	//rendered at the end of the frame with the rest of debug primitives
+	DebugDraw::addText(x, y, text, c, scale);
 	return true;
 }
 
@@ -309,37 +314,17 @@ std::string getGPUStats()
 	}
 
 	std::string str = "FPS: " + std::to_string(Application::instance->fps) + " DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB-nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
+	str += "\n" + Texture::getMemoryStats(); //exact, the extension above is only on NVIDIA
+	if (GPUArena::instance)
+		str += "\n" + GPUArena::instance->getStats();
 	Mesh::num_meshes_rendered = 0;
 	Mesh::num_triangles_rendered = 0;
 	return str;
 }
 
-Mesh* grid = NULL;
-
 void drawGrid()
 {
-	if (!grid)
-	{
-		grid = new Mesh();
-		grid->createGrid(10);
-	}
-
-	glLineWidth(1);
-	glEnable(GL_BLEND);
-	glDepthMask(false);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	Shader* grid_shader = Shader::getDefaultShader("grid");
-	grid_shader->enable();
-	Matrix44 m;
-	m.translate(floor(Camera::last_enabled->eye.x / 100.0)*100.0f, 0.0f, floor(Camera::last_enabled->eye.z / 100.0f)*100.0f);
-	grid_shader->setUniform("u_color", Vector4(0.7, 0.7, 0.7, 0.7));
-	grid_shader->setUniform("u_model", m);
-	grid_shader->setUniform("u_camera_position", Camera::last_enabled->eye);
-	grid_shader->setUniform("u_viewprojection", Camera::last_enabled->viewprojection_matrix);
-	grid->render(GL_LINES); //background grid
-	glDisable(GL_BLEND);
-	glDepthMask(true);
-	grid_shader->disable();
+	DebugDraw::addGrid(Camera::last_enabled->eye);
 }
 
 
@@ -15,6 +15,7 @@
 long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
+bool isCacheValid(const char* filename, const char* cache_filename); //the cache exists and is newer than the source (or the source is not there)
 
 //generic purposes fuctions
 void drawGrid();
@@ -23,6 +24,8 @@ Vector3 transformQuat(const Vector3& a, const Quaternion& q);
 
 //check opengl errors
 bool checkGLErrors();
+int getGLVersion(); //major * 10 + minor, ex: 43 for GL 4.3
+bool hasGLExtension(const char* name); //GL 3.0 or newer
 
 std::string getPath();
 